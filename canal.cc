@@ -12,7 +12,17 @@
 #include <exception>
 #include <algorithm>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <limits>
 #include <map>
+#include <set>
+#include <mutex>
+#include <sstream>
+#include <thread>
 #include <err.h>
 
 #include "libpstack/proc.h"
@@ -35,9 +45,6 @@ using namespace std;
 using namespace pstack;
 
 using AddressRanges = std::vector<std::pair<Elf::Off, Elf::Off>>;
-#ifdef WITH_PYTHON
-std::unique_ptr<PythonPrinter<3>> py = nullptr;
-#endif
 
 // does "name" match the glob pattern "pattern"?
 static int
@@ -74,42 +81,81 @@ struct ListedSymbol {
     Elf::Off objbase;
     string name;
     size_t count;
+    size_t idx; // position in the store, for per-worker count arrays.
     string objname;
     ListedSymbol(const Elf::Sym &sym_, Elf::Off objbase_, string name_, string object)
         : sym(sym_)
         , objbase(objbase_)
         , name(name_)
         , count(0)
+        , idx(0)
         , objname(object)
     {}
     Elf::Off memaddr() const { return  sym.st_value + objbase; }
 };
 
 class SymbolStore {
-    std::map<Elf::Off, ListedSymbol> store_;
+    // kept flat and sorted by end address - with thousands of vtables
+    // matching the pattern, the scan does a lot of lookups, and a
+    // contiguous binary search beats chasing map nodes.
+    std::vector<ListedSymbol> store_;
 public:
 
     void add(ListedSymbol symbol) {
-        store_.emplace(symbol.memaddr() + symbol.sym.st_size, symbol);
+        store_.push_back(std::move(symbol));
+    }
+
+    size_t size() const { return store_.size(); }
+
+    // sort by end address and assign each symbol its slot; call once all
+    // symbols are added, before any find().
+    void prepare() {
+        std::sort(store_.begin(), store_.end(),
+              [](const ListedSymbol &l, const ListedSymbol &r) {
+                  return l.memaddr() + l.sym.st_size < r.memaddr() + r.sym.st_size; });
+        size_t idx = 0;
+        for (auto &sym : store_)
+            sym.idx = idx++;
     }
 
+    // The caller passes its previous hit back in as a hint: heap objects of
+    // the same type are adjacent often enough that retrying the last symbol
+    // skips the search entirely.
     template <typename Match>
-    std::tuple<bool, ListedSymbol*> find(Elf::Off address, const Match match) {
-        auto pos = store_.lower_bound(address);
-        auto sym = &pos->second;
-        if (pos != store_.end() && match(address, sym)) {
-            return std::make_tuple(true, sym);
+    std::tuple<bool, const ListedSymbol*> find(Elf::Off address, const Match match,
+          const ListedSymbol *&hint) const {
+        if (hint != nullptr && match(address, hint))
+            return std::make_tuple(true, hint);
+        auto pos = std::lower_bound(store_.begin(), store_.end(), address,
+              [](const ListedSymbol &sym, Elf::Off addr) {
+                  return sym.memaddr() + sym.sym.st_size < addr; });
+        if (pos != store_.end() && match(address, &*pos)) {
+            hint = &*pos;
+            return std::make_tuple(true, hint);
         }
         return std::make_tuple(false, nullptr);
     }
 
-    std::vector<ListedSymbol> flatten() const {
-        std::vector<ListedSymbol> retv;
-        retv.reserve(store_.size());
-        for(const auto & item : store_) {
-            retv.emplace_back( item.second );
+    // Tight bounds around all stored symbols. Candidate symbols cluster
+    // into a few narrow ranges per DSO, so almost every scanned word can be
+    // rejected by one comparison against these before any real lookup.
+    std::pair<Elf::Off, Elf::Off> bounds() const {
+        Elf::Off lo = std::numeric_limits<Elf::Off>::max(), hi = 0;
+        for (auto &sym : store_) {
+            lo = std::min(lo, sym.memaddr());
+            hi = std::max(hi, sym.memaddr() + sym.sym.st_size);
         }
-        return retv;
+        return { lo, hi };
+    }
+
+    // fold one worker's count array back into the store.
+    void merge(const std::vector<size_t> &counts) {
+        for (auto &sym : store_)
+            sym.count += counts[sym.idx];
+    }
+
+    std::vector<ListedSymbol> flatten() const {
+        return store_;
     }
 };
 
@@ -118,6 +164,9 @@ public:
     bool operator()(Elf::Off address, const ListedSymbol * sym) const {
       return sym->memaddr() <= address && sym->memaddr() + sym->sym.st_size > address;
     }
+    // How far past a symbol's extent this matcher can accept an address -
+    // used to widen the scanner's bounds prefilter.
+    Elf::Off maxOffset() const { return 0; }
 };
 
 class OffsetBoundSymbolMatcher {
@@ -127,6 +176,7 @@ public:
     bool operator()(Elf::Off address, const ListedSymbol * sym) const {
        return sym->memaddr() + offset_ == address;
     }
+    Elf::Off maxOffset() const { return offset_; }
 };
 
 struct Usage {
@@ -168,70 +218,228 @@ options:
 
 }
 
-static void findString(const Procman::Process &process,
-      const Procman::AddressRange &segment,
-      const std::string &findstr) {
-   std::vector<char> corestr;
-   corestr.resize(std::max(size_t(4096UL), findstr.size() * 4));
-   for (size_t in, memPos = segment.start, corestrPos = 0; memPos < segment.end; memPos += in) {
-      size_t freeCorestr = corestr.size() - corestrPos;
-      size_t remainingSegment = segment.fileEnd - memPos;
-      size_t readsize = std::min(remainingSegment, freeCorestr);
-      in = process.io->read(memPos, readsize, corestr.data() + corestrPos);
-      assert(in == readsize);
-      corestrPos += in;
-      for (auto found = corestr.begin();; ++found) {
-         found = std::search(corestr.begin(), corestr.begin() + corestrPos, findstr.begin(), findstr.end());
-         if (found == corestr.end())
-            break;
-         IOFlagSave _(cout);
-         std::cout << "0x" << hex << memPos + (found - corestr.begin()) << "\n";
+// A single -S pattern with its Boyer-Moore-Horspool skip table: on a
+// mismatch we advance by the distance from the window's last byte to its
+// rightmost occurrence in the pattern, so most of the core is skipped
+// without being compared at all.
+struct StringMatcher {
+   std::string pattern;
+   size_t skip[256];
+   StringMatcher(const std::string &pattern_) : pattern(pattern_) {
+      for (auto &s : skip)
+         s = pattern.size();
+      for (size_t i = 0; i + 1 < pattern.size(); ++i)
+         skip[(unsigned char)pattern[i]] = pattern.size() - 1 - i;
+   }
+   // offset of the next occurrence in buf[from..len), or len if none.
+   size_t find(const char *buf, size_t len, size_t from) const {
+      size_t n = pattern.size();
+      if (n == 0 || len < n)
+         return len;
+      for (size_t i = from; i <= len - n;) {
+         unsigned char last = buf[i + n - 1];
+         if (last == (unsigned char)pattern[n - 1] &&
+               memcmp(buf + i, pattern.data(), n - 1) == 0)
+            return i;
+         i += skip[last];
       }
-      if (corestrPos >= findstr.size()) {
-         memmove(corestr.data(),
-               corestr.data() + corestrPos - findstr.size() + 1,
-               findstr.size() - 1);
+      return len;
+   }
+};
+
+// Run all the -S patterns over the segment in one pass, in large blocks,
+// carrying enough of each block's tail over to the next to catch matches
+// straddling the boundary.
+static void findStrings(const Procman::Process &process,
+      const Procman::AddressRange &segment,
+      const std::vector<StringMatcher> &patterns,
+      std::ostream &os) {
+   size_t maxlen = 0;
+   for (auto &p : patterns)
+      maxlen = std::max(maxlen, p.pattern.size());
+   std::vector<char> corestr(std::max(size_t(1024 * 1024), maxlen * 4));
+   size_t carried = 0;
+   for (Elf::Off memPos = segment.start; memPos < segment.fileEnd;) {
+      size_t readsize = std::min(Elf::Off(corestr.size() - carried), segment.fileEnd - memPos);
+      size_t in = process.io->read(memPos, readsize, corestr.data() + carried);
+      if (in == 0)
+         break;
+      size_t avail = carried + in;
+      for (auto &p : patterns) {
+         for (size_t at = 0; (at = p.find(corestr.data(), avail, at)) < avail; ++at) {
+            IOFlagSave _(os);
+            os << "0x" << hex << memPos - carried + at << "\n";
+         }
       }
       memPos += in;
+      carried = std::min(avail, maxlen - 1);
+      memmove(corestr.data(), corestr.data() + avail - carried, carried);
    }
 }
 
+// A scan of a large core is dominated by reading the core itself, but leak
+// triage is iterative - the same core gets interrogated several times with
+// different patterns and ranges. So the first word-scan over a file-backed
+// core leaves a compact index beside it, holding every candidate pointer -
+// any word whose value lands within the scanned address space - and later
+// invocations mmap that and answer from it instead of re-reading the
+// segments. The core's size and mtime are recorded to invalidate a stale
+// index.
+struct ScanIndexHeader {
+    uint32_t magic = 0;
+    uint32_t version = 0;
+    uint32_t wordsize = 0;
+    uint32_t unused = 0;
+    uint64_t coreSize = 0;
+    uint64_t coreMtime = 0;
+    uint64_t count = 0;
+};
+constexpr uint32_t scanIndexMagic = 0x6c616e63;
+constexpr uint32_t scanIndexVersion = 1;
+// (value, location) pairs, sorted by value - the shape the reference
+// recorders produce, so range queries and the retain graph are a binary
+// search away.
+using ScanIndexEnt = std::pair<Elf::Off, Elf::Off>;
+
+static Reader::csptr
+loadScanIndex(const std::string &path, const ScanIndexHeader &want,
+      const ScanIndexEnt *&ents, size_t &count) {
+    try {
+        auto io = std::make_shared<MmapReader>(path);
+        auto hdr = io->readObj<ScanIndexHeader>(0);
+        if (hdr.magic != scanIndexMagic
+                || hdr.version != scanIndexVersion
+                || hdr.wordsize != want.wordsize
+                || hdr.coreSize != want.coreSize
+                || hdr.coreMtime != want.coreMtime
+                || io->size() < Reader::Off(sizeof hdr + hdr.count * sizeof (ScanIndexEnt)))
+            return nullptr;
+        const char *base = io->window(0, io->size());
+        if (base == nullptr)
+            return nullptr;
+        ents = reinterpret_cast<const ScanIndexEnt *>(base + sizeof hdr);
+        count = hdr.count;
+        return io;
+    }
+    catch (const std::exception &) {
+        return nullptr;
+    }
+}
+
+static void
+saveScanIndex(const std::string &path, ScanIndexHeader hdr,
+      const std::vector<ScanIndexEnt> &edges) {
+    auto tmp = stringify(path, ".", getpid());
+    int fd = ::open(tmp.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if (fd == -1)
+        return;
+    hdr.magic = scanIndexMagic;
+    hdr.version = scanIndexVersion;
+    hdr.count = edges.size();
+    bool ok = write(fd, &hdr, sizeof hdr) == ssize_t(sizeof hdr)
+        && write(fd, edges.data(), edges.size() * sizeof (ScanIndexEnt))
+                == ssize_t(edges.size() * sizeof (ScanIndexEnt));
+    close(fd);
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+        unlink(tmp.c_str());
+    else if (verbose)
+        *debug << "wrote scan index " << path << " ("
+            << edges.size() << " candidates)\n";
+}
+
+// Collects (target, referrer) edges of the reference graph as the scanners
+// walk their segments: any word holding a plausible pointer - one landing
+// inside the scanned address space - is an edge. Each worker owns one of
+// these, so edges land in a flat per-worker arena with no synchronization;
+// they're stitched together and sorted by target once the scan is done.
+struct RefRecorder {
+    Elf::Off lo = 0;
+    Elf::Off hi = 0;
+    std::vector<std::pair<Elf::Off, Elf::Off>> edges;
+    void note(Elf::Off referrer, Elf::Off target) {
+        if (target >= lo && target < hi)
+            edges.emplace_back(target, referrer);
+    }
+};
+
 template <typename Matcher, typename Word> inline void search(
         const Reader::csptr &view,
         const Matcher & m,
         Elf::Addr loc,
         const AddressRanges &searchaddrs,
-        SymbolStore &store,
-        bool showaddrs) {
+        const SymbolStore &store,
+        std::vector<size_t> &counts,
+        bool showaddrs,
+        RefRecorder *refs,
+#ifdef WITH_PYTHON
+        PythonPrinter<3> *py,
+        std::map<std::string, size_t> *pyCounts,
+#endif
+        std::ostream &os) {
     try {
-        IOFlagSave _(cout);
+        IOFlagSave _(os);
         ReaderArray<Word, 131072> r(*view, 0);
         auto start = r.begin();
         if (searchaddrs.size()) {
+            // hoist the extremes of all the ranges: one predictable
+            // comparison filters the overwhelming majority of words before
+            // the per-range checks. The ranges arrive sorted by start, so
+            // survivors are resolved by binary search - walking back no
+            // further than the longest range can reach.
+            Elf::Off lo = searchaddrs.front().first, hi = 0, maxlen = 0;
+            for (const auto &range : searchaddrs) {
+                hi = std::max(hi, Elf::Off(range.second));
+                maxlen = std::max(maxlen, Elf::Off(range.second - range.first));
+            }
             for (auto cur = start; cur != r.end(); ++cur) {
                 Word p = *cur;
-                for (const auto &range : searchaddrs )
-                    if (p >= range.first && p < range.second)
-                        cout << "0x" << hex << loc + (cur - start) * sizeof( Word) << dec << "\n";
+                if (refs != nullptr)
+                    refs->note(loc + (cur - start) * sizeof (Word), p);
+                if (p < lo || p >= hi)
+                    continue;
+                auto it = std::upper_bound(searchaddrs.begin(), searchaddrs.end(), Elf::Off(p),
+                      [](Elf::Off addr, const std::pair<Elf::Off, Elf::Off> &range) {
+                          return addr < range.first; });
+                while (it != searchaddrs.begin()) {
+                    --it;
+                    if (p - it->first >= maxlen)
+                        break;
+                    if (p < it->second)
+                        os << "0x" << hex << loc + (cur - start) * sizeof( Word) << dec << "\n";
+                }
             }
         } else {
+            // Same idea for the symbol scan: the store's bounds prefilter
+            // keeps the hot loop at plain memory bandwidth - the compiler
+            // can chew through the comparisons without the lookup in its
+            // way. The matcher may probe at a fixed offset past a symbol,
+            // so stretch the top end to suit.
+            auto [ lo, hi ] = store.bounds();
+            hi += m.maxOffset();
+            const ListedSymbol *hint = nullptr;
             for (auto cur = start; cur != r.end(); ++cur) {
                 Word p = *cur;
-                if ( auto [ found, sym ] = store.find(p, m); found) {
+                if (refs != nullptr)
+                    refs->note(loc + (cur - start) * sizeof (Word), p);
+                if (p < lo || p >= hi)
+                    continue;
+                if ( auto [ found, sym ] = store.find(p, m, hint); found) {
                     if (showaddrs)
-                        cout
+                        os
                             << sym->name << " 0x" << std::hex << loc + (cur - start)
                             << std::dec <<  " ... size=" << sym->sym.st_size
                             << ", diff=" << p - sym->memaddr() << endl;
 #ifdef WITH_PYTHON
-                    if (py) {
-                        std::cout << "pyo " << Elf::Addr(loc) << " ";
-                        py->print(Elf::Addr(loc) - sizeof (PyObject) +
-                                sizeof (struct _typeobject *));
-                        std::cout << "\n";
+                    if (py != nullptr) {
+                        auto obj = Elf::Addr(loc) - sizeof (PyObject) +
+                                sizeof (struct _typeobject *);
+                        os << "pyo " << Elf::Addr(loc) << " ";
+                        py->print(obj);
+                        os << "\n";
+                        ++(*pyCounts)[py->objectType(obj)];
                     }
 #endif
-                    sym->count++;
+                    counts[sym->idx]++;
                 }
             }
         }
@@ -243,12 +451,25 @@ template <typename Matcher, typename Word> inline void search(
 template <typename Matcher> void search(int wordsize,
         Procman::Process &process,
         const Matcher & m, const Procman::AddressRange &segment,
-        const AddressRanges &searchaddrs, SymbolStore &store, bool showaddrs) {
+        const AddressRanges &searchaddrs, const SymbolStore &store,
+        std::vector<size_t> &counts, bool showaddrs, RefRecorder *refs,
+#ifdef WITH_PYTHON
+        PythonPrinter<3> *py, std::map<std::string, size_t> *pyCounts,
+#endif
+        std::ostream &os) {
     auto view = process.io->view( "segment view", segment.start, segment.fileEnd - segment.start );
     if (wordsize == 32) {
-        return search<Matcher, uint32_t>(view, m, segment.start, searchaddrs, store, showaddrs);
+        return search<Matcher, uint32_t>(view, m, segment.start, searchaddrs, store, counts, showaddrs, refs,
+#ifdef WITH_PYTHON
+              py, pyCounts,
+#endif
+              os);
     } else if (wordsize == 64) {
-        return search<Matcher, uint64_t>(view, m, segment.start, searchaddrs, store, showaddrs);
+        return search<Matcher, uint64_t>(view, m, segment.start, searchaddrs, store, counts, showaddrs, refs,
+#ifdef WITH_PYTHON
+              py, pyCounts,
+#endif
+              os);
     } else {
         errx(1, "invalid word size %d, must be 32 or 64", wordsize);
     }
@@ -266,7 +487,8 @@ mainExcept(int argc, char *argv[])
     bool showsyms = false;
 
     AddressRanges searchaddrs;
-    std::string findstr;
+    std::vector<Elf::Off> retainaddrs;
+    std::vector<std::string> findstrs;
     int symOffset = -1;
 #ifdef WITH_PYTHON
     bool doPython = false;
@@ -309,7 +531,14 @@ mainExcept(int argc, char *argv[])
           "change previous 'f' option to include all addresses in range ['f' addr, 'e' addr)",
           [&](const char *p) { searchaddrs.back().second = strtoul(p, 0, 0); })
     .add("wordsize", 'w', "wordsize(16 or 32)", "consider address ranges as wordsize-bit values", Flags::set( wordsize ) )
-    .add("string", 'S', "text", "search the core for the text string <text>, and print it's address", Flags::set(findstr))
+    .add("retains", 'R', "address",
+          "record the reference graph during the scan, and report chains of "
+          "references retaining <address> (may be repeated)",
+          [&](const char *p) { retainaddrs.push_back(strtoul(p, 0, 0)); })
+    .add("string", 'S', "text",
+          "search the core for the text string <text>, and print it's address. "
+          "May be repeated; all strings are found in a single pass",
+          [&](const char *data) { if (*data) findstrs.push_back(data); })
     .parse(argc, argv);
 
     if (argc - optind >= 2) {
@@ -327,15 +556,15 @@ mainExcept(int argc, char *argv[])
 
 #ifdef WITH_PYTHON
     PyInterpInfo info;
-    if (doPython) {
+    if (doPython)
        info = getPyInterpInfo(*process);
-       py = make_unique<PythonPrinter<3>>(*process, std::cout, info);
-    }
 #endif
     if (searchaddrs.size()) {
         std::clog << "finding references to " << dec << searchaddrs.size() << " addresses\n";
         for (auto &addr : searchaddrs)
             std::clog << "\t" << addr.first <<" - " << addr.second << "\n";
+        // the scanners binary-search these.
+        std::sort(searchaddrs.begin(), searchaddrs.end());
     }
     clog << "opened process " << process << endl;
 
@@ -365,29 +594,276 @@ mainExcept(int argc, char *argv[])
         if (verbose)
             *debug << "found " << count << " symbols in " << *obj->io << endl;
     }
+    store.prepare();
     if (showsyms)
        exit(0);
 
-    // Now run through the corefile, searching for virtual objects.
+    // If the target is a file-backed core, look for a scan index from an
+    // earlier run beside it. String searches need the raw bytes, and the
+    // python printer walks objects in the core proper, so those still scan.
+    std::string indexPath;
+    ScanIndexHeader indexWant {};
+    indexWant.wordsize = wordsize;
+    struct stat coreStat;
+    if (stat(argv[optind], &coreStat) == 0 && S_ISREG(coreStat.st_mode)) {
+        indexPath = stringify(argv[optind], ".canalidx");
+        indexWant.coreSize = coreStat.st_size;
+        indexWant.coreMtime = coreStat.st_mtime;
+    }
+    const ScanIndexEnt *indexEnts = nullptr;
+    size_t indexCount = 0;
+    Reader::csptr indexReader;
+    if (indexPath != "" && findstrs.empty()
+#ifdef WITH_PYTHON
+            && !doPython
+#endif
+            )
+        indexReader = loadScanIndex(indexPath, indexWant, indexEnts, indexCount);
+
     auto as = process->addressSpace();
-    for (auto &segment : as ) {
-        if (verbose) {
-            IOFlagSave _(*debug);
-            *debug << "scan " << hex << segment.start <<  " to " << segment.start + segment.fileEnd;
+    // (target, referrer) candidate-pointer edges, ordered by target - from
+    // the recorders after a scan, or straight from the index.
+    std::vector<ScanIndexEnt> edges;
+
+    if (indexReader != nullptr) {
+        // Sub-second path: every candidate pointer in the core is in the
+        // index, so symbol and range queries are binary searches over it.
+        if (verbose)
+            *debug << "loaded scan index " << indexPath << " ("
+                << dec << indexCount << " candidates)\n";
+        IOFlagSave _(cout);
+        if (searchaddrs.size()) {
+            for (auto &range : searchaddrs) {
+                auto pos = std::lower_bound(indexEnts, indexEnts + indexCount,
+                      range.first,
+                      [](const ScanIndexEnt &ent, Elf::Off addr) {
+                          return ent.first < addr; });
+                for (; pos != indexEnts + indexCount && pos->first < range.second; ++pos)
+                    cout << "0x" << hex << pos->second << dec << "\n";
+            }
+        } else {
+            auto [ lo, hi ] = store.bounds();
+            hi += symOffset > 0 ? Elf::Off(symOffset) : 0;
+            std::vector<size_t> counts(store.size());
+            const ListedSymbol *hint = nullptr;
+            auto pos = std::lower_bound(indexEnts, indexEnts + indexCount, lo,
+                  [](const ScanIndexEnt &ent, Elf::Off addr) {
+                      return ent.first < addr; });
+            for (; pos != indexEnts + indexCount && pos->first < hi; ++pos) {
+                bool found;
+                const ListedSymbol *sym;
+                if (symOffset > 0)
+                    std::tie(found, sym) = store.find(pos->first,
+                          OffsetBoundSymbolMatcher(symOffset), hint);
+                else
+                    std::tie(found, sym) = store.find(pos->first,
+                          OffsetFreeSymbolMatcher(), hint);
+                if (found) {
+                    if (showaddrs)
+                        cout << sym->name << " 0x" << hex << pos->second
+                            << dec << " ... size=" << sym->sym.st_size
+                            << ", diff=" << pos->first - sym->memaddr() << endl;
+                    counts[sym->idx]++;
+                }
+            }
+            store.merge(counts);
+        }
+        if (!retainaddrs.empty())
+            edges.assign(indexEnts, indexEnts + indexCount);
+    } else {
+        // Now run through the corefile, searching for virtual objects. Segments
+        // are independent, so split them over a pool of workers. Each worker
+        // counts hits into its own array (merged below), and buffers its text
+        // output per segment so concurrent findings don't interleave.
+        size_t nthreads = std::min<size_t>(std::thread::hardware_concurrency(), as.size());
+        if (nthreads < 1)
+            nthreads = 1;
+        std::vector<StringMatcher> stringMatchers;
+        for (auto &findstr : findstrs)
+            stringMatchers.emplace_back(findstr);
+        // Each worker collects pointer edges as it scans - for -R, and to
+        // build the scan index. Only words landing inside the scanned address
+        // space are worth keeping.
+        bool buildIndex = indexPath != "" && stringMatchers.empty();
+        std::vector<RefRecorder> refRecorders(
+              retainaddrs.empty() && !buildIndex ? 0 : nthreads);
+        if (!refRecorders.empty()) {
+            Elf::Off asLo = std::numeric_limits<Elf::Off>::max(), asHi = 0;
+            for (auto &segment : as) {
+                asLo = std::min(asLo, segment.start);
+                asHi = std::max(asHi, Elf::Addr(segment.fileEnd));
+            }
+            for (auto &r : refRecorders) {
+                r.lo = asLo;
+                r.hi = asHi;
+            }
         }
-        if (findstr != "") {
-           findString( *process, segment, findstr );
+        std::mutex outputLock;
+        std::atomic<size_t> nextSegment { 0 };
+        std::vector<std::vector<size_t>> workerCounts(nthreads, std::vector<size_t>(store.size()));
+#ifdef WITH_PYTHON
+        // The python printer and its cache are single-threaded, so each
+        // worker owns a private pair, bound to the worker's buffer. Objects
+        // are also tallied by type name per worker; the histograms merge
+        // after the scan.
+        std::vector<std::map<std::string, size_t>> workerPyCounts(nthreads);
+#endif
+        auto worker = [&](size_t me) {
+            // the buffer outlives each segment so the python printer can be
+            // bound to it once; it's flushed and reset as segments finish.
+            std::ostringstream buf;
+#ifdef WITH_PYTHON
+            PythonCache pycache;
+            std::unique_ptr<PythonPrinter<3>> py;
+            if (doPython)
+                py = make_unique<PythonPrinter<3>>(*process, buf, info, pycache);
+#endif
+            for (;;) {
+                size_t i = nextSegment++;
+                if (i >= as.size())
+                    return;
+                auto &segment = as[i];
+                if (verbose) {
+                    IOFlagSave _(*debug);
+                    *debug << "scan " << hex << segment.start <<  " to " << segment.start + segment.fileEnd;
+                }
+                // with one worker and no printer bound to the buffer, write
+                // straight to stdout.
+                std::ostream &os = nthreads == 1
+#ifdef WITH_PYTHON
+                      && !doPython
+#endif
+                      ? static_cast<std::ostream &>(cout) : buf;
+                RefRecorder *refs = refRecorders.empty() ? nullptr : &refRecorders[me];
+                if (!stringMatchers.empty()) {
+                   findStrings( *process, segment, stringMatchers, os );
+                } else {
+                    if (symOffset > 0)
+                        search<OffsetBoundSymbolMatcher>(wordsize, *process,
+                              OffsetBoundSymbolMatcher(symOffset),
+                              segment, searchaddrs, store, workerCounts[me], showaddrs, refs,
+#ifdef WITH_PYTHON
+                              py.get(), &workerPyCounts[me],
+#endif
+                              os);
+                    else
+                        search<OffsetFreeSymbolMatcher>(wordsize, *process,
+                              OffsetFreeSymbolMatcher(),
+                              segment, searchaddrs, store, workerCounts[me], showaddrs, refs,
+#ifdef WITH_PYTHON
+                              py.get(), &workerPyCounts[me],
+#endif
+                              os);
+                }
+                auto text = buf.str();
+                if (text != "") {
+                    std::lock_guard<std::mutex> lock(outputLock);
+                    cout << text;
+                    buf.str("");
+                }
+            }
+        };
+        if (nthreads > 1) {
+            std::vector<std::future<void>> workers;
+            workers.reserve(nthreads);
+            for (size_t i = 0; i < nthreads; ++i)
+                workers.push_back(std::async(std::launch::async, worker, i));
+            for (auto &w : workers)
+                w.get();
         } else {
-            if (symOffset > 0)
-                search<OffsetBoundSymbolMatcher>(wordsize, *process,
-                      OffsetBoundSymbolMatcher(symOffset),
-                      segment, searchaddrs, store, showaddrs);
-            else
-                search<OffsetFreeSymbolMatcher>(wordsize, *process,
-                      OffsetFreeSymbolMatcher(),
-                      segment, searchaddrs, store, showaddrs);
+            worker(0);
+        }
+        for (auto &counts : workerCounts)
+            store.merge(counts);
+
+#ifdef WITH_PYTHON
+        if (doPython) {
+            // fold the per-worker type tallies together and report the
+            // census, biggest first.
+            std::map<std::string, size_t> pyHist;
+            for (auto &counts : workerPyCounts)
+                for (auto &[type, n] : counts)
+                    pyHist[type] += n;
+            std::vector<std::pair<std::string, size_t>> byCount(
+                  pyHist.begin(), pyHist.end());
+            std::sort(byCount.begin(), byCount.end(),
+                  [](const auto &l, const auto &r) { return l.second > r.second; });
+            for (auto &[type, n] : byCount)
+                cout << dec << n << " python " << type << "\n";
+        }
+#endif
+
+        if (!refRecorders.empty()) {
+            // Stitch the workers' arenas into one edge list ordered by target:
+            // the reverse edges for any address are then a binary search away.
+            size_t total = 0;
+            for (auto &r : refRecorders)
+                total += r.edges.size();
+            edges.reserve(total);
+            for (auto &r : refRecorders) {
+                edges.insert(edges.end(), r.edges.begin(), r.edges.end());
+                r.edges = {};
+            }
+            std::sort(edges.begin(), edges.end());
+            if (buildIndex)
+                saveScanIndex(indexPath, indexWant, edges);
         }
     }
+
+    if (!retainaddrs.empty()) {
+        clog << "recorded " << dec << edges.size() << " references\n";
+
+        // describe an address: a matched symbol if one covers it, else the
+        // backing of the segment it lies in.
+        auto describe = [&](Elf::Off addr) -> std::string {
+            const ListedSymbol *hint = nullptr;
+            if (auto [found, sym] = store.find(addr, OffsetFreeSymbolMatcher(), hint); found)
+                return sym->name + "+" + std::to_string(addr - sym->memaddr());
+            auto seg = std::upper_bound(as.begin(), as.end(), addr,
+                  [](Elf::Off a, const Procman::AddressRange &r) { return a < r.start; });
+            if (seg != as.begin() && addr < (--seg)->end)
+                return seg->backing.path != "" ? seg->backing.path : "anon";
+            return "?";
+        };
+
+        // Walk the graph backwards, printing each retaining chain. We don't
+        // know the base address of the heap object a referring word lies
+        // in, so past the first level we accept references to any address
+        // shortly at or before the word - wide enough to catch most
+        // objects' headers, narrow enough not to drown in noise.
+        constexpr Elf::Off window = 256;
+        constexpr size_t maxDepth = 4, maxFanout = 10;
+        std::set<Elf::Off> visited;
+        std::function<void(Elf::Off, Elf::Off, size_t)> retainers =
+              [&](Elf::Off lo, Elf::Off hi, size_t depth) {
+            auto pos = std::lower_bound(edges.begin(), edges.end(),
+                  std::make_pair(lo, Elf::Off(0)));
+            size_t shown = 0;
+            IOFlagSave _(cout);
+            for (auto it = pos; it != edges.end() && it->first <= hi; ++it) {
+                if (++shown > maxFanout) {
+                    cout << std::string(depth * 2, ' ') << "...\n";
+                    break;
+                }
+                cout << std::string(depth * 2, ' ')
+                    << "0x" << hex << it->second << " (" << describe(it->second) << ")"
+                    << " -> 0x" << it->first << dec << "\n";
+                if (depth < maxDepth && visited.insert(it->second).second)
+                    retainers(it->second > window ? it->second - window + 1 : 0,
+                          it->second, depth + 1);
+            }
+        };
+        for (auto addr : retainaddrs) {
+            {
+                IOFlagSave _(cout);
+                cout << "retainers of 0x" << hex << addr << dec << ":\n";
+            }
+            visited.clear();
+            visited.insert(addr);
+            retainers(addr, addr, 1);
+        }
+    }
+
     auto histogram = store.flatten();
     sort(histogram.begin(), histogram.end(),
       [](const ListedSymbol &l, const ListedSymbol &r) { return l.count > r.count; });
@@ -13,33 +13,35 @@ CoreProcess::CoreProcess(Elf::Object::sptr exec, Elf::Object::sptr core,
      , prpsinfo{}
      , coreImage(std::move(core))
 {
+   // Index the notes in one pass. The kernel writes each LWP's notes
+   // after its NT_PRSTATUS, so notes are attributed to the most recent
+   // task seen; everything is also filed under lwp 0 (first occurrence
+   // wins) for process-wide lookups like NT_AUXV.
+   lwpid_t curLwp = 0;
    for (auto note : coreImage->notes()) {
-      if (note.name() == "CORE") {
-         switch  (note.type() ) {
-            case NT_PRSTATUS: {
-               // for NT_PRSTATUS notes, mark the index of the current note in our
-               // vector as the start of the notes for that LWP. When looking
-               // for an LWP-related note, we start at the index for that LWPs
-               // NT_PRSTATUS, and consider it a failure if we reach another
-               // NT_PRSTATUS or the end of the list.
-               auto task = note.data()->readObj<prstatus_t>(0);
-               lwpToPrStatusIdx[task.pr_pid] = notes.size();
-               break;
-            }
-            case NT_PRPSINFO: {
-               note.data()->readObj(0, &prpsinfo); // hold on to a copy of this
-               break;
-            }
-            default:
-               break;
+      if (note.name() != "CORE")
+         continue;
+      switch (note.type()) {
+         case NT_PRSTATUS: {
+            auto task = note.data()->readObj<prstatus_t>(0);
+            curLwp = task.pr_pid;
+            prStatuses[curLwp] = task;
+            break;
+         }
+         case NT_PRPSINFO: {
+            note.data()->readObj(0, &prpsinfo); // hold on to a copy of this
+            break;
          }
+         default:
+            break;
       }
-      notes.push_back( note );
+      noteIndex.emplace(std::make_pair(int(note.type()), curLwp), note.data());
+      noteIndex.emplace(std::make_pair(int(note.type()), lwpid_t(0)), note.data());
    }
 }
 
 void CoreProcess::listLWPs(std::function<void(lwpid_t)> cb) {
-   for (auto &task : lwpToPrStatusIdx)
+   for (auto &task : prStatuses)
       cb(task.first);
 }
 
@@ -47,12 +49,9 @@ Reader::csptr
 CoreProcess::getAUXV() const
 {
 #ifdef __linux__
-    for (const auto &note : notes) {
-       if (note.name() == "CORE" && note.type() == NT_AUXV) {
-           return note.data();
-           break;
-       }
-    }
+    auto it = noteIndex.find({NT_AUXV, 0});
+    if (it != noteIndex.end())
+        return it->second;
 #endif
     return {};
 }
@@ -137,34 +136,42 @@ CoreReader::read(Off remoteAddr, size_t size, char *ptr) const
     return remoteAddr - start;
 }
 
+const char *
+CoreReader::window(Off remoteAddr, size_t size) const
+{
+    if (core == nullptr)
+        return nullptr;
+    const Elf::Phdr *hdr = core->getSegmentForAddress(remoteAddr);
+    if (hdr == nullptr)
+        return nullptr;
+    Elf::Off off = remoteAddr - hdr->p_vaddr;
+    // Only file-backed content can be windowed - zero-fill tails and ranges
+    // spanning segments need read()'s assembly logic.
+    if (size > hdr->p_filesz || off > hdr->p_filesz - size)
+        return nullptr;
+    return core->io->window(hdr->p_offset + off, size);
+}
+
 CoreReader::CoreReader(Process *p_, Elf::Object::sptr core_) : p(p_), core(std::move( core_ ) ) { }
 
 size_t
 CoreProcess::getRegs(lwpid_t lwpid, int code, size_t size, void *data)
 {
-   auto idx = lwpToPrStatusIdx.find( lwpid );
-   if ( idx == lwpToPrStatusIdx.end() ) {
-      return 0;
-   }
-   for (size_t i = idx->second;;) {
-      if (notes[i].type() == code) {
-         if (code == NT_PRSTATUS) {
-            auto prstatus = notes[i].data()->readObj<prstatus_t>(0);
-            size = std::min(size, sizeof prstatus.pr_reg);
-            memcpy(data, &prstatus.pr_reg, size);
-         } else {
-            size = std::min(size, size_t(notes[i].data()->size()));
-            notes[i].data()->read(0, size, reinterpret_cast<char *>(data));
-         }
-         return size;
-      }
-      ++i;
-      if (i == notes.size() || ( notes[i].type() == NT_PRSTATUS && notes[i].name() == "CORE") ) {
-         // We're done if that's all the notes, or the next note is the start of a new LWP.
-         break;
-      }
+   if (code == NT_PRSTATUS) {
+      // served from the copy decoded at construction.
+      auto it = prStatuses.find(lwpid);
+      if (it == prStatuses.end())
+         return 0;
+      size = std::min(size, sizeof it->second.pr_reg);
+      memcpy(data, &it->second.pr_reg, size);
+      return size;
    }
-   return 0;
+   auto it = noteIndex.find({code, lwpid});
+   if (it == noteIndex.end())
+      return 0;
+   size = std::min(size, size_t(it->second->size()));
+   it->second->read(0, size, reinterpret_cast<char *>(data));
+   return size;
 }
 
 void
@@ -2,8 +2,14 @@
 #include "libpstack/dwarf.h"
 #include "libpstack/dwarf_reader.h"
 #include <sys/procfs.h>
+#include <atomic>
+#include <condition_variable>
+#include <future>
 #include <iomanip>
+#include <mutex>
 #include <set>
+#include <sstream>
+#include <thread>
 #include <string.h>
 
 #if ELF_BITS == 64
@@ -229,24 +235,29 @@ std::ostream &operator << (std::ostream &os, const JSON<Dwarf::FileEntry> &jobj)
 }
 
 template <typename C>
-std::ostream &operator << (std::ostream &os, const JSON<Dwarf::LineState, C> &jo) {
-    auto &ls = jo.object;
+std::ostream &operator << (std::ostream &os, const JSON<Dwarf::LineRow, C> &jo) {
+    auto &row = jo.object;
     return JObject(os)
-        .field("file", *ls.file)
-        .field("line", ls.line)
-        .field("addr", ls.addr);
+        .field("file", *row.file)
+        .field("line", row.line)
+        .field("addr", row.addr);
 }
 
 template <typename C>
 std::ostream &operator << (std::ostream &os, const JSON<Dwarf::LineInfo, C> &jo) {
     auto &lines = jo.object;
-    return JObject(os)
+    JObject o(os);
+    o
         .field("default_is_stmt",  lines.default_is_stmt)
         .field("opcode_base", int(lines.opcode_base))
         .field("opcode_lengths", lines.opcode_lengths)
         .field("files", lines.files)
-        .field("directories", lines.directories)
-        .field("matrix", lines.matrix);
+        .field("directories", lines.directories);
+    // stream the matrix a row at a time rather than flattening every
+    // sequence into one big vector first.
+    JArray matrix(o.streamField("matrix"));
+    lines.eachRow([&](const Dwarf::LineRow &row) { matrix.element(row); });
+    return os;
 }
 
 std::ostream & operator << (std::ostream &os, const JSON<Dwarf::DIE> &jo) {
@@ -517,11 +528,82 @@ operator << (std::ostream &os, const JSON<Dwarf::Macros> &mi)
     // XXX: use a visitor to generate details?
 }
 
+namespace {
+
+// The unit list of an Info, rendered by a pool of workers: units are
+// independent, so each is serialized into its own buffer, and the merger
+// streams the buffers out in unit order as they become ready. Memory is
+// bounded by the units in flight - each buffer is released once written, and
+// the unit emitter purges its DIEs as it finishes.
+struct ParallelUnitDump {
+    const Dwarf::Info &info;
+    explicit ParallelUnitDump(const Dwarf::Info &info_) : info(info_) {}
+};
+
+std::ostream &
+operator << (std::ostream &os, const JSON<ParallelUnitDump> &jd)
+{
+    std::vector<Dwarf::Unit::sptr> units;
+    for (const auto &u : jd.object.info.getUnits())
+        units.push_back(u);
+
+    std::mutex lock;
+    std::condition_variable rendered;
+    struct Slot {
+        bool done = false;
+        std::string content;
+    };
+    std::vector<Slot> slots(units.size());
+    std::atomic<size_t> next { 0 };
+
+    auto nthreads = std::min<size_t>(std::thread::hardware_concurrency(), units.size());
+    std::vector<std::future<void>> work;
+    work.reserve(nthreads);
+    for (size_t t = 0; t < nthreads; ++t) {
+        work.push_back(std::async(std::launch::async, [&] {
+            for (;;) {
+                size_t i = next++;
+                if (i >= units.size())
+                    return;
+                std::ostringstream buf;
+                buf << json(units[i]);
+                std::lock_guard<std::mutex> guard(lock);
+                slots[i].content = buf.str();
+                slots[i].done = true;
+                rendered.notify_all();
+            }
+        }));
+    }
+
+    os << "[ ";
+    const char *sep = "";
+    for (size_t i = 0; i < units.size(); ++i) {
+        std::string content;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            rendered.wait(guard, [&] { return slots[i].done; });
+            content = std::move(slots[i].content);
+            slots[i].content = {};
+        }
+        os << sep << content;
+        sep = ",\n";
+    }
+    os << " ]";
+    for (auto &w : work)
+        w.get();
+    return os;
+}
+
+}
+
 std::ostream &
 operator << (std::ostream &os, const JSON<Dwarf::Info> &di)
 {
     JObject writer(os);
-    writer.field("units", di.object.getUnits())
+    // The dump reads from an mmap'd image, so the units can be decoded in
+    // parallel before we serialize them.
+    di.object.preloadUnits();
+    writer.field("units", ParallelUnitDump(di.object))
         .field("pubnameUnits", di.object.pubnames())
         ; // XXX .field("aranges", di->getARanges());
 
@@ -655,7 +737,7 @@ std::ostream &operator<< (std::ostream &os, const JSON<Elf::Object> &elf)
         .field("type", typeNames[ehdr.e_type])
         .field("entry", ehdr.e_entry)
         .field("abi", brand < sizeof abiNames / sizeof abiNames[0]? abiNames[brand] : nullptr)
-        .field("sections", elf.object.sectionHeaders)
+        .field("sections", elf.object.sections())
         .field("segments", mappedSegments, &elf.object)
         .field("notes", elf.object.notes())
         .field("versioninfo", *elf.object.symbolVersions())
@@ -13,15 +13,21 @@ ImageCache::getDwarf(const std::string &filename)
 Info::sptr
 ImageCache::getDwarf(Elf::Object::sptr object)
 {
-    auto it = dwarfCache.find(object);
-    dwarfLookups++;
-    if (it != dwarfCache.end()) {
-        dwarfHits++;
-        return it->second;
+    {
+        std::lock_guard<std::mutex> guard(dwarfLock);
+        auto it = dwarfCache.find(object);
+        dwarfLookups++;
+        if (it != dwarfCache.end()) {
+            dwarfHits++;
+            return it->second;
+        }
     }
+    // Construct the Info without the lock held - it loads debug sections, and
+    // may come back through the ELF image cache. If we raced another thread
+    // here, the first insert wins and the duplicate is discarded.
     auto dwarf = std::make_shared<Info>(object, *this);
-    dwarfCache[object] = dwarf;
-    return dwarf;
+    std::lock_guard<std::mutex> guard(dwarfLock);
+    return dwarfCache.emplace(object, dwarf).first->second;
 }
 
 ImageCache::ImageCache() : dwarfHits(0), dwarfLookups(0) { }
@@ -36,6 +42,7 @@ void
 ImageCache::flush(Elf::Object::sptr o)
 {
     Elf::ImageCache::flush(o);
+    std::lock_guard<std::mutex> guard(dwarfLock);
     dwarfCache.erase(o);
 }
 
@@ -1,4 +1,5 @@
 #include "libpstack/dwarf.h"
+#include "libpstack/stats.h"
 #include "libpstack/dwarf_reader.h"
 #include "libpstack/global.h"
 #include "libpstack/stringify.h"
@@ -9,13 +10,14 @@ namespace pstack::Dwarf {
 
 class DIE::Raw {
     const Abbreviation *type;
-    std::vector<DIE::Attribute::Value> values;
+    // values, and any Blocks they point at, live in the unit's arena - no
+    // per-DIE cleanup is required.
+    std::vector<DIE::Attribute::Value, ArenaAllocator<DIE::Attribute::Value>> values;
     Elf::Off parent; // 0 implies we do not yet know the parent's offset.
     Elf::Off firstChild;
     Elf::Off nextSibling;
 public:
     Raw(Unit *unit, DWARFReader &r, size_t abbr, Elf::Off parent);
-    ~Raw();
     // Mostly, Raw DIEs are hidden from everything. DIE needs access though
     friend class DIE;
     static std::shared_ptr<Raw> decode(Unit *unit, const DIE &parent, Elf::Off offset);
@@ -37,14 +39,22 @@ DIE::nextSibling(const DIE &parent) const
 {
 
     if (raw->nextSibling == 0) {
-        // Need to work out what the next sibling is, and we don't have DW_AT_sibling
-        // Run through all our children. decodeEntries will update the
-        // parent's (our) nextSibling.
-        std::shared_ptr<Raw> last = nullptr;
-        for (auto &it : children())
-            last = it.raw;
-        if (last)
-            last->nextSibling = 0;
+        // No DW_AT_sibling. An earlier traversal may have worked the offset
+        // out already - the raw DIE holding it may have been purged since.
+        std::lock_guard<std::recursive_mutex> guard(unit->unitLock);
+        auto memo = unit->siblingOffsets.find(offset);
+        if (memo != unit->siblingOffsets.end()) {
+            raw->nextSibling = memo->second;
+        } else {
+            // Run through all our children. decodeEntries will update the
+            // parent's (our) nextSibling.
+            std::shared_ptr<Raw> last = nullptr;
+            for (auto &it : children())
+                last = it.raw;
+            if (last)
+                last->nextSibling = 0;
+            unit->siblingOffsets[offset] = raw->nextSibling;
+        }
     }
     return unit->offsetToDIE(parent, raw->nextSibling);
 }
@@ -100,13 +110,8 @@ DIE::containsAddress(Elf::Addr addr) const
     auto rangeattr = attribute(DW_AT_ranges);
     if (rangeattr.valid()) {
         const auto &ranges = unit->getRanges(*this, low.valid() ? uintmax_t(low) : 0);
-        if (ranges != nullptr) {
-            // Iterate over the ranges, and see if the address lies inside.
-            for (const Ranges::value_type &range : *ranges)
-                if (range.first <= addr && addr <= range.second)
-                    return ContainsAddr::YES;
-            return ContainsAddr::NO;
-        }
+        if (ranges != nullptr)
+            return ranges->contains(addr) ? ContainsAddr::YES : ContainsAddr::NO;
     }
     return ContainsAddr::UNKNOWN;
 }
@@ -148,19 +153,21 @@ DIE::attribute(AttrName name, bool local) const
     return {};
 }
 
-std::string
+std::string_view
 DIE::name() const
 {
     auto attr = attribute(DW_AT_name);
-    return attr.valid() ? std::string(attr) : "";
+    return attr.valid() ? std::string_view(attr) : std::string_view();
 }
 
 DIE::Raw::Raw(Unit *unit, DWARFReader &r, size_t abbrev, Elf::Off parent_)
     : type(unit->findAbbreviation(abbrev))
+    , values(ArenaAllocator<DIE::Attribute::Value>(unit->arena))
     , parent(parent_)
     , firstChild(0)
     , nextSibling(0)
 {
+    stats::count(stats::diesMaterialized);
     size_t i = 0;
     values.reserve(type->forms.size());
     for (auto &form : type->forms) {
@@ -270,21 +277,21 @@ DIE::Attribute::Value::Value(DWARFReader &r, const FormEntry &forment, Unit *uni
         break;
 
     case DW_FORM_block1:
-        block = new Block();
+        block = unit->arena->make<Block>();
         block->length = r.getu8();
         block->offset = r.getOffset();
         r.skip(block->length);
         break;
 
     case DW_FORM_block2:
-        block = new Block();
+        block = unit->arena->make<Block>();
         block->length = r.getu16();
         block->offset = r.getOffset();
         r.skip(block->length);
         break;
 
     case DW_FORM_block4:
-        block = new Block();
+        block = unit->arena->make<Block>();
         block->length = r.getu32();
         block->offset = r.getOffset();
         r.skip(block->length);
@@ -292,7 +299,7 @@ DIE::Attribute::Value::Value(DWARFReader &r, const FormEntry &forment, Unit *uni
 
     case DW_FORM_exprloc:
     case DW_FORM_block:
-        block = new Block();
+        block = unit->arena->make<Block>();
         block->length = r.getuleb128();
         block->offset = r.getOffset();
         r.skip(block->length);
@@ -325,25 +332,6 @@ DIE::Attribute::Value::Value(DWARFReader &r, const FormEntry &forment, Unit *uni
     }
 }
 
-DIE::Raw::~Raw()
-{
-    int i = 0;
-    for (auto &forment : type->forms) {
-        switch (forment.form) {
-            case DW_FORM_exprloc:
-            case DW_FORM_block:
-            case DW_FORM_block1:
-            case DW_FORM_block2:
-            case DW_FORM_block4:
-                delete values[i].block;
-                break;
-            default:
-                break;
-        }
-        ++i;
-    }
-}
-
 void walk(const DIE & die) { for (auto c : die.children()) { walk(c); } };
 
 Elf::Off
@@ -380,7 +368,8 @@ DIE::decode(Unit *unit, const DIE &parent, Elf::Off offset)
             parent.raw->nextSibling = r.getOffset();
         return nullptr;
     }
-    return std::make_shared<DIE::Raw>(unit, r, abbrev, parent.getOffset());
+    return std::allocate_shared<DIE::Raw>(
+          ArenaAllocator<DIE::Raw>(unit->arena), unit, r, abbrev, parent.getOffset());
 }
 
 DIE::Children::const_iterator &DIE::Children::const_iterator::operator++() {
@@ -544,6 +533,41 @@ Ranges::Ranges(const DIE &die, uintmax_t base) {
             }
         }
     }
+    // Keep the list sorted, so containment checks can binary search.
+    std::sort(begin(), end());
+}
+
+bool
+Ranges::contains(uintmax_t addr) const
+{
+    // Find the first range starting after addr - only its predecessor can
+    // cover addr; a DIE's ranges don't overlap.
+    auto it = std::upper_bound(begin(), end(), addr,
+          [](uintmax_t lhs, const value_type &rhs) { return lhs < rhs.first; });
+    if (it == begin())
+        return false;
+    --it;
+    return addr <= it->second;
+}
+
+DIE::Attribute::operator std::string_view() const
+{
+    if (!valid())
+        return {};
+    const Info *dwarf = die.unit->dwarf;
+    switch (formp->form) {
+        // The common string forms can point straight into the section data.
+        case DW_FORM_strp:
+            return dwarf->stringAt(dwarf->debugStrings, value().addr);
+        case DW_FORM_line_strp:
+            return dwarf->stringAt(dwarf->debugLineStrings, value().addr);
+        case DW_FORM_string:
+            return dwarf->stringAt(dwarf->debugInfo, value().addr);
+        default:
+            // Anything else (strx, alt tables...) has to be synthesized -
+            // intern the result to give it a stable lifetime.
+            return dwarf->intern(std::string(*this));
+    }
 }
 
 DIE::Attribute::operator std::string() const
@@ -628,6 +652,10 @@ DIE::Attribute::operator DIE() const
 DIE
 DIE::findEntryForAddr(Elf::Addr address, Tag t, bool skipStart)
 {
+    // Top-level queries for subprograms and inlined subroutines are served
+    // from the unit's interval index, avoiding a tree walk per address.
+    if (skipStart && (t == DW_TAG_subprogram || t == DW_TAG_inlined_subroutine))
+        return unit->findEntryForAddr(address, t, *this);
     switch (containsAddress(address)) {
         case ContainsAddr::NO:
             return DIE();
@@ -692,7 +720,7 @@ DIE::typeName()
         return "void";
     const auto &selfname = name();
     if (selfname != "")
-        return selfname;
+        return std::string(selfname);
     auto base = DIE(attribute(DW_AT_type));
     std::string s, sep;
     switch (tag()) {
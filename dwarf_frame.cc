@@ -1,4 +1,5 @@
 #include "libpstack/dwarf.h"
+#include "libpstack/stats.h"
 #include "libpstack/dwarf_reader.h"
 #include "libpstack/global.h"
 #include <stack>
@@ -131,6 +132,7 @@ CFI::putFDEorCIE( DWARFReader &reader ) const {
 }
 
 const std::vector<std::unique_ptr<FDE>> &CFI::getFDEs() const {
+   std::lock_guard<std::mutex> guard(fdeLock);
    ensureFDEs();
    return fdes;
 }
@@ -139,6 +141,12 @@ const std::map<Elf::Addr,CIE> &CFI::getCIEs() const {
    return cies;
 }
 
+const CIE &CFI::getCIE(Elf::Addr off) const {
+   // take the lock - a concurrent findFDE may be inserting a CIE.
+   std::lock_guard<std::mutex> guard(fdeLock);
+   return cies.at(off);
+}
+
 CFI::CFI(const Info *info, FIType type_)
     : dwarf(info)
     , type(type_)
@@ -252,13 +260,37 @@ CFI::ensureFDEs() const {
 const FDE *
 CFI::findFDE(Elf::Addr addr) const {
 
-   // No FDE found. Check the lookup table.
+   std::lock_guard<std::mutex> guard(fdeLock);
    uintptr_t start = 0;
    uintptr_t end = fdes.size();
 
+   if (fdeTable != nullptr) {
+      // Binary search the raw eh_frame_hdr table - each probe just decodes
+      // the initial location from the sorted table, and we only materialize
+      // the one FDE that can actually cover addr.
+      size_t encodingSize = sizeForEncoding( ExceptionHandlingEncoding(fdeTableEnc) );
+      while (start < end) {
+         auto mid = start + (end - start) / 2;
+         DWARFReader tableReader( fdeTable, encodingSize * 2 * mid );
+         auto [fdeAddr, indirect] = decodeAddress(tableReader, fdeTableEnc, ehFrameHdrAddr);
+         (void)indirect;
+         if (Elf::Addr(fdeAddr) <= addr)
+            start = mid + 1;
+         else
+            end = mid;
+      }
+      if (start == 0)
+         return nullptr;
+      ensureFDE(start - 1);
+      auto &entry = fdes[start - 1];
+      if (entry->iloc <= addr && addr < entry->iloc + entry->irange)
+         return entry.get();
+      return nullptr;
+   }
+
+   // No search table: all the FDEs are decoded and sorted already.
    while (start < end) {
       auto mid = start + (end - start) / 2;
-      ensureFDE(mid);
       auto &entry = fdes[mid];
       if (entry->iloc <= addr) {
          start = mid + 1;
@@ -285,18 +317,41 @@ CallFrame::CallFrame()
 }
 
 CallFrame
-CIE::execInsns(DWARFReader &r, uintmax_t addr, uintmax_t wantAddr) const
+CIE::execInsns(DWARFReader &r, uintmax_t addr, uintmax_t wantAddr,
+        uintmax_t *rowStart, uintmax_t *rowEnd) const
 {
     std::stack<CallFrame> stack;
     CallFrame frame;
 
-    // default frame for this CIE.
-    CallFrame dframe;
-    if (addr != 0 || wantAddr != 0) {
-        DWARFReader r2(r.io, instructions, end);
-        dframe = execInsns(r2, 0, 0);
+    if (rowStart != nullptr)
+        *rowStart = addr;
+    if (rowEnd != nullptr)
+        *rowEnd = std::numeric_limits<uintmax_t>::max();
+    // Track the range of addresses the returned rules are valid for: each
+    // location advance either starts a new row below wantAddr, or terminates
+    // the row containing it.
+    auto advance = [&] (uintmax_t newaddr) {
+        addr = newaddr;
+        if (addr <= wantAddr) {
+            if (rowStart != nullptr)
+                *rowStart = addr;
+        } else if (rowEnd != nullptr) {
+            *rowEnd = addr;
+        }
+    };
+
+    // default frame for this CIE. While initialFrame itself is being
+    // computed (addr and wantAddr both zero), this is still the
+    // default-constructed state, as before.
+    const CallFrame &dframe = initialFrame;
+    if (addr != 0 || wantAddr != 0)
         frame = dframe;
-    }
+
+    // DW_CFA_restore for a register the initial instructions never mentioned
+    // leaves it undefined.
+    auto restore = [&] (int reg) {
+        frame.reg(reg) = dframe.reg(reg);
+    };
     while (addr <= wantAddr) {
         if (r.empty())
             return frame;
@@ -305,18 +360,19 @@ CIE::execInsns(DWARFReader &r, uintmax_t addr, uintmax_t wantAddr) const
         auto op = CFAInstruction(rawOp & ~0x3f);
         switch (op) {
         case DW_CFA_advance_loc:
-            addr += reg * codeAlign;
+            advance(addr + reg * codeAlign);
             break;
 
         case DW_CFA_offset: {
             uintmax_t offset = r.getuleb128();
-            frame.registers[reg].type = OFFSET;
-            frame.registers[reg].u.offset = offset * dataAlign;
+            auto &unwind = frame.reg(reg);
+            unwind.type = OFFSET;
+            unwind.u.offset = offset * dataAlign;
             break;
         }
 
         case DW_CFA_restore: {
-            frame.registers[reg] = dframe.registers[reg];
+            restore(reg);
             break;
         }
 
@@ -327,49 +383,51 @@ CIE::execInsns(DWARFReader &r, uintmax_t addr, uintmax_t wantAddr) const
                 break;
 
             case DW_CFA_set_loc:
-                addr = r.getuint(r.addrLen);
+                advance(r.getuint(r.addrLen));
                 break;
 
             case DW_CFA_advance_loc1:
-                addr += r.getu8() * codeAlign;
+                advance(addr + r.getu8() * codeAlign);
                 break;
 
             case DW_CFA_advance_loc2:
-                addr += r.getu16() * codeAlign;
+                advance(addr + r.getu16() * codeAlign);
                 break;
 
             case DW_CFA_advance_loc4:
-                addr += r.getu32() * codeAlign;
+                advance(addr + r.getu32() * codeAlign);
                 break;
 
             case DW_CFA_offset_extended: {
                 auto reg = r.getuleb128();
                 auto offset = r.getuleb128();
-                frame.registers[reg].type = OFFSET;
-                frame.registers[reg].u.offset = offset * dataAlign;
+                auto &unwind = frame.reg(reg);
+                unwind.type = OFFSET;
+                unwind.u.offset = offset * dataAlign;
                 break;
             }
 
             case DW_CFA_restore_extended:
                 reg = r.getuleb128();
-                frame.registers[reg] = dframe.registers[reg];
+                restore(reg);
                 break;
 
             case DW_CFA_undefined:
                 reg = r.getuleb128();
-                frame.registers[reg].type = UNDEF;
+                frame.reg(reg).type = UNDEF;
                 break;
 
             case DW_CFA_same_value:
                 reg = r.getuleb128();
-                frame.registers[reg].type = SAME;
+                frame.reg(reg).type = SAME;
                 break;
 
             case DW_CFA_register: {
                 auto reg1 = r.getuleb128();
                 auto reg2 = r.getuleb128();
-                frame.registers[reg1].type = REG;
-                frame.registers[reg1].u.reg = reg2;
+                auto &unwind = frame.reg(reg1);
+                unwind.type = REG;
+                unwind.u.reg = reg2;
                 break;
             }
 
@@ -411,7 +469,7 @@ CIE::execInsns(DWARFReader &r, uintmax_t addr, uintmax_t wantAddr) const
 
             case DW_CFA_val_expression: {
                 reg = r.getuleb128();
-                auto &unwind = frame.registers[reg];
+                auto &unwind = frame.reg(reg);
                 unwind.type = VAL_EXPRESSION;
                 unwind.u.expression.length = r.getuleb128();
                 unwind.u.expression.offset = r.getOffset();
@@ -422,7 +480,7 @@ CIE::execInsns(DWARFReader &r, uintmax_t addr, uintmax_t wantAddr) const
             case DW_CFA_expression: {
                 reg = r.getuleb128();
                 auto offset = r.getuleb128();
-                auto &unwind = frame.registers[reg];
+                auto &unwind = frame.reg(reg);
                 unwind.type = EXPRESSION;
                 unwind.u.expression.offset = r.getOffset();
                 unwind.u.expression.length = offset;
@@ -476,6 +534,7 @@ FDE::FDE(const CFI &fi, DWARFReader &reader, Elf::Off cieOff_, Elf::Off endOff_)
     : end(endOff_)
     , cieOff(cieOff_)
 {
+    stats::count(stats::fdesDecoded);
     auto &cie = fi.cies.at( cieOff );
     bool indirect;
     std::tie(iloc, indirect) = fi.decodeAddress(reader, cie.addressEncoding, fi.sectionAddr);
@@ -561,6 +620,11 @@ CIE::CIE(const CFI *fi, DWARFReader &r, Elf::Off end_)
         r.setOffset(endaugdata);
     }
     instructions = r.getOffset();
+
+    // Execute the initial instructions now, so FDE evaluation can start from
+    // the result instead of re-running them for every frame.
+    DWARFReader r2(r.io, instructions, end);
+    initialFrame = execInsns(r2, 0, 0);
 }
 
 }
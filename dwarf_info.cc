@@ -3,11 +3,45 @@
 #include "libpstack/stringify.h"
 #include "libpstack/fs.h"
 #include "libpstack/global.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <future>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
 
 namespace pstack::Dwarf {
 
+namespace {
+
+/*
+ * On-disk address-to-unit index, keyed by build-id in the cache directory
+ * beside the symbol index (elf.cc): a header, then a table of (range end,
+ * range length, unit offset) entries sorted by end address. Saved once the
+ * expensive fallback walk of every unit root has been done, so later runs on
+ * the same binary answer lookupUnit with a binary search into the mapping,
+ * with no range parsing at all.
+ */
+struct UnitIndexHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t infoSize; // size of the .debug_info indexed - sanity check.
+    uint64_t count;
+};
+struct UnitIndexEnt {
+    uint64_t end;
+    uint64_t length;
+    uint64_t unit;
+};
+constexpr uint32_t unitIndexMagic = 0x70737375; // "pssu"
+constexpr uint32_t unitIndexVersion = 1;
+
+}
+
 CFI *Info::getCFI(FIType type) const {
+   std::lock_guard<std::mutex> guard(frameLock);
    for (auto candidate : { FI_EH_FRAME,  FI_DEBUG_FRAME } ) {
       if (candidate != type && type != FI_BEST)
          continue;
@@ -44,9 +78,54 @@ Info::sourceFromAddr(uintmax_t addr) const
     return info;
 }
 
+std::map<uintmax_t, std::vector<std::pair<std::string, int>>>
+Info::sourceFromAddrs(std::vector<uintmax_t> addrs) const
+{
+    std::map<uintmax_t, std::vector<std::pair<std::string, int>>> results;
+    // Sorting keeps runs of addresses from the same unit together, so the
+    // common case reuses the unit found for the previous address, and the
+    // lazily-decoded line sequences are visited in address order.
+    std::sort(addrs.begin(), addrs.end());
+    Unit::sptr unit;
+    for (auto addr : addrs) {
+        auto &info = results[addr];
+        if (unit != nullptr && unit->sourceFromAddr(Elf::Addr(addr), info))
+            continue;
+        unit = lookupUnit(addr);
+        if (unit)
+            unit->sourceFromAddr(Elf::Addr(addr), info);
+    }
+    return results;
+}
+
+std::string_view
+Info::stringAt(const Elf::Section &section, Elf::Off offset) const
+{
+    auto io = section.io();
+    auto size = io->size();
+    if (offset < size) {
+        const char *p = io->window(offset, size - offset);
+        if (p != nullptr)
+            return { p, strnlen(p, size - offset) };
+    }
+    // No window over the section - fall back to a copy, interned so the
+    // caller still gets a stable view.
+    return intern(io->readString(offset));
+}
+
+std::string_view
+Info::intern(std::string &&s) const
+{
+    // Entries are never erased, so the returned view stays valid after the
+    // lock is dropped.
+    std::lock_guard<std::mutex> guard(stringsLock);
+    return *internedStrings.insert(std::move(s)).first;
+}
+
 const std::list<PubnameUnit> &
 Info::pubnames() const
 {
+    std::lock_guard<std::mutex> guard(lazyLock);
     if (pubnameUnits == nullptr) {
         pubnameUnits = std::make_unique<std::list<PubnameUnit>>();
         const Elf::Section &pubnamesh = elf->getDebugSection(".debug_pubnames", SHT_NULL);
@@ -59,9 +138,42 @@ Info::pubnames() const
     return *pubnameUnits;
 }
 
+const std::unordered_multimap<std::string, Elf::Off> &
+Info::pubnameIndex() const
+{
+    // A miss can't be answered without examining every unit in the section,
+    // so the first query pays for one streaming pass that indexes all the
+    // names; per-unit laziness would buy nothing here. Unlike pubnames(),
+    // this doesn't retain the per-unit lists.
+    std::lock_guard<std::mutex> guard(lazyLock);
+    if (pubnameIdx == nullptr) {
+        pubnameIdx = std::make_unique<std::unordered_multimap<std::string, Elf::Off>>();
+        const Elf::Section &pubnamesh = elf->getDebugSection(".debug_pubnames", SHT_NULL);
+        if (pubnamesh) {
+            DWARFReader r(pubnamesh.io());
+            while (!r.empty()) {
+                auto length = r.getu32();
+                Elf::Off next = r.getOffset() + length;
+                r.getu16(); // version.
+                auto infoOffset = r.getu32();
+                r.getu32(); // length of the described info unit.
+                while (r.getOffset() < next) {
+                    uint32_t offset = r.getu32();
+                    if (offset == 0)
+                        break;
+                    pubnameIdx->emplace(r.getstring(), infoOffset + offset);
+                }
+                r.setOffset(next);
+            }
+        }
+    }
+    return *pubnameIdx;
+}
+
 Unit::sptr
 Info::getUnit(Elf::Off offset) const
 {
+    std::lock_guard<std::mutex> guard(unitsLock);
     auto &ent = units[offset];
     if (ent == nullptr) {
         DWARFReader r(debugInfo.io(), offset);
@@ -73,6 +185,60 @@ Info::getUnit(Elf::Off offset) const
     return ent;
 }
 
+/*
+ * Decode all the units in the object, spreading the work over several
+ * threads. Unit headers are self-delimiting, so a cheap sequential scan over
+ * the length fields finds the boundaries, and the units themselves - header,
+ * abbreviations, and root DIE - are decoded concurrently, feeding the units
+ * map under a lock. The caller must ensure the underlying readers tolerate
+ * concurrent access: mmap-backed images (as used by the dump paths) do.
+ */
+void
+Info::preloadUnits() const
+{
+    auto io = debugInfo.io();
+    if (io == nullptr)
+        return;
+
+    std::vector<Elf::Off> offsets;
+    {
+        std::lock_guard<std::mutex> guard(unitsLock);
+        DWARFReader r(io);
+        while (!r.empty()) {
+            Elf::Off off = r.getOffset();
+            if (units.find(off) == units.end())
+                offsets.push_back(off);
+            auto [ length, dwarfLen ] = r.getlength();
+            r.setOffset(r.getOffset() + length);
+        }
+    }
+
+    // Warm the abbreviations section cache from this thread - the workers
+    // will all want it, and section lookup mutates the ELF object.
+    elf->getDebugSection(".debug_abbrev", SHT_NULL);
+
+    std::atomic<size_t> next { 0 };
+    auto nthreads = std::min<size_t>(std::thread::hardware_concurrency(), offsets.size());
+    std::vector<std::future<void>> work;
+    work.reserve(nthreads);
+    for (size_t t = 0; t < nthreads; ++t) {
+        work.push_back(std::async(std::launch::async, [&] {
+            for (;;) {
+                size_t i = next++;
+                if (i >= offsets.size())
+                    return;
+                DWARFReader ur(io, offsets[i]);
+                auto u = std::make_shared<Unit>(this, ur);
+                u->root(); // forces the abbreviations and root DIE in.
+                std::lock_guard<std::mutex> guard(unitsLock);
+                units.emplace(offsets[i], std::move(u));
+            }
+        }));
+    }
+    for (auto &w : work)
+        w.get();
+}
+
 DIE
 Info::offsetToDIE(Elf::Off offset) const
 {
@@ -85,45 +251,57 @@ Info::offsetToDIE(Elf::Off offset) const
     // offset <= the required DIE offset, and walk forward until we find the
     // first unit that has an end > the DIE offset (they can be the same unit)
 
-    auto it = units.upper_bound(offset);
-    // "it" is the first unit with an offset > our DIE offset. Our required
-    // Unit is before this in the sequence.
-    Elf::Off uOffset;
-
-    if (it != units.begin()) {
-        // Theres already at least one unit that has an offset < the desired DIE
-        // offset. The highest one is at it - 1. Start searching forward from there.
-        --it;
-        uOffset = it->first;
-    } else {
-        // There are either no units, or the first unit has an offset higher
-        // than our required DIE offset - start at offset 0.
-        uOffset = 0;
+    Unit::sptr u;
+    Elf::Off uOffset = 0;
+    {
+        std::lock_guard<std::mutex> guard(unitsLock);
+        auto it = units.upper_bound(offset);
+        // "it" is the first unit with an offset > our DIE offset. Our required
+        // Unit is before this in the sequence.
+        if (it != units.begin()) {
+            // Theres already at least one unit that has an offset < the desired DIE
+            // offset. The highest one is at it - 1.
+            --it;
+            if (it->second != nullptr && it->second->end > offset) {
+                // Cross-unit references overwhelmingly land in a unit we've
+                // already decoded, so the binary search alone answers them.
+                u = it->second;
+            } else {
+                // Start searching forward from there.
+                uOffset = it->first;
+            }
+        }
+        // otherwise there are either no units, or the first unit has an
+        // offset higher than our required DIE offset - start at offset 0.
     }
 
-    int i = 0;
-    for (Units::iterator start(this, uOffset), end; start != end; ++start, ++i) {
-        const auto &u = *start;
-        if (u->end > offset) {
-            // this is the first unit that ends after our required offset -
-            // we're done looking
-            if (u->offset <= offset) {
-                // the unit starts at or before our required offset - the DIE
-                // should be in here.
-                DIE entry = u->offsetToDIE(DIE(), offset);
-                if (entry) {
-                    if (verbose > 2)
-                        *debug << "search for DIE at " << offset
-                                  << " in " << *debugInfo.io()
-                                  << " started at " << uOffset
-                                  << ", found at " << u->offset
-                                  << " and took " << i << " iterations\n";
-                    return entry;
-                }
+    if (u == nullptr) {
+        // Extend the frontier: decode headers forward from the last known
+        // unit until one ends past our offset. Each unit visited lands in
+        // the units map, so later searches start closer.
+        int i = 0;
+        for (Units::iterator start(this, uOffset), end; start != end; ++start, ++i) {
+            if ((*start)->end > offset) {
+                // this is the first unit that ends after our required offset -
+                // we're done looking
+                if (verbose > 2)
+                    *debug << "search for DIE at " << offset
+                              << " in " << *debugInfo.io()
+                              << " started at " << uOffset
+                              << " and took " << i << " iterations\n";
+                u = *start;
+                break;
             }
-            break;
         }
     }
+
+    if (u != nullptr && u->offset <= offset) {
+        // the unit starts at or before our required offset - the DIE
+        // should be in here.
+        DIE entry = u->offsetToDIE(DIE(), offset);
+        if (entry)
+            return entry;
+    }
     throw (Exception() << "DIE not found");
 }
 
@@ -169,8 +347,103 @@ Info::decodeARangeSet(DWARFReader &r) const {
     }
 }
 
+bool
+Info::loadUnitIndex() const
+{
+    auto dir = cacheDirectory();
+    if (dir == "")
+        return false;
+    auto id = elf->buildID();
+    if (id == "")
+        return false;
+    try {
+        auto io = std::make_shared<MmapReader>(stringify(dir, "/", id, ".unitidx"));
+        auto hdr = io->readObj<UnitIndexHeader>(0);
+        if (hdr.magic != unitIndexMagic
+                || hdr.version != unitIndexVersion
+                || hdr.infoSize != uint64_t(debugInfo.io()->size())
+                || io->size() < Reader::Off(sizeof hdr + hdr.count * sizeof (UnitIndexEnt)))
+            return false;
+        unitIndex = io;
+        unitIndexCount = hdr.count;
+        if (verbose >= 2)
+            *debug << "loaded unit index for " << *elf->io << " from " << *io << "\n";
+        return true;
+    }
+    catch (const std::exception &ex) {
+        return false;
+    }
+}
+
+void
+Info::saveUnitIndex() const
+{
+    if (unitIndex != nullptr || aranges == nullptr || aranges->empty())
+        return;
+    auto dir = cacheDirectory();
+    if (dir == "")
+        return;
+    auto id = elf->buildID();
+    if (id == "")
+        return;
+    auto path = stringify(dir, "/", id, ".unitidx");
+    auto tmp = stringify(path, ".", getpid());
+    int fd = ::open(tmp.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if (fd == -1)
+        return;
+    // aranges is keyed by range end, so iteration gives the entries already
+    // sorted for the reader's binary search.
+    std::vector<UnitIndexEnt> ents;
+    ents.reserve(aranges->size());
+    for (const auto &[end, rest] : *aranges)
+        ents.push_back({end, rest.first, rest.second});
+    UnitIndexHeader hdr { unitIndexMagic, unitIndexVersion,
+        uint64_t(debugInfo.io()->size()), ents.size() };
+    bool ok = write(fd, &hdr, sizeof hdr) == ssize_t(sizeof hdr)
+        && write(fd, ents.data(), ents.size() * sizeof (UnitIndexEnt))
+                == ssize_t(ents.size() * sizeof (UnitIndexEnt));
+    close(fd);
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+        unlink(tmp.c_str());
+    else if (verbose >= 2)
+        *debug << "wrote unit index " << path << " for " << *elf->io << "\n";
+}
+
 Unit::sptr
 Info::lookupUnit(Elf::Addr addr) const {
+    // getUnit is always called with lazyLock dropped - creating the unit
+    // takes unitsLock, and decoding its root can reach back into lazily
+    // built state (the alt image, for one).
+    std::unique_lock<std::mutex> guard(lazyLock);
+
+    // An index saved by an earlier run can answer without parsing any range
+    // data at all.
+    if (!unitIndexTried) {
+        unitIndexTried = true;
+        loadUnitIndex();
+    }
+    if (unitIndex != nullptr) {
+        const char *base = unitIndex->window(0, unitIndex->size());
+        const auto *ents = reinterpret_cast<const UnitIndexEnt *>(
+                base + sizeof (UnitIndexHeader));
+        size_t lo = 0;
+        size_t hi = unitIndexCount;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (ents[mid].end <= addr)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo < unitIndexCount && addr >= ents[lo].end - ents[lo].length) {
+            auto off = ents[lo].unit;
+            guard.unlock();
+            return getUnit(off);
+        }
+        // The index covers every unit: no match means no unit.
+        return nullptr;
+    }
+
     if (aranges == nullptr) {
         aranges = std::make_unique<ARanges>();
         const Elf::Section &arangesh = elf->getDebugSection(".debug_aranges", SHT_NULL);
@@ -181,40 +454,71 @@ Info::lookupUnit(Elf::Addr addr) const {
         }
     }
     auto it = aranges->upper_bound(addr);
-    if (it != aranges->end() && it->first - it->second.first <= addr)
-        return getUnit(it->second.second);
+    if (it != aranges->end() && it->first - it->second.first <= addr) {
+        auto off = it->second.second;
+        guard.unlock();
+        return getUnit(off);
+    }
 
     if (!unitRangesCached) {
-        // Clang does not add debug_aranges.  If we fail to find the unit via
-        // the aranges, walk through all the units, and check out their
-        // DW_AT_range attribute, and fold its content into the aranges data.
-        unitRangesCached = true;
-        for (auto u : getUnits()) {
-            auto root = u->root();
-            auto lowpc = root.attribute(DW_AT_low_pc);
-            auto highpc = root.attribute(DW_AT_high_pc);
-            if (lowpc.valid() && highpc.valid()) {
-               auto low = uintmax_t(lowpc);
-               auto high = uintmax_t(highpc);
-               if (highpc.form() != DW_FORM_addr)
-                  high += low;
-               (*aranges)[high] = std::make_pair(high - low, u->offset);
-            }
-            // do we have ranges for this DIE?
-            const auto &ranges = root.getRanges();
-            if (ranges != nullptr)
-                for (auto r : *ranges)
-                    (*aranges)[r.second] = { r.first, u->offset };
+        // The synthesis walks every unit, taking unit locks as it decodes
+        // their root DIEs - it can't run under lazyLock, so drop the lock
+        // and let it publish its own results.
+        guard.unlock();
+        synthesizeARanges();
+        guard.lock();
+        // Try again now we've added all the unit ranges.
+        it = aranges->upper_bound(addr);
+        if (it != aranges->end() && it->first - it->second.first <= addr) {
+            auto off = it->second.second;
+            guard.unlock();
+            return getUnit(off);
         }
     }
-
-    // Try again now we've added all the unit ranges.
-    it = aranges->upper_bound(addr);
-    if (it != aranges->end() && it->first - it->second.first <= addr)
-        return getUnit(it->second.second);
     return nullptr;
 }
 
+/*
+ * Clang does not add debug_aranges. If we fail to find a unit via the aranges
+ * data, make a single pass over all the units, and synthesize arange-set
+ * style entries from each unit's root DIE ranges. The result persists in
+ * "aranges", so the full .debug_info walk happens at most once per Info.
+ */
+void
+Info::synthesizeARanges() const
+{
+    // Build into a local map and publish in one shot at the end -
+    // concurrent callers may duplicate the walk, but the merge is
+    // idempotent, and searches never see a half-built table.
+    ARanges local;
+    for (const auto &u : getUnits()) {
+        auto root = u->root();
+        auto lowpc = root.attribute(DW_AT_low_pc);
+        auto highpc = root.attribute(DW_AT_high_pc);
+        if (lowpc.valid() && highpc.valid()) {
+           auto low = uintmax_t(lowpc);
+           auto high = uintmax_t(highpc);
+           if (highpc.form() != DW_FORM_addr)
+              high += low;
+           local[high] = std::make_pair(high - low, u->offset);
+        }
+        // do we have ranges for this DIE?
+        const auto &ranges = root.getRanges();
+        if (ranges != nullptr)
+            for (auto r : *ranges)
+                local[r.second] = { r.second - r.first, u->offset };
+    }
+    std::lock_guard<std::mutex> guard(lazyLock);
+    if (unitRangesCached)
+        return;
+    for (const auto &[end, rest] : local)
+        (*aranges)[end] = rest;
+    unitRangesCached = true;
+    // This walk is the expensive part of a cold start - save the result so
+    // the next run over this binary skips it.
+    saveUnitIndex();
+}
+
 Abbreviation::Abbreviation(DWARFReader &r)
     : tag(Tag(r.getuleb128()))
     , hasChildren(HasChildren(r.getu8()) == DW_CHILDREN_yes)
@@ -261,16 +565,121 @@ Info::getAltImageName() const
     return stringify(exedir, "/", name);
 }
 
+// The hex-encoded build-id stored after the link name in .gnu_debugaltlink -
+// it identifies the supplementary file, so we can find it by id when the
+// named path doesn't exist on this host, and sanity-check whatever we load.
+std::string
+Info::getAltImageID() const
+{
+    const Elf::Section &section = elf->getDebugSection(".gnu_debugaltlink", SHT_NULL);
+    if (!section)
+        return "";
+    auto io = section.io();
+    size_t idoff = io->readString(0).size() + 1;
+    if (io->size() <= idoff)
+        return "";
+    std::vector<unsigned char> data(io->size() - idoff);
+    io->readObj(idoff, &data[0], data.size());
+    std::ostringstream os;
+    os << std::hex << std::setfill('0');
+    for (auto byte : data)
+        os << std::setw(2) << int(byte);
+    return os.str();
+}
+
 Info::sptr
 Info::getAltDwarf() const
 {
+    std::lock_guard<std::mutex> guard(lazyLock);
     if (!altImageLoaded) {
-        altDwarf = imageCache.getDwarf(getAltImageName());
         altImageLoaded = true;
+        const auto &id = getAltImageID();
+        try {
+            altDwarf = imageCache.getDwarf(getAltImageName());
+        }
+        catch (const std::exception &ex) {
+            if (verbose)
+                *debug << "can't load alt image " << getAltImageName()
+                    << ": " << ex.what() << "\n";
+        }
+
+        // The named path may not exist here (eg, analysing a core from
+        // another host) - fall back to the debug directories and debuginfod,
+        // keyed by the build-id from the link.
+        if (altDwarf == nullptr && id != "") {
+            auto obj = imageCache.getDebugImage(stringify(
+                        ".build-id/", id.substr(0, 2), "/", id.substr(2), ".debug"));
+            if (!obj)
+                obj = imageCache.getDebugImageForBuildID(id);
+            if (obj)
+                altDwarf = imageCache.getDwarf(obj);
+        }
+
+        if (altDwarf != nullptr && id != "" && altDwarf->elf->buildID() != id)
+            *debug << "warning: alt debug " << *altDwarf->elf->io
+                << " build-id does not match link in " << *elf->io << "\n";
     }
     if (altDwarf == nullptr)
         throw (Exception() << "no alt-dwarf found");
     return altDwarf;
 }
 
+Unit::sptr
+Info::findSplitUnit(Unit &skel) const
+{
+    const auto &root = skel.root();
+
+    // DWARF 5 names the .dwo with DW_AT_dwo_name; GNU split dwarf used its
+    // own attribute. Relative names resolve against the compilation
+    // directory.
+    std::string path;
+    {
+        const auto &a5 = root.attribute(DW_AT_dwo_name);
+        const auto &a4 = root.attribute(DW_AT_GNU_dwo_name);
+        if (a5.valid())
+            path = std::string(a5);
+        else if (a4.valid())
+            path = std::string(a4);
+        else
+            return nullptr;
+    }
+    if (path[0] != '/') {
+        const auto &comp = root.attribute(DW_AT_comp_dir);
+        if (comp.valid())
+            path = stringify(std::string(comp), "/", path);
+    }
+
+    Info::sptr dwo;
+    try {
+        dwo = imageCache.getDwarf(path);
+    }
+    catch (const std::exception &ex) {
+        if (verbose)
+            *debug << "can't load split dwarf " << path << " for "
+                << *elf->io << ": " << ex.what() << "\n";
+        return nullptr;
+    }
+
+    // Find the unit matching the skeleton's id. DWARF 5 stores the id in the
+    // unit headers; GNU split dwarf compares DW_AT_GNU_dwo_id on the roots.
+    for (const auto &u : dwo->getUnits()) {
+        bool match;
+        if (skel.version >= 5) {
+            match = u->id == skel.id;
+        } else {
+            const auto &mine = root.attribute(DW_AT_GNU_dwo_id);
+            const auto &theirs = u->root().attribute(DW_AT_GNU_dwo_id);
+            match = mine.valid() && theirs.valid()
+                && uintmax_t(mine) == uintmax_t(theirs);
+        }
+        if (match) {
+            u->skeleton = &skel;
+            return u;
+        }
+    }
+    if (verbose)
+        *debug << "no unit matching skeleton id in " << path << "\n";
+    return nullptr;
+}
+
 }
@@ -1,6 +1,7 @@
 #include "libpstack/dwarf.h"
 #include "libpstack/dwarf_reader.h"
 #include "libpstack/global.h"
+#include <algorithm>
 namespace pstack::Dwarf {
 
 namespace {
@@ -19,7 +20,7 @@ readEntryFormats(DWARFReader &r) {
 }
 }
 
-LineState::LineState(LineInfo *li)
+LineState::LineState(const LineInfo *li)
     : file{ &li->files[1] }
     , addr { 0 }
     , line { 1 }
@@ -33,12 +34,6 @@ LineState::LineState(LineInfo *li)
     , discriminator{ 0 }
 {}
 
-void
-dwarfStateAddRow(LineInfo *li, const LineState &state)
-{
-    li->matrix.push_back(state);
-}
-
 void
 LineInfo::build(DWARFReader &r, Unit &unit)
 {
@@ -46,7 +41,6 @@ LineInfo::build(DWARFReader &r, Unit &unit)
     Elf::Off end = r.getOffset() + total_length;
 
     uint16_t version = r.getu16();
-    unsigned char address_size;
 
     if (version >= 5) {
         address_size = r.getu8();
@@ -59,14 +53,14 @@ LineInfo::build(DWARFReader &r, Unit &unit)
 
     Elf::Off header_length = r.getuint(version > 2 ? dwarfLen : 4);
     Elf::Off expectedEnd = header_length + r.getOffset();
-    int min_insn_length = r.getu8();
+    min_insn_length = r.getu8();
 
     int maximum_operations_per_instruction = version >= 4 ? r.getu8() : 1; // new in DWARF 4.
     (void)maximum_operations_per_instruction; // XXX: work out what to do with this.
 
     default_is_stmt = r.getu8() != 0;
-    int line_base = r.gets8();
-    int line_range = r.getu8();
+    line_base = r.gets8();
+    line_range = r.getu8();
 
     opcode_base = r.getu8();
     opcode_lengths.resize(opcode_base);
@@ -147,10 +141,37 @@ LineInfo::build(DWARFReader &r, Unit &unit)
         r.skip(diff);
     }
 
-    if (r.getOffset() == end)
-       return;
+    io = r.io;
+    programEnd = end;
+
+    // Note the boundaries and address ranges of each sequence in the
+    // program. The rows themselves are decoded when a sequence is first
+    // queried - a stack trace rarely touches more than a few sequences.
+    while (r.getOffset() < end) {
+        Sequence seq;
+        seq.offset = r.getOffset();
+        processSequence(r, end, nullptr, seq.lowAddr, seq.highAddr);
+        sequences.push_back(std::move(seq));
+    }
+    std::sort(sequences.begin(), sequences.end(),
+          [](const Sequence &lhs, const Sequence &rhs) { return lhs.lowAddr < rhs.lowAddr; });
+}
 
+void
+LineInfo::processSequence(DWARFReader &r, Elf::Off end, std::vector<LineRow> *rows,
+      Elf::Addr &low, Elf::Addr &high) const
+{
     LineState state(this);
+    bool first = true;
+    low = high = 0;
+    auto addRow = [&](const LineState &state) {
+        if (first) {
+            low = state.addr;
+            first = false;
+        }
+        if (rows != nullptr)
+            rows->push_back({state.addr, state.file, state.line, state.end_sequence});
+    };
     while (r.getOffset() < end) {
         unsigned c = r.getu8();
         if (c >= opcode_base) {
@@ -160,7 +181,7 @@ LineInfo::build(DWARFReader &r, Unit &unit)
             int lineIncr = c % line_range + line_base;
             state.addr += addrIncr * min_insn_length;
             state.line += lineIncr;
-            dwarfStateAddRow(this, state);
+            addRow(state);
             state.basic_block = false;
 
         } else if (c == 0) {
@@ -170,9 +191,9 @@ LineInfo::build(DWARFReader &r, Unit &unit)
             switch (code) {
             case DW_LNE_end_sequence:
                 state.end_sequence = true;
-                dwarfStateAddRow(this, state);
-                state = LineState(this);
-                break;
+                addRow(state);
+                high = state.addr;
+                return;
             case DW_LNE_set_address:
                 state.addr = r.getuint(address_size);
                 break;
@@ -204,7 +225,7 @@ LineInfo::build(DWARFReader &r, Unit &unit)
                 state.file = &files[r.getuleb128()];
                 break;
             case DW_LNS_copy:
-                dwarfStateAddRow(this, state);
+                addRow(state);
                 state.basic_block = false;
                 break;
             case DW_LNS_set_column:
@@ -237,6 +258,41 @@ LineInfo::build(DWARFReader &r, Unit &unit)
             }
         }
     }
+    // Ran off the end of the program without an end_sequence.
+    high = state.addr;
+}
+
+void
+LineInfo::decodeRows(Sequence &seq) const
+{
+    if (!seq.rows.empty())
+        return;
+    DWARFReader r(io, seq.offset);
+    Elf::Addr low, high;
+    processSequence(r, programEnd, &seq.rows, low, high);
+}
+
+bool
+LineInfo::sourceFromAddr(Elf::Addr addr, std::vector<std::pair<std::string, int>> &info) const
+{
+    auto seq = std::upper_bound(sequences.begin(), sequences.end(), addr,
+          [](Elf::Addr lhs, const Sequence &rhs) { return lhs < rhs.lowAddr; });
+    if (seq == sequences.begin())
+        return false;
+    --seq;
+    if (addr >= seq->highAddr)
+        return false;
+    decodeRows(*seq);
+    auto row = std::upper_bound(seq->rows.begin(), seq->rows.end(), addr,
+          [](Elf::Addr lhs, const LineRow &rhs) { return lhs < rhs.addr; });
+    if (row == seq->rows.begin())
+        return false;
+    --row;
+    if (row->end_sequence)
+        return false;
+    const std::string &dirname = directories[row->file->dirindex];
+    info.emplace_back(verbose != 0 ? dirname + "/" + row->file->name : row->file->name, row->line);
+    return true;
 }
 
 FileEntry::FileEntry(std::string name_, unsigned dirindex_, unsigned lastMod_, unsigned length_)
@@ -138,6 +138,14 @@ Macros::visit4(Unit &u, MacroVisitor *visitor) const
 bool
 Macros::visit5(Unit &u, MacroVisitor *visitor) const
 {
+    if (visiting)
+        return true; // cyclic import - nothing new to see here.
+    struct VisitGuard {
+        const Macros &macros;
+        explicit VisitGuard(const Macros &macros_) : macros(macros_) { macros.visiting = true; }
+        ~VisitGuard() { macros.visiting = false; }
+    } guard(*this);
+
     auto lineinfo = debug_line_offset != -1 ? u.dwarf->linesAt(debug_line_offset, u) : nullptr;
     DWARFReader dr(io);
     for (bool done=false; !done; ) {
@@ -164,8 +172,10 @@ Macros::visit5(Unit &u, MacroVisitor *visitor) const
                 // XXX: "u" is likely not right here, but only makes a
                 // difference if the import unit uses unit-relative string
                 // offsets, which it can't, reliably. (see DW_MACRO_define_strp below)
-                Macros nest(*u.dwarf, offset, 5);
-                if (!nest.visit(u, visitor))
+                auto &nest = imports[offset];
+                if (nest == nullptr)
+                    nest = std::make_unique<Macros>(*u.dwarf, offset, 5);
+                if (!nest->visit(u, visitor))
                     return false;
 
                 break;
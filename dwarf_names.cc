@@ -0,0 +1,212 @@
+#include "libpstack/dwarf.h"
+#include "libpstack/dwarf_reader.h"
+#include "libpstack/global.h"
+
+namespace pstack::Dwarf {
+
+namespace {
+// DWARF 5 specifies the classic djb hash for the accelerator's buckets.
+uint32_t
+djbhash(const std::string &name)
+{
+    uint32_t h = 5381;
+    for (auto c : name)
+        h = h * 33 + (unsigned char)c;
+    return h;
+}
+}
+
+DebugNames::DebugNames(const Info &info)
+    : strings(info.debugStrings.io())
+{
+    const Elf::Section &section = info.elf->getDebugSection(".debug_names", SHT_NULL);
+    if (!section)
+        return;
+    io = section.io();
+    DWARFReader r(io);
+    try {
+        size_t dwarfLen_;
+        std::tie(std::ignore, dwarfLen_) = r.getlength();
+        dwarfLen = dwarfLen_;
+        auto version = r.getu16();
+        if (version != 5) {
+            if (verbose > 0)
+                *debug << "unexpected .debug_names version " << version
+                       << " in " << *io << "\n";
+            return;
+        }
+        r.getu16(); // padding.
+        cuCount = r.getu32();
+        auto localTypeUnits = r.getu32();
+        auto foreignTypeUnits = r.getu32();
+        bucketCount = r.getu32();
+        nameCount = r.getu32();
+        auto abbrevSize = r.getu32();
+        auto augSize = r.getu32();
+        r.skip(augSize);
+
+        // The tables follow the header back-to-back.
+        cuTable = r.getOffset();
+        buckets = cuTable + (cuCount + localTypeUnits) * dwarfLen + foreignTypeUnits * 8;
+        hashes = buckets + bucketCount * 4;
+        stringOffsets = hashes + nameCount * 4;
+        entryOffsets = stringOffsets + nameCount * dwarfLen;
+        Elf::Off abbrevOffset = entryOffsets + nameCount * dwarfLen;
+        entryPool = abbrevOffset + abbrevSize;
+
+        // Parse the abbreviations describing the index entries.
+        DWARFReader ar(io, abbrevOffset);
+        while (ar.getOffset() < entryPool) {
+            auto code = ar.getuleb128();
+            if (code == 0)
+                break;
+            auto &abb = abbrevs[code];
+            abb.tag = Tag(ar.getuleb128());
+            for (;;) {
+                auto idx = ar.getuleb128();
+                auto form = Form(ar.getuleb128());
+                if (idx == 0 && form == DW_FORM_none)
+                    break;
+                abb.attrs.push_back({unsigned(idx), form});
+            }
+        }
+        valid = nameCount != 0;
+    }
+    catch (const Exception &ex) {
+        if (verbose > 0)
+            *debug << "failed to parse .debug_names in " << *io << ": " << ex.what() << "\n";
+        valid = false;
+    }
+}
+
+std::vector<Elf::Off>
+DebugNames::lookup(const std::string &name) const
+{
+    std::vector<Elf::Off> rv;
+    if (!valid)
+        return rv;
+
+    // Fetch entry "i" from the fixed-width table starting at "table".
+    auto tableEntry = [&](Elf::Off table, size_t entsize, size_t i) -> uintmax_t {
+        DWARFReader r(io, table + i * entsize);
+        return r.getuint(entsize);
+    };
+
+    size_t index = 0; // 1-based index into the name table, 0 = no match.
+    if (bucketCount != 0) {
+        uint32_t h = djbhash(name);
+        auto bucket = h % bucketCount;
+        // Buckets hold the index of their first name; names sharing a bucket
+        // are adjacent in the hash table.
+        for (size_t idx = tableEntry(buckets, 4, bucket); idx != 0 && idx <= nameCount; ++idx) {
+            auto hash = uint32_t(tableEntry(hashes, 4, idx - 1));
+            if (hash % bucketCount != bucket)
+                break;
+            if (hash == h &&
+                  strings->readString(tableEntry(stringOffsets, dwarfLen, idx - 1)) == name) {
+                index = idx;
+                break;
+            }
+        }
+    } else {
+        // No hash table - the producer only left us the name list.
+        for (size_t idx = 1; idx <= nameCount; ++idx) {
+            if (strings->readString(tableEntry(stringOffsets, dwarfLen, idx - 1)) == name) {
+                index = idx;
+                break;
+            }
+        }
+    }
+    if (index == 0)
+        return rv;
+
+    // Walk the name's series of index entries in the entry pool.
+    DWARFReader er(io, entryPool + tableEntry(entryOffsets, dwarfLen, index - 1));
+    for (;;) {
+        auto code = er.getuleb128();
+        if (code == 0)
+            break;
+        auto it = abbrevs.find(code);
+        if (it == abbrevs.end())
+            break; // we can't parse past an entry we don't understand.
+        uintmax_t cu = 0;
+        uintmax_t die = 0;
+        bool haveDie = false;
+        for (const auto &attr : it->second.attrs) {
+            uintmax_t value;
+            switch (attr.form) {
+                case DW_FORM_data1:
+                case DW_FORM_ref1:
+                    value = er.getu8();
+                    break;
+                case DW_FORM_data2:
+                case DW_FORM_ref2:
+                    value = er.getu16();
+                    break;
+                case DW_FORM_data4:
+                case DW_FORM_ref4:
+                    value = er.getu32();
+                    break;
+                case DW_FORM_data8:
+                case DW_FORM_ref8:
+                    value = er.getuint(8);
+                    break;
+                case DW_FORM_udata:
+                case DW_FORM_ref_udata:
+                    value = er.getuleb128();
+                    break;
+                case DW_FORM_flag_present:
+                    value = 1;
+                    break;
+                default:
+                    return rv; // unexpected form in an index entry.
+            }
+            switch (attr.idx) {
+                case DW_IDX_compile_unit:
+                    cu = value;
+                    break;
+                case DW_IDX_die_offset:
+                    die = value;
+                    haveDie = true;
+                    break;
+                default:
+                    break;
+            }
+        }
+        // Entry DIE offsets are unit-relative: rebase via the CU table.
+        if (haveDie && cu < cuCount)
+            rv.push_back(tableEntry(cuTable, dwarfLen, cu) + die);
+    }
+    return rv;
+}
+
+const DebugNames &
+Info::names() const
+{
+    std::lock_guard<std::mutex> guard(lazyLock);
+    if (debugNames == nullptr)
+        debugNames = std::make_unique<DebugNames>(*this);
+    return *debugNames;
+}
+
+std::vector<DIE>
+Info::lookupName(const std::string &name) const
+{
+    std::vector<DIE> rv;
+    const auto &index = names();
+    if (index) {
+        for (auto off : index.lookup(name)) {
+            auto die = offsetToDIE(off);
+            if (die)
+                rv.push_back(die);
+        }
+        return rv;
+    }
+    // No accelerator - use the hashed index over the legacy pubnames data.
+    auto [begin, end] = pubnameIndex().equal_range(name);
+    for (auto it = begin; it != end; ++it)
+        rv.push_back(offsetToDIE(it->second));
+    return rv;
+}
+
+}
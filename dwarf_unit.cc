@@ -2,6 +2,7 @@
 #include "libpstack/global.h"
 #include "libpstack/dwarf.h"
 #include "libpstack/dwarf_reader.h"
+#include <algorithm>
 
 namespace pstack::Dwarf {
 
@@ -11,29 +12,87 @@ Unit::load()
     auto &abbrev { dwarf->elf->getDebugSection(".debug_abbrev", SHT_NULL) };
     DWARFReader abbR(abbrev.io(), abbrevOffset);
     uintmax_t code;
-    while ((code = abbR.getuleb128()) != 0)
-        abbreviations.emplace(std::piecewise_construct,
-                std::forward_as_tuple(code),
-                std::forward_as_tuple(abbR));
+    while ((code = abbR.getuleb128()) != 0) {
+        if (code < maxFlatAbbrev) {
+            if (flatAbbreviations.size() <= code)
+                flatAbbreviations.resize(code + 1);
+            flatAbbreviations[code].emplace(abbR);
+        } else {
+            abbreviations.emplace(std::piecewise_construct,
+                    std::forward_as_tuple(code),
+                    std::forward_as_tuple(abbR));
+        }
+    }
 }
 
 std::string
 Unit::strx(size_t idx) {
     if (!dwarf->debugStrOffsets)
         throw Exception() << "no string offsets table, but have strx form";
-    // Get the root die, and the string offset base.
-    auto base = intmax_t(root().attribute(DW_AT_str_offsets_base));
+    std::lock_guard<std::recursive_mutex> guard(unitLock);
+    // Get the root die, and the string offset base. Split (.dwo) units have
+    // no DW_AT_str_offsets_base - their table starts just after the
+    // .debug_str_offsets.dwo header.
+    const auto &battr = root().attribute(DW_AT_str_offsets_base);
+    auto base = battr.valid() ? intmax_t(battr) : intmax_t(dwarfLen == 4 ? 8 : 16);
     auto len = dwarfLen;
-    DWARFReader r(dwarf->debugStrOffsets.io(), base + len * idx);
+    auto io = dwarf->debugStrOffsets.io();
+    if (!strOffsetsLoaded) {
+        // Materialize this unit's whole contribution on first use - the
+        // length field in the contribution header just before the base
+        // bounds the entry count. Indexed attribute access is inner-loop
+        // work for locals printing, so make it an array load afterwards.
+        strOffsetsLoaded = true;
+        try {
+            uintmax_t length = len == 4
+                ? io->readObj<uint32_t>(base - 8)
+                : io->readObj<uint64_t>(base - 12);
+            size_t count = (length - 4) / len;
+            DWARFReader r(io, base);
+            strOffsets.reserve(count);
+            for (size_t i = 0; i < count; ++i)
+                strOffsets.push_back(r.getuint(len));
+        }
+        catch (const std::exception &) {
+            strOffsets.clear(); // malformed header: stay on the slow path.
+        }
+    }
+    if (idx < strOffsets.size())
+        return dwarf->debugStrings.io()->readString(strOffsets[idx]);
+    DWARFReader r(io, base + len * idx);
     return dwarf->debugStrings.io()->readString(r.getuint(len));
 }
 
 uintmax_t
 Unit::addrx(size_t idx) {
-    if (!dwarf->debugAddr)
+    // Split units index the .debug_addr table in their skeleton's file.
+    Unit *u = skeleton != nullptr ? skeleton : this;
+    if (!u->dwarf->debugAddr)
         throw Exception() << "no debug addr table, but have addrx form";
-    auto base = intmax_t(root().attribute(DW_AT_addr_base));
-    return dwarf->debugAddr.io()->readObj<Elf::Addr>(base + idx * sizeof(Elf::Addr));
+    // The table lives in the skeleton's unit when we're split - take its
+    // lock, not ours.
+    std::lock_guard<std::recursive_mutex> guard(u->unitLock);
+    auto io = u->dwarf->debugAddr.io();
+    auto base = intmax_t(u->root().attribute(DW_AT_addr_base));
+    if (!u->addrsLoaded) {
+        // As for strx: slurp the unit's .debug_addr contribution in one
+        // read, sized from the header preceding the base.
+        u->addrsLoaded = true;
+        try {
+            uintmax_t length = u->dwarfLen == 4
+                ? io->readObj<uint32_t>(base - 8)
+                : io->readObj<uint64_t>(base - 12);
+            size_t count = (length - 4) / sizeof(Elf::Addr);
+            u->addrs.resize(count);
+            io->readObj(base, u->addrs.data(), count);
+        }
+        catch (const std::exception &) {
+            u->addrs.clear();
+        }
+    }
+    if (idx < u->addrs.size())
+        return u->addrs[idx];
+    return io->readObj<Elf::Addr>(base + idx * sizeof(Elf::Addr));
 }
 
 
@@ -115,6 +174,7 @@ Unit::offsetToRawDIE(const DIE &parent, Elf::Off offset) {
     if (offset == 0 || offset < this->offset || offset >= this->end)
         return nullptr;
 
+    std::lock_guard<std::recursive_mutex> guard(unitLock);
     auto &rawptr = allEntries[offset];
     if (rawptr == nullptr) {
         rawptr = DIE::decode(this, parent, offset);
@@ -132,7 +192,8 @@ Unit::offsetToRawDIE(const DIE &parent, Elf::Off offset) {
  */
 DIE
 Unit::offsetToDIE(const DIE &parent, Elf::Off offset) {
-    if (abbreviations.empty())
+    std::lock_guard<std::recursive_mutex> guard(unitLock);
+    if (flatAbbreviations.empty() && abbreviations.empty())
         load();
     return {shared_from_this(), offset, offsetToRawDIE(parent, offset)};
 }
@@ -141,15 +202,29 @@ DIE Unit::root() {
    return offsetToDIE(DIE(), rootOffset);
 }
 
+Unit::sptr
+Unit::split()
+{
+    std::lock_guard<std::recursive_mutex> guard(unitLock);
+    if (!splitLoaded) {
+        splitLoaded = true;
+        if (unitType == DW_UT_skeleton ||
+              (version < 5 && root().attribute(DW_AT_GNU_dwo_name).valid()))
+            splitUnit = dwarf->findSplitUnit(*this);
+    }
+    return splitUnit;
+}
+
 std::string
 Unit::name()
 {
-    return root().name();
+    return std::string(root().name());
 }
 
 const Macros *
 Unit::getMacros()
 {
+    std::lock_guard<std::recursive_mutex> guard(unitLock);
     if (macros == nullptr) {
        const DIE &root_ = root();
        for (auto i : { DW_AT_GNU_macros, DW_AT_macros, DW_AT_macro_info }) {
@@ -169,24 +244,13 @@ Unit::sourceFromAddr(Elf::Addr addr, std::vector<std::pair<std::string, int>> &i
     if (d.containsAddress(addr) == ContainsAddr::NO)
         return false;
     const auto &lines = getLines();
-    if (lines != nullptr) {
-        for (auto i = lines->matrix.begin(); i != lines->matrix.end(); ++i) {
-            if (i->end_sequence)
-                continue;
-            auto next = i+1;
-            if (i->addr <= addr && next->addr > addr) {
-                const std::string &dirname = lines->directories[i->file->dirindex];
-                info.emplace_back(verbose != 0 ? dirname + "/" + i->file->name : i->file->name, i->line);
-                return true;
-            }
-        }
-    }
-    return false;
+    return lines != nullptr && lines->sourceFromAddr(addr, info);
 }
 
 const std::unique_ptr<LineInfo> &
 Unit::getLines()
 {
+    std::lock_guard<std::recursive_mutex> guard(unitLock);
     if (lines != nullptr)
         return lines;
 
@@ -205,12 +269,18 @@ Unit::getLines()
 const Abbreviation *
 Unit::findAbbreviation(size_t code) const
 {
+    std::lock_guard<std::recursive_mutex> guard(unitLock);
+    if (code < flatAbbreviations.size()) {
+        const auto &ent = flatAbbreviations[code];
+        return ent ? &*ent : nullptr;
+    }
     auto it = abbreviations.find(code);
     return it != abbreviations.end() ? &it->second : nullptr;
 }
 
 const std::unique_ptr<Ranges> &
 Unit::getRanges(const DIE &die, uintmax_t base) {
+    std::lock_guard<std::recursive_mutex> guard(unitLock);
     if (base == 0) {
        const DIE::Attribute & low = root().attribute(DW_AT_low_pc);
        if (low.valid())
@@ -223,12 +293,121 @@ Unit::getRanges(const DIE &die, uintmax_t base) {
     return ptr;
 }
 
+void
+Unit::buildAddrIndex(const DIE &die, Elf::Off parentIndexed)
+{
+    auto tag = die.tag();
+    if (tag == DW_TAG_subprogram || tag == DW_TAG_inlined_subroutine) {
+        auto low = die.attribute(DW_AT_low_pc, true);
+        auto high = die.attribute(DW_AT_high_pc, true);
+        if (low.valid() && high.valid()) {
+            Elf::Addr start = uintmax_t(low);
+            // high_pc is either an address, or an offset from low_pc.
+            Elf::Addr end;
+            switch (high.form()) {
+                case DW_FORM_data1:
+                case DW_FORM_data2:
+                case DW_FORM_data4:
+                case DW_FORM_data8:
+                case DW_FORM_udata:
+                    end = start + uintmax_t(high);
+                    break;
+                default:
+                    end = uintmax_t(high);
+                    break;
+            }
+            addrIndex.push_back({start, end, die.getOffset(), parentIndexed, tag});
+        } else if (die.attribute(DW_AT_ranges).valid()) {
+            const auto &ranges = getRanges(die, low.valid() ? uintmax_t(low) : 0);
+            if (ranges != nullptr)
+                for (const auto &range : *ranges)
+                    addrIndex.push_back(
+                          {range.first, range.second, die.getOffset(), parentIndexed, tag});
+        }
+        parentIndexed = die.getOffset();
+    }
+    for (auto child : die.children())
+        buildAddrIndex(child, parentIndexed);
+}
+
+DIE
+Unit::findEntryForAddr(Elf::Addr addr, Tag t, const DIE &start)
+{
+    std::lock_guard<std::recursive_mutex> guard(unitLock);
+    if (!addrIndexBuilt) {
+        buildAddrIndex(root(), 0);
+        std::sort(addrIndex.begin(), addrIndex.end(),
+              [](const AddrEntry &lhs, const AddrEntry &rhs) { return lhs.start < rhs.start; });
+        for (const auto &ent : addrIndex)
+            addrIndexMaxRange = std::max(addrIndexMaxRange, ent.end - ent.start);
+        addrIndexBuilt = true;
+    }
+
+    // When searching from the root, we want top-level entries; otherwise, we
+    // want entries nested directly below "start" - repeated calls walk down
+    // through nested inlined subroutines one level at a time.
+    Elf::Off parentWanted = isRoot(start) ? 0 : start.getOffset();
+
+    auto it = std::upper_bound(addrIndex.begin(), addrIndex.end(), addr,
+          [](Elf::Addr lhs, const AddrEntry &rhs) { return lhs < rhs.start; });
+    while (it != addrIndex.begin()) {
+        --it;
+        if (addr - it->start > addrIndexMaxRange)
+            break; // nothing further back can reach this address.
+        if (it->tag == t && it->end > addr && it->parent == parentWanted)
+            return offsetToDIE(DIE(), it->die);
+    }
+    return DIE();
+}
+
+const std::vector<Elf::Off> &
+Unit::inlineChain(Elf::Addr addr, const DIE &function)
+{
+    std::lock_guard<std::recursive_mutex> guard(unitLock);
+    auto [it, isnew] = inlineChains.emplace(addr, std::vector<Elf::Off>());
+    if (isnew) {
+        for (DIE f = function;;) {
+            DIE inl = findEntryForAddr(addr, DW_TAG_inlined_subroutine, f);
+            if (!inl)
+                break;
+            it->second.push_back(inl.getOffset());
+            f = std::move(inl);
+        }
+    }
+    return it->second;
+}
+
 void
 Unit::purge()
 {
+    std::lock_guard<std::recursive_mutex> guard(unitLock);
     allEntries = AllEntries();
     rangesForOffset = decltype(rangesForOffset)();
     macros.reset(nullptr);
+    // Start a fresh arena - the old one dies once any outstanding DIEs do.
+    arena = std::make_shared<Arena>();
+}
+
+void *
+Arena::allocate(size_t size, size_t align)
+{
+    used = (used + align - 1) & ~(align - 1);
+    if (used + size > chunkSize) {
+        if (size > chunkSize) {
+            // Oversized request: give it a dedicated chunk, and keep bumping
+            // through the current one.
+            chunks.push_back(std::make_unique<char[]>(size));
+            char *p = chunks.back().get();
+            if (chunks.size() > 1)
+                std::swap(chunks[chunks.size() - 2], chunks.back());
+            return p;
+        }
+        chunks.push_back(std::make_unique<char[]>(chunkSize));
+        used = 0;
+    }
+    char *p = chunks.back().get() + used;
+    used += size;
+    return p;
 }
 
 }
@@ -98,6 +98,29 @@ operator <<( std::ostream &os, DW_LLE lle) {
 };
 
 
+namespace {
+/*
+ * Classify a location expression, so the dominant single-op forms can be
+ * answered without running the interpreter for every frame. Anything more
+ * complex falls back to bytecode interpretation.
+ */
+Dwarf::Unit::CompiledLocation
+compileLocation(const Reader::csptr &io, const Dwarf::Block &block)
+{
+    using CompiledLocation = Dwarf::Unit::CompiledLocation;
+    Dwarf::DWARFReader r(io, block.offset, block.offset + block.length);
+    auto op = Dwarf::ExpressionOp(r.getu8());
+    if (op == Dwarf::DW_OP_call_frame_cfa && r.empty())
+        return {CompiledLocation::CFA, 0};
+    if (op == Dwarf::DW_OP_fbreg) {
+        auto offset = r.getsleb128();
+        if (r.empty())
+            return {CompiledLocation::FBREG, offset};
+    }
+    return {CompiledLocation::INTERPRET, 0};
+}
+}
+
 /*
  * Evaluate an expression specified by an exprloc, or as inferred by a location list
  */
@@ -194,8 +217,21 @@ ExpressionStack::eval(Process &proc, const Dwarf::DIE::Attribute &attr,
         case Dwarf::DW_FORM_block:
         case Dwarf::DW_FORM_exprloc: {
             const auto &block = Dwarf::Block(attr);
-            Dwarf::DWARFReader r(dwarf->debugInfo.io(), block.offset, block.offset + block.length);
-            return eval(proc, r, frame, reloc);
+            auto &compiled = unit->locationCache[block.offset];
+            if (compiled.kind == Dwarf::Unit::CompiledLocation::UNCOMPILED)
+                compiled = compileLocation(dwarf->debugInfo.io(), block);
+            switch (compiled.kind) {
+                case Dwarf::Unit::CompiledLocation::CFA:
+                    isValue = false;
+                    return frame->cfa;
+                case Dwarf::Unit::CompiledLocation::FBREG:
+                    isValue = false;
+                    return frame->getFrameBase(proc) + compiled.offset;
+                default: {
+                    Dwarf::DWARFReader r(dwarf->debugInfo.io(), block.offset, block.offset + block.length);
+                    return eval(proc, r, frame, reloc);
+                }
+            }
         }
         default:
             abort();
@@ -464,11 +500,34 @@ std::optional<Elf::CoreRegisters> StackFrame::unwind(Process &p) {
 
     DWARFReader r(cfi->io, fde->instructions, fde->end);
 
-    auto iter = location.dwarf()->callFrameForAddr.find(objaddr);
-    if (iter == location.dwarf()->callFrameForAddr.end())
-        location.dwarf()->callFrameForAddr[objaddr] = cie->execInsns(r, fde->iloc, objaddr);
-
-    const CallFrame &dcf = location.dwarf()->callFrameForAddr[objaddr];
+    // The unwind rules are cached per row of the unwind table, so all frames
+    // in the address range of the row share an entry, whatever thread they
+    // belong to. Map nodes are stable, so the pointer remains valid once we
+    // release the lock.
+    auto info = location.dwarf();
+    auto &rows = info->callFrameForAddr;
+    const CallFrame *dcfp = nullptr;
+    {
+        std::lock_guard<std::mutex> guard(info->frameLock);
+        auto iter = rows.upper_bound(objaddr);
+        if (iter != rows.begin()) {
+            --iter;
+            if (objaddr < iter->second.first)
+                dcfp = &iter->second.second;
+        }
+    }
+    if (dcfp == nullptr) {
+        uintmax_t rowStart;
+        uintmax_t rowEnd;
+        auto newFrame = cie->execInsns(r, fde->iloc, objaddr, &rowStart, &rowEnd);
+        rowEnd = std::min(rowEnd, uintmax_t(fde->iloc + fde->irange));
+        std::lock_guard<std::mutex> guard(info->frameLock);
+        auto [pos, inserted] = rows.emplace(Elf::Addr(rowStart),
+                std::make_pair(Elf::Addr(rowEnd), std::move(newFrame)));
+        (void)inserted;
+        dcfp = &pos->second.second;
+    }
+    const CallFrame &dcf = *dcfp;
 
     // Given the registers available, and the state of the call unwind data,
     // calculate the CFA at this point.
@@ -500,11 +559,8 @@ std::optional<Elf::CoreRegisters> StackFrame::unwind(Process &p) {
         default:
             cfa = -1;
     }
-    auto rarInfo = dcf.registers.find(cie->rar);
-
-    for (const auto &entry : dcf.registers) {
-        const RegisterUnwind &unwind = entry.second;
-        int regno = entry.first;
+    for (int regno = 0; regno < CallFrame::maxReg; ++regno) {
+        const RegisterUnwind &unwind = dcf.registers[regno];
         switch (unwind.type) {
             case ARCH:
 #ifdef CFA_RESTORE_REGNO
@@ -544,13 +600,13 @@ std::optional<Elf::CoreRegisters> StackFrame::unwind(Process &p) {
     }
 
     // If the return address isn't defined, then we can't unwind.
-    if (rarInfo == dcf.registers.end() || rarInfo->second.type == UNDEF || cfa == 0) {
+    const RegisterUnwind &rarInfo = dcf.reg(cie->rar);
+    if (rarInfo.type == UNDEF || cfa == 0) {
         if (verbose > 1) {
            *debug << "DWARF unwinding stopped at "
               << std::hex << location.address() << std::dec
               << ": " <<
-              (rarInfo == dcf.registers.end() ? "no RAR register found"
-               : rarInfo->second.type == UNDEF ? "RAR register undefined"
+              (rarInfo.type == UNDEF ? "RAR register undefined"
                : "null CFA for frame")
               << std::endl;
         }
@@ -567,6 +623,7 @@ std::optional<Elf::CoreRegisters> StackFrame::unwind(Process &p) {
 
 const Elf::MaybeNamedSymbol &
 CodeLocation::symbol() const {
+    std::lock_guard<std::mutex> guard(lazyLock);
     if (!symbol_ && dwarf_) {
         symbol_ = dwarf_->elf->findSymbolByAddress(location_, STT_NOTYPE);
     }
@@ -582,10 +639,12 @@ ProcessLocation::symbol() const {
 
 const Dwarf::FDE *
 CodeLocation::fde() const {
-    if (fde_ == nullptr) {
+    std::lock_guard<std::mutex> guard(lazyLock);
+    if (!fdeSearched_) {
+        fdeSearched_ = true;
         const Dwarf::CFI *cfip = cfi();
         if (cfip != nullptr)
-            fde_ = cfi()->findFDE(location_);
+            fde_ = cfip->findFDE(location_);
     }
     return fde_;
 }
@@ -599,9 +658,13 @@ ProcessLocation::fde() const {
 
 const Dwarf::DIE &
 CodeLocation::die() const {
+    std::lock_guard<std::mutex> guard(lazyLock);
     if (!die_ && dwarf_) {
         Dwarf::Unit::sptr u = dwarf_->lookupUnit(location_);
         if (u) {
+            // -gsplit-dwarf: the subprogram detail lives in the .dwo's unit.
+            if (auto splitUnit = u->split(); splitUnit != nullptr)
+                u = splitUnit;
             die_ = u->root().findEntryForAddr(location_, Dwarf::DW_TAG_subprogram);
         }
     }
@@ -651,14 +714,22 @@ CodeLocation::CodeLocation(Dwarf::Info::sptr info, const Elf::Phdr *phdr, Elf::A
 void
 ProcessLocation::set(Process &proc, Elf::Addr address)
 {
+    this->location = address;
+    {
+        std::lock_guard<std::mutex> guard(proc.locationsLock);
+        auto it = proc.codeLocations.find(address);
+        if (it != proc.codeLocations.end()) {
+            codeloc = it->second;
+            return;
+        }
+    }
     auto [ elfReloc, elf, phdr ] = proc.findSegment(address);
     auto dwarf = elf ? proc.getDwarf(elf) : nullptr;
-    if (dwarf) {
-        codeloc = std::make_shared<CodeLocation>(dwarf, phdr, address - elfReloc);
-    } else {
-        this->codeloc = nullptr;
-    }
-    this->location = address;
+    auto loc = dwarf
+        ? std::make_shared<CodeLocation>(dwarf, phdr, address - elfReloc)
+        : nullptr;
+    std::lock_guard<std::mutex> guard(proc.locationsLock);
+    codeloc = proc.codeLocations.emplace(address, std::move(loc)).first->second;
 }
 
 Dwarf::CFI *
@@ -1,4 +1,5 @@
 #include "libpstack/elf.h"
+#include "libpstack/stats.h"
 #include "libpstack/global.h"
 #include "libpstack/stringify.h"
 #include "libpstack/ioflag.h"
@@ -9,12 +10,20 @@
 #ifdef WITH_LZMA
 #include "libpstack/lzmareader.h"
 #endif
+#ifdef WITH_ZSTD
+#include "libpstack/zstdreader.h"
+#endif
+#ifdef WITH_DEBUGINFOD
+#include <elfutils/debuginfod.h>
+#endif
 
 #include <algorithm>
 #include <iomanip>
 #include <iostream>
+#include <sstream>
 #include <cstring>
 
+#include <sys/stat.h>
 #include <unistd.h>
 
 namespace pstack::Elf {
@@ -132,22 +141,41 @@ Object::symbolVersion(VersionIdx idx) const {
     const SymbolVersioning *vi = symbolVersions();
 
     unsigned i = idx.idx & 0x7fffU;
-    if (i >= 2)
-        return vi->versions.at(i);
-    else
-        return std::nullopt;
+    if (i >= 2 && i < vi->byIndex.size() && vi->byIndex[i] != nullptr)
+        return *vi->byIndex[i];
+    return std::nullopt;
 }
 
 VersionIdx Object::versionIdxForSymbol(size_t idx) const {
-   return VersionIdx(*gnu_version ?
-           gnu_version->io()->readObj<Half>(idx * 2) :
+   const auto &vi = *symbolVersions();
+   return VersionIdx(idx < vi.symbols.size() ?
+           vi.symbols[idx] :
            std::numeric_limits<Half>::max());
 }
 
 std::pair<uint32_t, Sym>
 GnuHash::findSymbol(const char *name) const {
-    auto symhash = gnu_hash(name);
+    return lookup(name, gnu_hash(name));
+}
 
+std::map<std::string, std::pair<uint32_t, Sym>>
+GnuHash::findSymbols(const std::vector<std::string> &names) const {
+    // hash all the names up front, then probe the table for each.
+    std::vector<uint32_t> hashes;
+    hashes.reserve(names.size());
+    for (const auto &name : names)
+        hashes.push_back(gnu_hash(name.c_str()));
+    std::map<std::string, std::pair<uint32_t, Sym>> rv;
+    for (size_t i = 0; i < names.size(); ++i) {
+        auto [idx, sym] = lookup(names[i].c_str(), hashes[i]);
+        if (idx != 0)
+            rv[names[i]] = std::make_pair(idx, sym);
+    }
+    return rv;
+}
+
+std::pair<uint32_t, Sym>
+GnuHash::lookup(const char *name, uint32_t symhash) const {
     auto bloomword = hash->readObj<Elf::Off>(bloomoff((symhash/ELF_BITS) % header.bloom_size));
 
     Elf::Off mask = Elf::Off(1) << symhash % ELF_BITS |
@@ -166,6 +194,7 @@ GnuHash::findSymbol(const char *name) const {
         return std::make_pair(0, undef());
     }
     for (;;) {
+        stats::count(stats::symbolsScanned);
         auto sym = syms->readObj<Sym>(idx * sizeof (Sym));
         auto chainhash = hash->readObj<uint32_t>(chainoff(idx - header.symoffset));
         if ((chainhash | 1U)  == (symhash | 1U) && strings->readString(sym.st_name) == name)
@@ -189,6 +218,7 @@ SymbolSection *Object::dynamicSymbols() {
 
 SymbolSection *
 Object::getSymtab(std::unique_ptr<SymbolSection> &table, const char *name, int type) const {
+    std::lock_guard<std::recursive_mutex> guard(elfLock);
     if (table == nullptr) {
         const Section &sec {getDebugSection( name, type )};
         table = std::make_unique<SymbolSection>(sec.io(), getLinkedSection(sec).io());
@@ -215,6 +245,20 @@ Object::Object(ImageCache &cache, Reader::csptr io_, bool isDebug)
         std::sort(phdrs.second.begin(), phdrs.second.end(),
                 [] (const Phdr &lhs, const Phdr &rhs) {
                     return lhs.p_vaddr < rhs.p_vaddr; });
+    // Section headers, their name map, and the dynamic and version
+    // scaffolding hung off them are parsed on first touch - see
+    // ensureSections(). A fast unwind only needs the program headers for
+    // most mapped objects, and attaching to a process with hundreds of DSOs
+    // pays the section parse for each of them up front otherwise.
+}
+
+void
+Object::ensureSections() const
+{
+    std::lock_guard<std::recursive_mutex> guard(elfLock);
+    if (sectionsLoaded)
+        return;
+    sectionsLoaded = true;
 
     // Make sure the header sections are present in the reader, otherwise, skip.
     if (elfHeader.e_shoff < io->size()) {
@@ -231,7 +275,7 @@ Object::Object(ImageCache &cache, Reader::csptr io_, bool isDebug)
 
        int i = 0;
        for (Elf::Off off = elfHeader.e_shoff; i < headerCount; i++) {
-           sectionHeaders.emplace_back(std::make_unique<Section>(this, off));
+           sectionHeaders.emplace_back(std::make_unique<Section>(const_cast<Object *>(this), off));
            if (i == 0 && elfHeader.e_shnum == 0) {
                headerCount = sectionHeaders[0]->shdr.sh_size;
                sectionHeaders.reserve(headerCount);
@@ -280,6 +324,7 @@ Object::Object(ImageCache &cache, Reader::csptr io_, bool isDebug)
 const SymbolVersioning *
 Object::symbolVersions() const
 {
+    std::lock_guard<std::recursive_mutex> guard(elfLock);
     if (symbolVersions_ != nullptr)
         return symbolVersions_.get();
 
@@ -341,6 +386,18 @@ Object::symbolVersions() const
           }
        }
     }
+    // Flatten for per-symbol queries: slurp the .gnu.version index array in
+    // one read, and index the version names by number.
+    if (gnu_version != nullptr && *gnu_version) {
+        auto io = gnu_version->io();
+        rv->symbols.resize(io->size() / sizeof (Half));
+        io->readObj(0, rv->symbols.data(), rv->symbols.size());
+    }
+    if (!rv->versions.empty()) {
+        rv->byIndex.resize(rv->versions.rbegin()->first + 1, nullptr);
+        for (const auto &[idx, name] : rv->versions)
+            rv->byIndex[idx] = &name;
+    }
     symbolVersions_ = std::move(rv);
     return symbolVersions_.get();
 }
@@ -348,10 +405,9 @@ Object::symbolVersions() const
 const Phdr *
 Object::getSegmentForAddress(Off a) const
 {
-    if (lastSegmentForAddress != nullptr &&
-          lastSegmentForAddress->p_vaddr <= a &&
-          lastSegmentForAddress->p_vaddr + lastSegmentForAddress->p_memsz > a)
-       return lastSegmentForAddress;
+    const Phdr *last = lastSegmentForAddress;
+    if (last != nullptr && last->p_vaddr <= a && last->p_vaddr + last->p_memsz > a)
+       return last;
     const auto &hdrs = getSegments(PT_LOAD);
 
     auto pos = std::lower_bound(hdrs.begin(), hdrs.end(), a,
@@ -359,7 +415,7 @@ Object::getSegmentForAddress(Off a) const
             return header.p_vaddr + header.p_memsz <= addr; });
     if (pos != hdrs.end() && pos->p_vaddr <= a) {
         lastSegmentForAddress = &*pos;
-        return lastSegmentForAddress;
+        return &*pos;
     }
     return nullptr;
 }
@@ -388,46 +444,75 @@ Object::getInterpreter() const
     return "";
 }
 
+Object::AddressIndex &
+Object::getAddressIndex(std::unique_ptr<AddressIndex> &ptr, SymbolSection *syms)
+{
+    std::lock_guard<std::recursive_mutex> guard(elfLock);
+    if (ptr == nullptr) {
+        ensureSections();
+        ptr = std::make_unique<AddressIndex>();
+        uint32_t idx = 0;
+        for (const auto &sym : *syms) {
+            if (sym.st_shndx < sectionHeaders.size()) {
+                ptr->ents.push_back({sym.st_value, sym.st_size, idx, sym.st_info, sym.st_shndx});
+                ptr->maxSize = std::max(ptr->maxSize, Addr(sym.st_size));
+            }
+            ++idx;
+        }
+        // stable, so symbols at the same address keep their table order.
+        std::stable_sort(ptr->ents.begin(), ptr->ents.end(),
+                [] (const AddressIndex::Ent &lhs, const AddressIndex::Ent &rhs) {
+                    return lhs.value < rhs.value; });
+    }
+    return *ptr;
+}
+
 /*
  * Find the symbol that represents a particular address.
  */
 std::optional<std::pair<Sym, string>>
 Object::findSymbolByAddress(Addr addr, int type)
 {
+    std::lock_guard<std::recursive_mutex> guard(elfLock);
     /* Try to find symbols in these sections */
     bool haveExactZeroSizeMatch = false;
 
     Sym sym;
     std::string name;
-    auto findSym = [&] (auto &table) {
-        for (const auto &candidate : table) {
-            if (candidate.st_shndx >= sectionHeaders.size())
-                continue;
-            if (type != STT_NOTYPE && ELF_ST_TYPE(candidate.st_info) != type)
+    auto findSym = [&] (AddressIndex &index, SymbolSection &table) {
+        auto &ents = index.ents;
+        // Start just past the last symbol at or below addr, and walk back
+        // over candidates that might span it.
+        auto it = std::upper_bound(ents.begin(), ents.end(), addr,
+                [] (Addr lhs, const AddressIndex::Ent &rhs) { return lhs < rhs.value; });
+        while (it != ents.begin()) {
+            const auto &candidate = *--it;
+            stats::count(stats::symbolsScanned);
+            if (addr - candidate.value > index.maxSize)
+                break; // no earlier symbol can reach this far forward.
+            if (type != STT_NOTYPE && ELF_ST_TYPE(candidate.info) != type)
                 continue;
-            if (candidate.st_value > addr)
-                continue;
-            if (candidate.st_size + candidate.st_value <= addr) {
-                if (candidate.st_size == 0 && candidate.st_value == addr) {
-                    sym = candidate;
-                    name = table.name(candidate);
+            if (candidate.size + candidate.value <= addr) {
+                if (candidate.size == 0 && candidate.value == addr && !haveExactZeroSizeMatch) {
+                    sym = table[candidate.idx];
+                    name = table.name(sym);
                     haveExactZeroSizeMatch = true;
                 }
                 continue;
             }
-            auto &sec = sectionHeaders[candidate.st_shndx];
+            auto &sec = sectionHeaders[candidate.shndx];
             if ((sec->shdr.sh_flags & SHF_ALLOC) == 0)
                 continue;
-            sym = candidate;
-            name = table.name(candidate);
+            sym = table[candidate.idx];
+            name = table.name(sym);
             return true;
         }
         sym.st_shndx = SHN_UNDEF;
         return false;
     };
-    if (findSym(*debugSymbols()))
+    if (findSym(getAddressIndex(debugAddressIndex, debugSymbols()), *debugSymbols()))
         return std::make_pair( sym, name );
-    if (findSym(*dynamicSymbols()))
+    if (findSym(getAddressIndex(dynamicAddressIndex, dynamicSymbols()), *dynamicSymbols()))
         return std::make_pair( sym, name );
     // .gnu_debugdata is a separate LZMA-compressed ELF image with just
     // a symbol table.
@@ -463,6 +548,7 @@ Object::findSymbolByAddress(Addr addr, int type)
 const Section &
 Object::getSection(const string &name, Word type) const
 {
+    ensureSections();
     auto s = namedSection.find(name);
     if (s != namedSection.end()) {
         auto &ref = sectionHeaders[s->second];
@@ -497,6 +583,7 @@ Object::getDebugSection(const string &name, Word type) const
 const Section &
 Object::getSection(Word idx) const
 {
+    ensureSections();
     if (sectionHeaders[idx]->shdr.sh_type != SHT_NULL)
         return *sectionHeaders[idx];
     return *sectionHeaders[0];
@@ -505,6 +592,7 @@ Object::getSection(Word idx) const
 const Section &
 Object::getLinkedSection(const Section &from) const
 {
+    ensureSections();
     if (!from)
         return from;
     if (from.elf == this) // it might come from the debug object...
@@ -523,6 +611,7 @@ Object::getLinkedSection(const Section &from) const
 std::pair<Sym, size_t>
 Object::findDynamicSymbol(const std::string &name)
 {
+    std::lock_guard<std::recursive_mutex> guard(elfLock);
     Sym sym;
     uint32_t idx;
 
@@ -537,17 +626,140 @@ Object::findDynamicSymbol(const std::string &name)
     return {sym, idx};
 }
 
+std::map<string, std::pair<Sym, size_t>>
+Object::findDynamicSymbols(const std::vector<string> &names)
+{
+    std::lock_guard<std::recursive_mutex> guard(elfLock);
+    std::map<string, std::pair<Sym, size_t>> rv;
+    if (names.empty())
+        return rv;
+    auto hits = gnu_hash() ? gnu_hash()->findSymbols(names)
+            : hash() ? hash()->findSymbols(names)
+            : std::map<string, std::pair<uint32_t, Sym>>();
+    for (const auto &[name, hit] : hits)
+        rv[name] = std::make_pair(hit.second, hit.first);
+    return rv;
+}
+
+namespace {
+
+/*
+ * On-disk symbol-name index, keyed by build-id under the user's cache
+ * directory: a header, a name-sorted table of (name offset, symbol index)
+ * pairs, then a blob of NUL-terminated names. A warm start is then an mmap
+ * and a binary search rather than a full .symtab scan.
+ */
+struct SymbolIndexHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t symtabSize; // entries in the symtab indexed - sanity check.
+    uint64_t count;
+};
+struct SymbolIndexEnt {
+    uint64_t nameoff;
+    uint64_t symidx;
+};
+constexpr uint32_t symbolIndexMagic = 0x70737378; // "pssx"
+constexpr uint32_t symbolIndexVersion = 1;
+
+}
+
+bool
+Object::loadSymbolIndex()
+{
+    auto dir = cacheDirectory();
+    if (dir == "")
+        return false;
+    auto id = buildID();
+    if (id == "")
+        return false;
+    try {
+        auto io = std::make_shared<MmapReader>(stringify(dir, "/", id, ".symidx"));
+        auto hdr = io->readObj<SymbolIndexHeader>(0);
+        if (hdr.magic != symbolIndexMagic
+                || hdr.version != symbolIndexVersion
+                || hdr.symtabSize != debugSymbols()->size()
+                || io->size() < sizeof hdr + hdr.count * sizeof (SymbolIndexEnt))
+            return false;
+        symbolIndex = io;
+        symbolIndexCount = hdr.count;
+        if (verbose >= 2)
+            *debug << "loaded symbol index for " << *this->io << " from " << *io << "\n";
+        return true;
+    }
+    catch (const std::exception &ex) {
+        return false;
+    }
+}
+
+void
+Object::saveSymbolIndex()
+{
+    auto dir = cacheDirectory();
+    if (dir == "")
+        return;
+    auto id = buildID();
+    if (id == "")
+        return;
+    auto path = stringify(dir, "/", id, ".symidx");
+    auto tmp = stringify(path, ".", getpid());
+    int fd = ::open(tmp.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if (fd == -1)
+        return;
+    // cachedSymbols is an ordered map, so iteration gives us the names
+    // already sorted.
+    std::vector<SymbolIndexEnt> ents;
+    ents.reserve(cachedSymbols->size());
+    string blob;
+    uint64_t strbase = sizeof (SymbolIndexHeader) + cachedSymbols->size() * sizeof (SymbolIndexEnt);
+    for (const auto &[symname, idx] : *cachedSymbols) {
+        ents.push_back({strbase + blob.size(), idx});
+        blob += symname;
+        blob += '\0';
+    }
+    SymbolIndexHeader hdr { symbolIndexMagic, symbolIndexVersion, debugSymbols()->size(), ents.size() };
+    bool ok = write(fd, &hdr, sizeof hdr) == ssize_t(sizeof hdr)
+        && write(fd, ents.data(), ents.size() * sizeof (SymbolIndexEnt))
+                == ssize_t(ents.size() * sizeof (SymbolIndexEnt))
+        && write(fd, blob.data(), blob.size()) == ssize_t(blob.size());
+    close(fd);
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+        unlink(tmp.c_str());
+    else if (verbose >= 2)
+        *debug << "wrote symbol index " << path << " for " << *io << "\n";
+}
+
 std::pair<Sym, size_t>
 Object::findDebugSymbol(const string &name)
 {
-    // Cache all debug symbols the first time we scan them.
-    //
+    std::lock_guard<std::recursive_mutex> guard(elfLock);
+    // Use a previously-saved on-disk index if there is one; otherwise cache
+    // all debug symbols the first time we scan them, and try to save the
+    // result for the next run.
     auto &syms = *debugSymbols();
-    if (!cachedSymbols) {
+    if (!cachedSymbols && symbolIndex == nullptr && !loadSymbolIndex()) {
        cachedSymbols = std::make_unique<std::map<std::string, size_t>>();
        size_t idx = 0;
        for (auto sym : syms)
           (*cachedSymbols)[syms.name(sym)] = idx++;
+       saveSymbolIndex();
+    }
+    if (symbolIndex != nullptr) {
+       const char *base = symbolIndex->window(0, symbolIndex->size());
+       const auto *ents = reinterpret_cast<const SymbolIndexEnt *>(base + sizeof (SymbolIndexHeader));
+       size_t lo = 0;
+       size_t hi = symbolIndexCount;
+       while (lo < hi) {
+          size_t mid = (lo + hi) / 2;
+          int cmp = strcmp(name.c_str(), base + ents[mid].nameoff);
+          if (cmp == 0)
+             return { syms[ents[mid].symidx], ents[mid].symidx };
+          if (cmp < 0)
+             hi = mid;
+          else
+             lo = mid + 1;
+       }
+       return {undef(), 0};
     }
     auto iter = cachedSymbols->find(name);
     if (iter != cachedSymbols->end())
@@ -555,31 +767,37 @@ Object::findDebugSymbol(const string &name)
     return {undef(), 0};
 }
 
-Object *
-Object::getDebug() const
+std::string
+Object::buildID() const
 {
-    if (debugLoaded || noExtDebug)
-        return debugObject.get();
-    debugLoaded = true;
-
-    // Use the build ID to find debug data.
     for (const auto &note : notes()) {
         if (note.name() == "GNU" && note.type() == GNU_BUILD_ID) {
-            std::ostringstream dir;
-            dir << ".build-id/";
-            size_t i;
             auto io = note.data();
             std::vector<unsigned char> data(io->size());
             io->readObj(0, &data[0], io->size());
-            dir << std::hex << std::setw(2) << std::setfill('0') << int(data[0]);
-            dir << "/";
-            for (i = 1; i < size_t(io->size()); ++i)
-                dir << std::setw(2) << int(data[i]);
-            dir << ".debug" << std::dec;
-            debugObject = imageCache.getDebugImage(dir.str());
-            break;
+            std::ostringstream os;
+            os << std::hex << std::setfill('0');
+            for (auto byte : data)
+                os << std::setw(2) << int(byte);
+            return os.str();
         }
     }
+    return "";
+}
+
+Object *
+Object::getDebug() const
+{
+    std::lock_guard<std::recursive_mutex> guard(elfLock);
+    if (debugLoaded || noExtDebug)
+        return debugObject.get();
+    debugLoaded = true;
+
+    // Use the build ID to find debug data.
+    auto id = buildID();
+    if (id != "")
+        debugObject = imageCache.getDebugImage(
+                stringify(".build-id/", id.substr(0, 2), "/", id.substr(2), ".debug"));
 
     // If that doesn't work, maybe the gnu_debuglink is valid?
     if (!debugObject) {
@@ -592,6 +810,10 @@ Object::getDebug() const
         }
     }
 
+    // Nothing local: ask a debuginfod server, if support is compiled in.
+    if (!debugObject && id != "")
+        debugObject = imageCache.getDebugImageForBuildID(id);
+
     if (!debugObject) {
         if (verbose >= 2)
            *debug << "no debug object for " << *this->io << "\n";
@@ -655,11 +877,29 @@ SymHash::findSymbol(const string &name)
     return std::make_pair(0, undef());
 }
 
+std::map<string, std::pair<uint32_t, Sym>>
+SymHash::findSymbols(const std::vector<string> &names)
+{
+    std::map<string, std::pair<uint32_t, Sym>> rv;
+    for (const auto &name : names) {
+        auto [idx, sym] = findSymbol(name);
+        if (idx != 0)
+            rv[name] = std::make_pair(idx, sym);
+    }
+    return rv;
+}
+
 Section::Section(Object *elf, Off off) : elf(elf) {
     elf->io->readObj(off, &shdr);
 }
 
 Reader::csptr Section::io() const {
+    // The reader is built lazily and may be shared with a prefetch thread -
+    // hold the owning object's lock while creating it. The null section has
+    // no owner (and nothing to decompress).
+    std::unique_lock<std::recursive_mutex> guard;
+    if (elf != nullptr)
+        guard = std::unique_lock(elf->elfLock);
     if (io_ != nullptr)
         return io_;
 
@@ -668,22 +908,42 @@ Reader::csptr Section::io() const {
         return io_;
     }
 
-    // deal with two possible zlib-compressed sections. The sane,
-    // "SHF_COMPRESSED" version, and the hacky ".zdebug_" versions.
-#ifndef WITH_ZLIB
-    bool wantedZlib = false;
-#endif
+    // deal with compressed sections: the sane "SHF_COMPRESSED" version (with
+    // a Chdr naming the algorithm), and the hacky ".zdebug_" versions.
+
+    // Warn (once) if we find one we can't decompress, either because support
+    // isn't compiled in or the compression type is unknown.
+    auto warnCompressed = [this](unsigned type) {
+        static bool warned = false;
+        if (!warned && debug) {
+            warned = true;
+            *debug << "warning: no support configured for compression type "
+                << type << " of debug info in section " << name << " of "
+                << *elf->io << std::endl;
+        }
+    };
 
     auto rawIo = elf->io->view(name, shdr.sh_offset, shdr.sh_size);
     if ((shdr.sh_flags & SHF_COMPRESSED) != 0) {
-#ifdef WITH_ZLIB
         auto chdr = rawIo->readObj<Chdr>(0);
-        io_ = make_shared<InflateReader>(
-              chdr.ch_size,
-              *rawIo->view("ZLIB compressed content after chdr", sizeof chdr, shdr.sh_size - sizeof chdr));
-#else
-        wantedZlib = true;
+        auto content = rawIo->view("compressed content after chdr",
+              sizeof chdr, shdr.sh_size - sizeof chdr);
+        switch (chdr.ch_type) {
+#ifdef WITH_ZLIB
+            case ELFCOMPRESS_ZLIB:
+                io_ = make_shared<InflateReader>(chdr.ch_size, *content);
+                break;
+#endif
+#ifdef WITH_ZSTD
+            case ELFCOMPRESS_ZSTD:
+                // decompresses lazily, caching the decoded blocks.
+                io_ = make_shared<ZstdReader>(content);
+                break;
 #endif
+            default:
+                warnCompressed(chdr.ch_type);
+                break;
+        }
     } else if (name.rfind(".zdebug_", 0) == 0) {
         unsigned char sig[12];
         rawIo->readObj(0, sig, sizeof sig);
@@ -698,36 +958,121 @@ Reader::csptr Section::io() const {
                   sz,
                   *rawIo->view("ZLIB compressed content after magic signature", sizeof sig, sz));
 #else
-            wantedZlib = true;
+            warnCompressed(ELFCOMPRESS_ZLIB);
 #endif
         }
     } else {
         io_ = rawIo;
     }
-#ifndef WITH_ZLIB
-    if (wantedZlib) {
-        static bool warned = false;
-        if (!warned && debug) {
-            warned = true;
-            *debug <<"warning: no support configured for compressed debug info in section "
-                << name << " of " << *elf->io << std::endl;
-        }
-    }
-#endif
     if (io_ == nullptr)
         io_ = make_shared<NullReader>();
     return io_;
 }
 
+namespace {
+string
+dirOf(const string &path)
+{
+    auto slash = path.rfind('/');
+    return slash == string::npos ? "." : path.substr(0, slash);
+}
+}
+
+// Called with imagesLock held. Consult the directory's cached mtime, going
+// back to stat() only once the cached value is a few seconds old - the
+// debug directories are shared by every probe, so this bounds the stat
+// traffic regardless of how many images are scanned.
+time_t
+ImageCache::debugDirMtime(const string &dir)
+{
+    auto now = std::chrono::steady_clock::now();
+    auto it = dirTimes.find(dir);
+    if (it != dirTimes.end() && now - it->second.checked < std::chrono::seconds(5))
+        return it->second.mtime;
+    struct stat buf{};
+    time_t mtime = ::stat(dir.c_str(), &buf) == 0 ? buf.st_mtime : 0;
+    dirTimes[dir] = { mtime, now };
+    return mtime;
+}
+
 Object::sptr
 ImageCache::getImageForName(const string &name, bool isDebug) {
-    auto res = getImageIfLoaded(name);
+    std::unique_lock<std::mutex> lock(imagesLock);
+    auto res = getIfLoadedLocked(name);
     if (res != nullptr)
         return res;
-    auto item = make_shared<Object>(*this, std::make_shared<MmapReader>(name), isDebug);
-    // don't cache negative entries: assign into the cache after we've constructed:
-    // a failure to load the image will throw.
-    cache[name] = item;
+    if (isDebug) {
+        // Debug files are mostly absent, and callers probe several paths per
+        // image: remember failures, and trust each one while its directory's
+        // mtime is unchanged, so repeated scans skip the failing opens but
+        // still notice freshly installed debuginfo.
+        auto neg = negativeProbes.find(name);
+        if (neg != negativeProbes.end()) {
+            if (neg->second == debugDirMtime(dirOf(name)))
+                throw (Exception() << "no debug image " << name
+                        << " (negative cache)");
+            negativeProbes.erase(neg);
+        }
+    }
+    // for the main image, don't cache negative entries: assign into the cache
+    // after we've constructed: a failure to load the image will throw.
+    try {
+        auto item = make_shared<Object>(*this, std::make_shared<MmapReader>(name), isDebug);
+        cache[name] = { item, ++useClock };
+        enforceBudget(lock);
+        return item;
+    }
+    catch (const std::exception &ex) {
+        if (isDebug)
+            negativeProbes[name] = debugDirMtime(dirOf(name));
+        throw;
+    }
+}
+
+namespace {
+// A MemReader over bytes it owns - backs a cached vDSO with a local copy of
+// the remote image.
+class OwnedMemReader final : public MemReader {
+    std::vector<char> content;
+public:
+    OwnedMemReader(const std::string &descr, std::vector<char> content_)
+        : MemReader(descr, 0, nullptr), content(std::move(content_)) {
+        len = content.size();
+        data = content.data();
+    }
+};
+}
+
+Object::sptr
+ImageCache::getVdsoImage(const Reader &remote)
+{
+    // Copy the image out of the remote process page by page - the auxv only
+    // gives us the base address, so the caller's view is generously sized,
+    // and the copy just stops at the end of the mapping.
+    std::vector<char> content;
+    char page[4096];
+    for (Reader::Off off = 0; off < remote.size(); off += sizeof page) {
+        size_t got;
+        try {
+            got = remote.read(off, sizeof page, page);
+        }
+        catch (const std::exception &) {
+            break;
+        }
+        content.insert(content.end(), page, page + got);
+        if (got != sizeof page)
+            break;
+    }
+    auto key = stringify("(vdso ", std::hex,
+          std::hash<std::string_view>()({content.data(), content.size()}), ")");
+    std::unique_lock<std::mutex> lock(imagesLock);
+    auto res = getIfLoadedLocked(key);
+    if (res != nullptr)
+        return res;
+    auto item = make_shared<Object>(*this,
+          std::make_shared<OwnedMemReader>(key, std::move(content)));
+    cache[key] = { item, ++useClock };
+    enforceBudget(lock);
     return item;
 }
 
@@ -735,24 +1080,141 @@ ImageCache::ImageCache() : elfHits(0), elfLookups(0) {}
 ImageCache::~ImageCache() noexcept {
     if (verbose >= 2) {
         *debug << "ELF image cache: lookups: " << elfLookups << ", hits=" << elfHits << std::endl;
-        for (const auto &[name, elf] : cache) {
-            *debug << "\t" << *elf->io << std::endl;
+        for (const auto &[name, entry] : cache) {
+            *debug << "\t" << *entry.object->io << std::endl;
         }
     }
 }
 
 Object::sptr
 ImageCache::getImageIfLoaded(const string &name)
+{
+    std::lock_guard<std::mutex> lock(imagesLock);
+    return getIfLoadedLocked(name);
+}
+
+Object::sptr
+ImageCache::getIfLoadedLocked(const string &name)
 {
     elfLookups++;
     auto it = cache.find(name);
     if (it != cache.end()) {
         elfHits++;
-        return it->second;
+        it->second.lastUse = ++useClock;
+        return it->second.object;
     }
     return Object::sptr();
 }
 
+size_t
+ImageCache::usage() const
+{
+    size_t total = 0;
+    for (const auto &[name, entry] : cache)
+        total += entry.object->io->size();
+    return total;
+}
+
+void
+ImageCache::setMemoryBudget(size_t bytes)
+{
+    std::unique_lock<std::mutex> lock(imagesLock);
+    memoryBudget = bytes;
+    enforceBudget(lock);
+}
+
+// Called with imagesLock held; the lock is dropped around the virtual flush,
+// which takes it again itself.
+void
+ImageCache::enforceBudget(std::unique_lock<std::mutex> &lock)
+{
+    if (memoryBudget == 0)
+        return;
+    while (cache.size() > 1 && usage() > memoryBudget) {
+        auto victim = cache.begin();
+        for (auto it = cache.begin(); it != cache.end(); ++it)
+            if (it->second.lastUse < victim->second.lastUse)
+                victim = it;
+        if (verbose >= 2)
+            *debug << "evicting " << *victim->second.object->io
+                << " from ELF image cache to meet memory budget" << std::endl;
+        // go via the virtual flush, so derived caches (ie, the DWARF one) can
+        // drop their own references too.
+        auto o = victim->second.object;
+        lock.unlock();
+        flush(o);
+        lock.lock();
+    }
+}
+
+namespace {
+// Download debug info for a build-id via debuginfod, returning the path of
+// the local copy (the client library keeps a persistent cache under
+// $DEBUGINFOD_CACHE_PATH), or "" on failure.
+string
+debuginfodFetch(const string &buildID)
+{
+#ifdef WITH_DEBUGINFOD
+    debuginfod_client *client = debuginfod_begin();
+    if (client == nullptr)
+        return "";
+    char *path = nullptr;
+    // a zero length tells the client library the id is hex-encoded.
+    int fd = debuginfod_find_debuginfo(client,
+            reinterpret_cast<const unsigned char *>(buildID.c_str()), 0, &path);
+    debuginfod_end(client);
+    if (fd < 0)
+        return "";
+    close(fd);
+    string rv = path;
+    free(path);
+    return rv;
+#else
+    (void)buildID;
+    return "";
+#endif
+}
+}
+
+void
+ImageCache::prefetchDebugImages(const std::vector<string> &buildIDs)
+{
+#ifdef WITH_DEBUGINFOD
+    std::lock_guard<std::mutex> lock(debuginfodLock);
+    for (const auto &id : buildIDs)
+        if (debuginfodFutures.find(id) == debuginfodFutures.end())
+            debuginfodFutures[id] = std::async(std::launch::async, debuginfodFetch, id);
+#else
+    (void)buildIDs;
+#endif
+}
+
+Object::sptr
+ImageCache::getDebugImageForBuildID(const string &buildID)
+{
+    if (buildID == "")
+        return nullptr;
+    string path;
+    {
+        std::lock_guard<std::mutex> lock(debuginfodLock);
+        auto it = debuginfodFutures.find(buildID);
+        if (it != debuginfodFutures.end()) {
+            path = it->second.get();
+            debuginfodFutures.erase(it);
+        }
+    }
+    if (path == "")
+        path = debuginfodFetch(buildID);
+    if (path == "")
+        return nullptr;
+    try {
+        return getImageForName(path, true);
+    }
+    catch (const std::exception &ex) {
+        return nullptr;
+    }
+}
+
 Object::sptr
 ImageCache::getDebugImage(const string &name) {
     // XXX: verify checksum.
@@ -775,8 +1237,9 @@ ImageCache::getDebugImage(const string &name) {
 void
 ImageCache::flush(Object::sptr o)
 {
+   std::lock_guard<std::mutex> lock(imagesLock);
    for (auto it = cache.begin(); it != cache.end(); ++it) {
-      if (it->second == o) {
+      if (it->second.object == o) {
          cache.erase(it);
          return;
       }
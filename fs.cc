@@ -1,5 +1,6 @@
 #include <iostream>
 #include <fcntl.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
@@ -7,6 +8,7 @@
 #include "libpstack/global.h"
 #include "libpstack/fs.h"
 #include "libpstack/exception.h"
+#include "libpstack/stringify.h"
 
 namespace pstack {
 std::vector<std::pair<std::string,std::string>> pathReplacements;
@@ -55,6 +57,24 @@ linkResolve(std::string name)
     return name;
 }
 
+std::string
+cacheDirectory()
+{
+    std::string dir;
+    const char *cachedir = getenv("XDG_CACHE_HOME");
+    if (cachedir != nullptr) {
+        dir = stringify(cachedir, "/pstack");
+    } else {
+        const char *home = getenv("HOME");
+        if (home == nullptr)
+            return "";
+        dir = stringify(home, "/.cache/pstack");
+    }
+    mkdir(dirname(dir).c_str(), 0755); // ~/.cache may not exist yet.
+    mkdir(dir.c_str(), 0755);
+    return dir;
+}
+
 namespace {
 int
 openFileDirect(const std::string &name_, int mode, int mask)
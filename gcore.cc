@@ -0,0 +1,231 @@
+#include "libpstack/proc.h"
+#include "libpstack/global.h"
+#include "libpstack/fs.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstring>
+#include <future>
+#include <thread>
+
+namespace pstack::Procman {
+
+namespace {
+
+// Append a "CORE" note to the accumulated note segment content.
+void
+appendNote(std::vector<char> &notes, Elf::Word type, const void *data, size_t len)
+{
+    Elf::Note nhdr {};
+    nhdr.n_namesz = 5; // "CORE"
+    nhdr.n_descsz = len;
+    nhdr.n_type = type;
+    auto append = [&notes] (const void *p, size_t count) {
+        notes.insert(notes.end(), (const char *)p, (const char *)p + count);
+        notes.resize(Elf::roundup2(notes.size(), 4), 0);
+    };
+    append(&nhdr, sizeof nhdr);
+    append("CORE", 5);
+    append(data, len);
+}
+
+bool
+allZero(const char *p, size_t len)
+{
+    for (size_t i = 0; i < len; ++i)
+        if (p[i] != 0)
+            return false;
+    return true;
+}
+
+}
+
+/*
+ * Write an ELF core-style snapshot of the target to <path>. The layout is
+ * the kernel's: the ELF header, a PT_NOTE segment carrying PRPSINFO, one
+ * PRSTATUS per LWP, AUXV and an NT_FILE mapping table, then a PT_LOAD per
+ * readable mapping. Segment content is read with per-thread VmReaders on a
+ * pool of workers, and pages that read back as zeroes (or can't be read at
+ * all) are left as holes in the file, so untouched heap costs neither time
+ * nor disk. The target is stopped for the duration of the dump - the pause
+ * is bounded by how fast its memory can be read, not by the disk.
+ */
+void
+gcore(Process &p, const std::string &path)
+{
+    StopProcess here(&p);
+
+    if (p.execImage == nullptr)
+        throw (Exception() << "can't snapshot a process with no executable image");
+    const auto &ehdr = p.execImage->getHeader();
+    const size_t pagesize = sysconf(_SC_PAGESIZE);
+
+    // Build the note content first - we need its size for the layout.
+    std::vector<char> notes;
+
+    prpsinfo_t psinfo {};
+    psinfo.pr_pid = p.getPID();
+    appendNote(notes, NT_PRPSINFO, &psinfo, sizeof psinfo);
+
+    p.listLWPs([&] (lwpid_t lwp) {
+        prstatus_t status {};
+        status.pr_pid = lwp;
+        p.getRegs(lwp, NT_PRSTATUS, sizeof status.pr_reg, &status.pr_reg);
+        appendNote(notes, NT_PRSTATUS, &status, sizeof status);
+    });
+
+    auto auxv = p.getAUXV();
+    if (auxv != nullptr) {
+        char buf[8192];
+        size_t len = auxv->read(0, sizeof buf, buf);
+        if (len != 0)
+            appendNote(notes, NT_AUXV, buf, len);
+    }
+
+    auto ranges = p.addressSpace();
+
+    // NT_FILE: (count, pagesize), count * (start, end, offset-in-pages),
+    // then the NUL-terminated paths.
+    {
+        std::vector<unsigned long> ents;
+        std::string names;
+        for (const auto &range : ranges) {
+            if (range.backing.path == "" || range.backing.path[0] == '[')
+                continue;
+            ents.push_back(range.start);
+            ents.push_back(range.end);
+            ents.push_back(range.offset / pagesize);
+            names += range.backing.path;
+            names += '\0';
+        }
+        std::vector<char> content;
+        unsigned long header[2] = { ents.size() / 3, pagesize };
+        content.insert(content.end(), (char *)header, (char *)(header + 2));
+        content.insert(content.end(), (char *)ents.data(), (char *)(ents.data() + ents.size()));
+        content.insert(content.end(), names.begin(), names.end());
+        appendNote(notes, NT_FILE, content.data(), content.size());
+    }
+
+    // Lay out the image: header, program headers, notes, then page-aligned
+    // segment data in address order.
+    std::vector<Elf::Phdr> phdrs;
+    phdrs.push_back({}); // PT_NOTE, fixed up below.
+
+    Elf::Off off = sizeof (Elf::Ehdr);
+    for (const auto &range : ranges) {
+        if (range.permissions.find(AddressRange::Flags::read) == range.permissions.end())
+            continue;
+        Elf::Phdr ph {};
+        ph.p_type = PT_LOAD;
+        ph.p_vaddr = range.start;
+        ph.p_memsz = ph.p_filesz = range.end - range.start;
+        ph.p_align = pagesize;
+        ph.p_flags = PF_R
+            | (range.permissions.find(AddressRange::Flags::write) != range.permissions.end() ? PF_W : 0)
+            | (range.permissions.find(AddressRange::Flags::exec) != range.permissions.end() ? PF_X : 0);
+        phdrs.push_back(ph);
+    }
+    off += phdrs.size() * sizeof (Elf::Phdr);
+    phdrs[0].p_type = PT_NOTE;
+    phdrs[0].p_offset = off;
+    phdrs[0].p_filesz = notes.size();
+    off = Elf::roundup2(off + notes.size(), pagesize);
+    for (auto &ph : phdrs) {
+        if (ph.p_type != PT_LOAD)
+            continue;
+        ph.p_offset = off;
+        off += ph.p_filesz;
+    }
+
+    Elf::Ehdr hdr {};
+    memcpy(&hdr, &ehdr, sizeof hdr.e_ident); // class/data/ABI from the target.
+    hdr.e_type = ET_CORE;
+    hdr.e_machine = ehdr.e_machine;
+    hdr.e_version = EV_CURRENT;
+    hdr.e_phoff = sizeof hdr;
+    hdr.e_ehsize = sizeof hdr;
+    hdr.e_phentsize = sizeof (Elf::Phdr);
+    hdr.e_phnum = phdrs.size();
+
+    int fd = openfile(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (ftruncate(fd, off) != 0 ||
+          pwrite(fd, &hdr, sizeof hdr, 0) != ssize_t(sizeof hdr) ||
+          pwrite(fd, phdrs.data(), phdrs.size() * sizeof (Elf::Phdr), hdr.e_phoff)
+                != ssize_t(phdrs.size() * sizeof (Elf::Phdr)) ||
+          pwrite(fd, notes.data(), notes.size(), phdrs[0].p_offset)
+                != ssize_t(notes.size())) {
+        int err = errno;
+        close(fd);
+        throw (Exception() << "failed to write core header to " << path
+              << ": " << strerror(err));
+    }
+
+    // Dump the segments on a pool of workers, each with its own reader so
+    // they don't serialize on a shared cache. Zero and unreadable pages are
+    // skipped, leaving holes.
+    bool live = dynamic_cast<LiveProcess *>(&p) != nullptr;
+    std::atomic<size_t> nextSegment { 1 };
+    std::atomic<size_t> bytesWritten { 0 };
+    auto worker = [&] {
+        std::unique_ptr<VmReader> vm;
+        if (live)
+            vm = std::make_unique<VmReader>(p.getPID());
+        const Reader &io = vm ? (const Reader &)*vm : *p.io;
+        constexpr size_t chunksize = 1024 * 1024;
+        std::vector<char> buf(chunksize);
+        for (;;) {
+            size_t i = nextSegment++;
+            if (i >= phdrs.size())
+                return;
+            const auto &ph = phdrs[i];
+            for (Elf::Off seg = 0; seg < ph.p_filesz; seg += chunksize) {
+                size_t want = std::min(chunksize, size_t(ph.p_filesz - seg));
+                size_t got;
+                try {
+                    got = io.read(ph.p_vaddr + seg, want, buf.data());
+                }
+                catch (const std::exception &) {
+                    got = 0; // unreadable: leave a hole.
+                }
+                // write page-by-page, skipping runs of zeroes.
+                for (size_t pg = 0; pg < got; pg += pagesize) {
+                    size_t len = std::min(pagesize, got - pg);
+                    if (allZero(buf.data() + pg, len))
+                        continue;
+                    if (pwrite(fd, buf.data() + pg, len,
+                             ph.p_offset + seg + pg) != ssize_t(len))
+                        throw (Exception() << "write to " << path
+                              << " failed: " << strerror(errno));
+                    bytesWritten += len;
+                }
+                if (got != want)
+                    break; // rest of the segment is a hole.
+            }
+        }
+    };
+    auto nthreads = std::max(1U, std::min(std::thread::hardware_concurrency(),
+             unsigned(phdrs.size() - 1)));
+    std::vector<std::future<void>> workers;
+    workers.reserve(nthreads);
+    for (size_t i = 0; i < nthreads; ++i)
+        workers.push_back(std::async(std::launch::async, worker));
+    std::string error;
+    for (auto &w : workers) {
+        try {
+            w.get();
+        }
+        catch (const std::exception &ex) {
+            error = ex.what();
+        }
+    }
+    close(fd);
+    if (error != "")
+        throw (Exception() << "core dump to " << path << " failed: " << error);
+    if (verbose > 0)
+        *debug << "wrote " << bytesWritten << " bytes (of " << off
+           << " addressed) to " << path << "\n";
+}
+
+}
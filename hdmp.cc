@@ -4,8 +4,14 @@
 #include "libpstack/proc.h"
 #include "heap.h"
 #include <unistd.h>
-#include <set>
+#include <atomic>
 #include <cassert>
+#include <future>
+#include <map>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <vector>
 
 using namespace pstack;
 
@@ -15,60 +21,163 @@ enum printoption {
 
 std::set<printoption> options;
 
-void printStack(std::ostream &os, Dwarf::ImageCache &ic, std::shared_ptr<Procman::Process> &proc, const hdbg_info &info, void **frames) {
-   for (size_t i = 0; i < info.maxframes && frames[i] != nullptr; ++i) {
-      uintptr_t frameip = uintptr_t(frames[i]);
-      if (i != 0)
-         frameip--;
-
-      // find the segment containing the instruction pointer.
-      auto &&[elfReloc, elf, phdr] = proc->findSegment(frameip);
-
-      os << "\t" << frames[i];
-      if (elf) {
-         auto found = elf->findSymbolByAddress(frameip - elfReloc, STT_FUNC);
-         if (found) {
-            auto &[ sym, name ] = *found;
-            os << "\t" << name << "+" << uintptr_t(frames[i]) - elfReloc - sym.st_value;
-         }
+// Symbolizes instruction pointers, memoized: a heap with millions of live
+// allocations shares a much smaller set of distinct call sites, so each
+// unique PC is resolved exactly once, and the unique PCs are split over a
+// pool of workers before anything is printed.
+class Symbolizer {
+   std::map<uintptr_t, std::string> cache_;
+   // return addresses point after the call; step back one byte to land in
+   // it, except for the faulting/leaf frame.
+   static uintptr_t adjust(size_t i, void *frame) {
+      return i != 0 ? uintptr_t(frame) - 1 : uintptr_t(frame);
+   }
+public:
+   void note(const hdbg_info &info, void *const *frames) {
+      for (size_t i = 0; i < info.maxframes && frames[i] != nullptr; ++i)
+         cache_.emplace(adjust(i, frames[i]), "");
+   }
+   void resolve(Dwarf::ImageCache &ic, Procman::Process &proc);
+   const std::string &describe(size_t i, void *frame) const {
+      return cache_.at(adjust(i, frame));
+   }
+};
 
-         auto dwarf = ic.getDwarf(elf);
-         if (dwarf) {
-            auto sep = "in";
-            for (auto &&[file, line] : dwarf->sourceFromAddr(frameip - elfReloc)) {
-               os << " " << sep << " " << file << ":" << line;
-               sep = ",";
+void
+Symbolizer::resolve(Dwarf::ImageCache &ic, Procman::Process &proc) {
+   struct Job {
+      std::pair<const uintptr_t, std::string> *ent;
+      Dwarf::Info::sptr dwarf;
+      Elf::Off offset;
+   };
+   std::vector<Job> todo;
+   todo.reserve(cache_.size());
+   for (auto &ent : cache_)
+      todo.push_back({&ent, nullptr, 0});
+   std::atomic<size_t> next { 0 };
+   auto worker = [&]() {
+      for (;;) {
+         size_t i = next++;
+         if (i >= todo.size())
+            return;
+         uintptr_t frameip = todo[i].ent->first;
+         std::ostringstream os;
+         // find the segment containing the instruction pointer.
+         auto &&[elfReloc, elf, phdr] = proc.findSegment(frameip);
+         if (elf) {
+            auto found = elf->findSymbolByAddress(frameip - elfReloc, STT_FUNC);
+            if (found) {
+               auto &[ sym, name ] = *found;
+               os << "\t" << name << "+" << frameip - elfReloc - sym.st_value;
             }
+            todo[i].dwarf = ic.getDwarf(elf);
+            todo[i].offset = frameip - elfReloc;
          }
+         todo[i].ent->second = os.str();
+      }
+   };
+   size_t nthreads = std::min<size_t>(std::thread::hardware_concurrency(), todo.size());
+   if (nthreads > 1) {
+      std::vector<std::future<void>> workers;
+      workers.reserve(nthreads);
+      for (size_t i = 0; i < nthreads; ++i)
+         workers.push_back(std::async(std::launch::async, worker));
+      for (auto &w : workers)
+         w.get();
+   } else {
+      worker();
+   }
 
+   // Source lookups batch naturally per image: all the offsets for one
+   // image resolve in a single sorted pass over its units, building each
+   // needed line table exactly once.
+   std::map<Dwarf::Info *, std::vector<uintmax_t>> byImage;
+   for (auto &job : todo)
+      if (job.dwarf)
+         byImage[job.dwarf.get()].push_back(job.offset);
+   std::map<Dwarf::Info *, std::map<uintmax_t, std::vector<std::pair<std::string, int>>>> sources;
+   for (auto &[dwarf, offsets] : byImage)
+      sources[dwarf] = dwarf->sourceFromAddrs(std::move(offsets));
+   for (auto &job : todo) {
+      if (!job.dwarf)
+         continue;
+      std::ostringstream os;
+      auto sep = "in";
+      for (auto &&[file, line] : sources[job.dwarf.get()][job.offset]) {
+         os << " " << sep << " " << file << ":" << line;
+         sep = ",";
       }
-      os << "\n";
+      job.ent->second += os.str();
    }
-   os << "\n";
 }
 
-void printBlocks(std::ostream &os, Dwarf::ImageCache &ic, std::shared_ptr<Procman::Process> proc, const hdbg_info &info, const memdesc_list &list, enum memstate state) {
+void printStack(std::ostream &os, const Symbolizer &syms, const hdbg_info &info, void *const *frames) {
+   for (size_t i = 0; i < info.maxframes && frames[i] != nullptr; ++i)
+      os << "\t" << frames[i] << syms.describe(i, frames[i]) << "\n";
+   os << "\n";
+}
 
-   size_t sz = sizeof (struct memdesc) + info.maxframes * sizeof (void *);
-   struct memdesc *hdr = (memdesc *)malloc(sz);
+// A descriptor list pulled out of the target: the descriptors land in one
+// flat local arena, strided by the in-core descriptor size, with each
+// block's guard states read alongside, so the expensive symbolization can
+// work from local memory.
+struct Blocks {
+   size_t stride;
+   std::vector<char> arena;
+   std::vector<std::pair<memstate, memstate>> states;
+   size_t count() const { return states.size(); }
+   const memdesc *desc(size_t i) const {
+      return (const memdesc *)(arena.data() + i * stride);
+   }
+};
 
-   for (Elf::Addr addr = (Elf::Addr)list.tqh_first; addr; addr = (Elf::Addr)hdr->node.tqe_next) {
-      if (proc->io->read((uintptr_t)addr, sz, (char *)hdr) != sz)
+void readBlocks(Procman::Process &proc, const hdbg_info &info, const memdesc_list &list, Blocks &blocks) {
+   blocks.stride = sizeof (struct memdesc) + info.maxframes * sizeof (void *);
+   size_t first = blocks.states.size(); // may be appending to an earlier shard's blocks.
+   for (Elf::Addr addr = (Elf::Addr)list.tqh_first; addr;) {
+      size_t off = blocks.arena.size();
+      blocks.arena.resize(off + blocks.stride);
+      auto hdr = (struct memdesc *)(blocks.arena.data() + off);
+      if (proc.io->read(addr, blocks.stride, (char *)hdr) != blocks.stride) {
+         blocks.arena.resize(off);
          break;
+      }
+      addr = (Elf::Addr)hdr->node.tqe_next;
+   }
+   // The chain walk above is serial - each descriptor names the next - but
+   // the guard states around the blocks aren't: gather them all with one
+   // vectored read rather than two round trips per block. The target stays
+   // stopped while we stream this, so fewer syscalls means a shorter pause,
+   // especially for a live process. A state that can't be read stays zero,
+   // which shows up as a guard mismatch rather than aborting the dump.
+   size_t count = blocks.arena.size() / blocks.stride;
+   blocks.states.resize(count);
+   std::vector<Reader::ReadRange> ranges;
+   ranges.reserve((count - first) * 2);
+   for (size_t i = first; i < count; ++i) {
+      auto hdr = blocks.desc(i);
+      ranges.push_back({ Reader::Off((Elf::Addr)&hdr->data->state),
+            sizeof (memstate), (char *)&blocks.states[i].first });
+      ranges.push_back({ Reader::Off((Elf::Addr)(hdr->data + 1) + hdr->len),
+            sizeof (memstate), (char *)&blocks.states[i].second });
+   }
+   proc.io->readv(ranges);
+}
+
+void printBlocks(std::ostream &os, const Symbolizer &syms, const hdbg_info &info, const Blocks &blocks, enum memstate state) {
+   for (size_t i = 0; i < blocks.count(); ++i) {
+      auto hdr = blocks.desc(i);
       os << "ptr=" << hdr->data + 1;
-      memstate head = proc->io->readObj<memstate>((Elf::Addr)&hdr->data->state);
-      memstate tail = proc->io->readObj<memstate>((Elf::Addr)(hdr->data + 1) + hdr->len);
+      auto &&[head, tail] = blocks.states[i];
       if (head != state) {
-         std::cout << " BADHEAD";
+         os << " BADHEAD";
       }
       if (tail != state) {
-         std::cout << " BADTAIL";
+         os << " BADTAIL";
       }
       os << " size=" << hdr->len << "\n";
-      printStack(os, ic, proc, info, hdr->stack);
-
+      printStack(os, syms, info, hdr->stack);
    }
-   free(hdr);
 }
 
 void dumpHeap(std::shared_ptr<Procman::Process> proc, std::ostream &os, Dwarf::ImageCache &ic)
@@ -86,20 +195,60 @@ void dumpHeap(std::shared_ptr<Procman::Process> proc, std::ostream &os, Dwarf::I
    << "Calls to realloc:              " << info.stats.realloc_calls << "\n"
    << "Calls to aligned_alloc et al:  " << info.stats.aligned_alloc_calls << "\n"
    ;
-
-   os << "\nStack at termination:\n\n";
-   printStack(os, ic, proc, info, info.crashstack);
-   if (options.find(heap_allocated) != options.end()) {
-      os << "\nCurrently allocated memory:\n\n";
-      printBlocks(os, ic, proc, info, info.heap, mem_allocated);
+   if (info.stats.sample != 0) {
+      auto recorded = info.stats.sampled_calls;
+      auto skipped = info.stats.skipped_calls;
+      os << "\nSampling one allocation per ~" << info.stats.sample
+         << " bytes: stacks recorded for " << recorded << " of "
+         << recorded + skipped << " allocations";
+      if (recorded != 0)
+         os << "; scale block counts by ~"
+            << double(recorded + skipped) / recorded;
+      os << "\n";
    }
-   if (options.find(heap_recentfree) != options.end()) {
-      os << "\nRecently freed memory:\n\n";
-      printBlocks(os, ic, proc, info, info.freelist, mem_free);
+
+   // Pull all the requested lists local, gather the distinct PCs from
+   // every recorded stack, and symbolize those before printing anything.
+   // Live and recently-freed blocks are sharded per allocating thread;
+   // walk every shard and merge.
+   struct Section {
+      const char *title;
+      enum memstate state;
+      Blocks blocks;
+   };
+   std::vector<Section> sections;
+   bool wantAllocated = options.find(heap_allocated) != options.end();
+   bool wantFree = options.find(heap_recentfree) != options.end();
+   if (wantAllocated)
+      sections.push_back({ "Currently allocated memory", mem_allocated, {} });
+   if (wantFree)
+      sections.push_back({ "Recently freed memory", mem_free, {} });
+   for (Elf::Addr shardAddr = (Elf::Addr)info.shards; shardAddr;) {
+      auto shard = proc->io->readObj<hdbg_shard>(shardAddr);
+      size_t section = 0;
+      if (wantAllocated)
+         readBlocks(*proc, info, shard.heap, sections[section++].blocks);
+      if (wantFree)
+         readBlocks(*proc, info, shard.freelist, sections[section].blocks);
+      shardAddr = (Elf::Addr)shard.next;
    }
    if (options.find(heap_historicbig) != options.end()) {
-      os << "\nHistoric large allocations:\n\n";
-      printBlocks(os, ic, proc, info, info.freebig, mem_free);
+      sections.push_back({ "Historic large allocations", mem_free, {} });
+      readBlocks(*proc, info, info.freebig, sections.back().blocks);
+   }
+
+   Symbolizer syms;
+   syms.note(info, info.crashstack);
+   for (auto &section : sections)
+      for (size_t i = 0; i < section.blocks.count(); ++i)
+         syms.note(info, section.blocks.desc(i)->stack);
+   syms.resolve(ic, *proc);
+
+   os << "\nStack at termination:\n\n";
+   printStack(os, syms, info, info.crashstack);
+   for (auto &section : sections) {
+      os << "\n" << section.title << ":\n\n";
+      printBlocks(os, syms, info, section.blocks, section.state);
    }
 }
 
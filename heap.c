@@ -46,9 +46,41 @@ static void buffer_free(void *unused) {
 struct hdbg_info hdbg; // not static - "hdmp" finds this symbol.
 
 static int startup = 2;
-static pthread_mutex_t heap_lock;
+static pthread_mutex_t heap_lock; // guards the shard registry and crash paths.
 static pthread_mutex_t descriptors_lock;
 
+// Per-thread state: the thread's shard, and a local pool of descriptors
+// refilled from (and published back to) the global list in batches, so
+// descriptor recycling doesn't serialize threads on every call.
+#define DESC_BATCH 32
+static __thread struct hdbg_shard *my_shard;
+static __thread struct memdesc_list my_descriptors;
+static __thread int my_ndescriptors;
+
+// sampling state: bytes of credit left until the next recorded
+// allocation, and a thread-local generator for drawing intervals.
+static __thread size_t sample_credit;
+static __thread unsigned long sample_rng;
+
+// Decide whether this allocation's stack gets recorded. Each byte spends
+// a byte of credit, making the chance an allocation is sampled
+// proportional to its size; the next interval is drawn uniformly around
+// the configured period, so threads don't sample in lockstep and
+// periodic allocation patterns can't hide between samples.
+static int sample_this(size_t size) {
+    if (hdbg.stats.sample == 0)
+        return 1;
+    if (sample_credit > size) {
+        sample_credit -= size;
+        return 0;
+    }
+    if (sample_rng == 0)
+        sample_rng = (unsigned long)pthread_self() | 1;
+    sample_rng = sample_rng * 6364136223846793005UL + 1442695040888963407UL;
+    sample_credit = (sample_rng >> 33) % (2 * hdbg.stats.sample) + 1;
+    return 1;
+}
+
 static malloc_t real_malloc = buffer_malloc;
 static free_t real_free = buffer_free;
 static calloc_t real_calloc = buffer_calloc;
@@ -108,38 +140,83 @@ set_state(struct memdesc *desc, enum memstate state)
     desc->data->state = state;
 }
 
+// the calling thread's shard, created (and registered for hdmp) on its
+// first allocation. Also readies the thread's descriptor pool.
+static struct hdbg_shard *shard(void) {
+    struct hdbg_shard *s = my_shard;
+    if (s == NULL) {
+        s = real_malloc(sizeof *s);
+        TAILQ_INIT(&s->heap);
+        TAILQ_INIT(&s->freelist);
+        s->freelistsize = 0;
+        pthread_mutex_init(&s->lock, 0);
+        TAILQ_INIT(&my_descriptors);
+        LOCK(&heap_lock);
+        s->next = hdbg.shards;
+        hdbg.shards = s;
+        UNLOCK(&heap_lock);
+        my_shard = s;
+    }
+    return s;
+}
+
 // prepare a new allocation - guard each side with the magic for an allocated
 // block, and create a descriptor for the allocation to hold its stack trace.
 static inline void build_alloc(void *base, struct guard *guard, size_t size) {
     struct memdesc *desc;
-    LOCK(&descriptors_lock);
-    if (TAILQ_EMPTY(&hdbg.descriptors)) {
+    struct hdbg_shard *s = shard();
+    guard->base = base;
+    guard->len = size;
+
+    size_t total = __atomic_add_fetch(&hdbg.stats.alloc_total, size, __ATOMIC_RELAXED);
+    if (total > hdbg.stats.maxmem) {
+        // racy high-water mark - it's diagnostic, and close enough.
+        hdbg.stats.maxmem = total;
+        if (hdbg.alloc_limit && total > hdbg.alloc_limit)
+           die("exceeded set memory limit");
+    }
+
+    if (!sample_this(size)) {
+        // No descriptor, no stack: just a head marker so free() can still
+        // validate the block. There's nothing to find the tail with.
+        guard->desc = 0;
+        guard->state = mem_allocated;
+        hdbg.stats.skipped_calls++;
+        fill(guard + 1, size, 0xbaadf00d);
+        return;
+    }
+    hdbg.stats.sampled_calls++;
+
+    if (TAILQ_EMPTY(&my_descriptors)) {
+        LOCK(&descriptors_lock);
+        for (int i = 0; i < DESC_BATCH && !TAILQ_EMPTY(&hdbg.descriptors); ++i) {
+            desc = TAILQ_FIRST(&hdbg.descriptors);
+            TAILQ_REMOVE(&hdbg.descriptors, desc, node);
+            TAILQ_INSERT_HEAD(&my_descriptors, desc, node);
+            my_ndescriptors++;
+        }
         UNLOCK(&descriptors_lock);
+    }
+    if (TAILQ_EMPTY(&my_descriptors)) {
         desc = real_malloc(sizeof (struct memdesc) +
               sizeof (void *) * (hdbg.maxframes - 1));
     } else {
-        desc = TAILQ_FIRST(&hdbg.descriptors);
-        TAILQ_REMOVE(&hdbg.descriptors, desc, node);
-        UNLOCK(&descriptors_lock);
+        desc = TAILQ_FIRST(&my_descriptors);
+        TAILQ_REMOVE(&my_descriptors, desc, node);
+        my_ndescriptors--;
     }
     guard->desc = desc;
     desc->data = guard;
     desc->len = size;
     desc->base = base;
+    desc->shard = s;
     set_state(desc, mem_allocated);
     getstacktrace(desc->stack, hdbg.maxframes);
 
-    LOCK(&heap_lock);
-    desc->serial = hdbg.serial++;
-    hdbg.stats.alloc_total += size;
-    if (hdbg.stats.alloc_total > hdbg.stats.maxmem) {
-        hdbg.stats.maxmem = hdbg.stats.alloc_total;
-        if (hdbg.alloc_limit && hdbg.stats.alloc_total > hdbg.alloc_limit)
-           die("exceeded set memory limit");
-        hdbg.stats.maxmem = hdbg.stats.alloc_total;
-    }
-    TAILQ_INSERT_HEAD(&hdbg.heap, desc, node);
-    UNLOCK(&heap_lock);
+    desc->serial = __atomic_fetch_add(&hdbg.serial, 1, __ATOMIC_RELAXED);
+    LOCK(&s->lock);
+    TAILQ_INSERT_HEAD(&s->heap, desc, node);
+    UNLOCK(&s->lock);
     fill(guard + 1, size, 0xbaadf00d);
 }
 
@@ -149,14 +226,27 @@ static inline void build_alloc(void *base, struct guard *guard, size_t size) {
 // them.
 static void free_desc(struct memdesc *desc) {
     sanity_freenode(desc);
-    LOCK(&descriptors_lock);
     if (desc->len >= hdbg.rememberbigger && hdbg.numbig < hdbg.maxbig) {
+       LOCK(&descriptors_lock);
        TAILQ_INSERT_TAIL(&hdbg.freebig, desc, node);
        hdbg.numbig++;
-    } else {
-       TAILQ_INSERT_TAIL(&hdbg.descriptors, desc, node);
+       UNLOCK(&descriptors_lock);
+       return;
+    }
+    // recycle through the thread's pool, publishing a batch back to the
+    // global list when we accumulate more than we'll plausibly reuse.
+    shard();
+    TAILQ_INSERT_HEAD(&my_descriptors, desc, node);
+    if (++my_ndescriptors >= DESC_BATCH * 2) {
+        LOCK(&descriptors_lock);
+        while (my_ndescriptors > DESC_BATCH) {
+            desc = TAILQ_FIRST(&my_descriptors);
+            TAILQ_REMOVE(&my_descriptors, desc, node);
+            TAILQ_INSERT_TAIL(&hdbg.descriptors, desc, node);
+            my_ndescriptors--;
+        }
+        UNLOCK(&descriptors_lock);
     }
-    UNLOCK(&descriptors_lock);
 }
 
 // Read the state markers at the start and end of a block, and assert they are
@@ -247,6 +337,7 @@ static bool use_hdmp() {
         static const char hdmp_fill[] = "HDMP_FILL=";
         static const char hdmp_maxmem[] = "HDMP_MAXMEM=";
         static const char hdmp_level[] = "HDMP_LEVEL=";
+        static const char hdmp_sample[] = "HDMP_SAMPLE=";
 #define INTSET(var, setting) \
         else if (strncmp(*pp, var, sizeof var - 1) == 0) \
             setting = atoi((*pp) + sizeof var - 1)
@@ -258,11 +349,11 @@ static bool use_hdmp() {
        INTSET(hdmp_big_max, hdbg.maxbig);
        INTSET(hdmp_maxmem, hdbg.alloc_limit);
        INTSET(hdmp_level, hdbg.level);
+       INTSET(hdmp_sample, hdbg.stats.sample);
     }
 
     // Initialize internal state.
-    TAILQ_INIT(&hdbg.heap);
-    TAILQ_INIT(&hdbg.freelist);
+    hdbg.shards = 0;
     TAILQ_INIT(&hdbg.descriptors);
     TAILQ_INIT(&hdbg.freebig);
     pthread_mutex_init(&descriptors_lock, 0);
@@ -303,6 +394,9 @@ __attribute__((constructor)) static void init() {
         (int)hdbg.maxbig,
         (intmax_t)hdbg.rememberbigger,
         malloc_total);
+    if (hdbg.stats.sample)
+        fprintf(stderr, "sampling roughly one allocation per %jd bytes\n",
+            (intmax_t)hdbg.stats.sample);
 }
 
 // On exit, grab a backtrace into the crash buffer, and ensure we dump core.
@@ -318,16 +412,20 @@ static void assertheap() {
     if (!hdbg.level || startup)
         return;
 
-    LOCK(&heap_lock);
+    LOCK(&heap_lock); // freezes the shard list.
     struct memdesc *desc;
-    TAILQ_FOREACH(desc, &hdbg.heap, node)
-        if (get_state(desc) != mem_allocated)
-            die("allocated memory isn't");
-    int count = 0;
-    TAILQ_FOREACH(desc, &hdbg.freelist, node) {
-        sanity_freenode(desc);
-        if (count++ > 64)
-            break;
+    for (struct hdbg_shard *s = hdbg.shards; s; s = s->next) {
+        LOCK(&s->lock);
+        TAILQ_FOREACH(desc, &s->heap, node)
+            if (get_state(desc) != mem_allocated)
+                die("allocated memory isn't");
+        int count = 0;
+        TAILQ_FOREACH(desc, &s->freelist, node) {
+            sanity_freenode(desc);
+            if (count++ > 64)
+                break;
+        }
+        UNLOCK(&s->lock);
     }
     UNLOCK(&heap_lock);
 }
@@ -456,34 +554,53 @@ void free(void *p) {
     struct guard *guard = (struct guard *)p - 1;
     struct memdesc *desc = guard->desc;
 
+    if (desc == 0) {
+        // sampling skipped this block: validate the head marker and
+        // release it directly - it was never on any list.
+        if (guard->state != mem_allocated)
+            die("free() passed non-allocated memory");
+        guard->state = mem_free;
+        hdbg.stats.free_calls++;
+        __atomic_sub_fetch(&hdbg.stats.alloc_total, guard->len, __ATOMIC_RELAXED);
+        void *base = guard->base;
+        if (!headroom(base))
+            real_free(base);
+        return;
+    }
+
     if (get_state(desc) != mem_allocated)
         die("free() passed non-allocated memory");
     if (desc->data != guard)
         die("internal integrity error");
 
     getstacktrace(desc->stack, hdbg.maxframes);
-    fill(desc->data + 1, desc->len, 0xdeaddead);
-    set_state(desc, mem_free);
-
-    LOCK(&heap_lock);
 
     hdbg.stats.free_calls++;
-    hdbg.stats.alloc_total -= desc->len;
-    TAILQ_REMOVE(&hdbg.heap, desc, node);
+    __atomic_sub_fetch(&hdbg.stats.alloc_total, desc->len, __ATOMIC_RELAXED);
+
+    // the block lives on the shard of the thread that allocated it; lock
+    // that shard - almost always our own, and uncontended either way. The
+    // state flip happens under the lock, so assertheap never catches a
+    // free-marked block still sitting on a heap list.
+    struct hdbg_shard *s = desc->shard;
+    LOCK(&s->lock);
+    TAILQ_REMOVE(&s->heap, desc, node);
+    fill(desc->data + 1, desc->len, 0xdeaddead);
+    set_state(desc, mem_free);
 
-    TAILQ_INSERT_HEAD(&hdbg.freelist, desc, node);
+    TAILQ_INSERT_HEAD(&s->freelist, desc, node);
     // put this block on the freelist, and extract the oldest block if the list
     // is too big. We will actually free the oldest one now, so we have
     // maintained some hysteresis between the application calling free() and
     // actually freeing the memory.
-    if (hdbg.freelistsize == hdbg.freelistmax) {
-        desc = TAILQ_LAST(&hdbg.freelist, memdesc_list);
-        TAILQ_REMOVE(&hdbg.freelist, desc, node);
+    if (s->freelistsize == hdbg.freelistmax) {
+        desc = TAILQ_LAST(&s->freelist, memdesc_list);
+        TAILQ_REMOVE(&s->freelist, desc, node);
     } else {
-        hdbg.freelistsize++;
+        s->freelistsize++;
         desc = 0;
     }
-    UNLOCK(&heap_lock);
+    UNLOCK(&s->lock);
 
     if (desc) {
         void *p = desc->base;
@@ -494,20 +611,21 @@ void free(void *p) {
 }
 
 void *realloc(void *p, size_t size) {
-    struct memdesc *olddesc;
+    size_t oldlen = 0;
     struct guard *guard;
     if (!use_hdmp())
         return real_realloc(p, size);
     hdbg.stats.realloc_calls++;
     if (p) {
+        // the guard knows the length whether or not the block was sampled.
         guard = (struct guard *)p - 1;
-        olddesc = guard->desc;
-        if (olddesc->len >= size)
+        oldlen = guard->len;
+        if (oldlen >= size)
             return p;
     }
     char *p2 = malloc(size);
     if (p2 && p) {
-        memcpy(p2, p, olddesc->len < size ? olddesc->len : size);
+        memcpy(p2, p, oldlen < size ? oldlen : size);
         free(p);
     }
     return p2;
@@ -4,6 +4,7 @@
 #define heap_h_guard
 #include <sys/queue.h>
 #include <stdlib.h>
+#include <pthread.h>
 
 enum memstate {
     mem_ignore = 0,
@@ -25,7 +26,9 @@ typedef TAILQ_ENTRY(memdesc) memdesc_node;
  */
 
 struct guard {
-    struct memdesc *desc;
+    struct memdesc *desc; /* NULL if sampling skipped this allocation */
+    void *base; /* underlying allocation, as passed to the real free() */
+    size_t len; /* user-requested length */
     enum memstate state;
 };
 
@@ -38,9 +41,25 @@ struct memdesc {
     size_t len; /* User-requested length of allocated block. */
     struct guard *data; /* Points to data for this descriptor */
     void *base;
+    struct hdbg_shard *shard; /* shard holding this block - free() locks it */
     void * stack[1]; // array of instruction pointers.
 };
 
+/*
+ * Per-thread view of the heap. Each thread links its live and recently
+ * free'd blocks on its own shard, so allocation-heavy threads contend on
+ * their own lock rather than a global one. Shards are created on a
+ * thread's first allocation and never removed; hdmp walks them all from
+ * hdbg.shards.
+ */
+struct hdbg_shard {
+    struct memdesc_list heap; /* Active memory allocated by this thread */
+    struct memdesc_list freelist; /* Recently free'd blocks, not yet released */
+    int freelistsize;
+    pthread_mutex_t lock; /* mostly taken by the owner; others lock it to free our blocks */
+    struct hdbg_shard *next; /* all shards, for hdmp */
+};
+
 struct stats {
     size_t alloc_total;
     size_t maxmem;
@@ -49,17 +68,21 @@ struct stats {
     unsigned calloc_calls;
     unsigned realloc_calls;
     unsigned aligned_alloc_calls;
+    /* sampling: when sample != 0, stacks are recorded for roughly one
+     * allocation per that many bytes; hdmp scales counts back up from the
+     * recorded/skipped split below. */
+    size_t sample;
+    size_t sampled_calls;
+    size_t skipped_calls;
 };
 
 /* This is the structure the post-processing tool grovels for. */
 #define CRASHFRAMES 512
 struct hdbg_info {
-    struct memdesc_list heap; /* Active memory */
-    struct memdesc_list freelist; /* Free memory */
+    struct hdbg_shard *shards; /* per-thread heap and freelist shards */
     struct memdesc_list descriptors; /* Free memdescs */
     struct memdesc_list freebig; /* memdescs for big blocks that were free'd */
     int freelistmax;
-    int freelistsize;
     struct stats stats;
     int level;
     unsigned long serial;
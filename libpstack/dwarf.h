@@ -2,11 +2,17 @@
 #define DWARF_H
 
 #include "libpstack/elf.h"
+#include <array>
 #include <list>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <iterator>
 
@@ -144,6 +150,37 @@ struct PubnameUnit {
     explicit PubnameUnit(DWARFReader &r);
 };
 
+/*
+ * DWARF 5 ".debug_names" accelerator table. Maps a name to the DIEs it
+ * denotes via the section's built-in hash table; modern toolchains emit this
+ * in place of .debug_pubnames. We only consume the first name index in the
+ * section.
+ */
+class DebugNames {
+    struct IdxAttr { unsigned idx; Form form; };
+    struct IdxAbbrev { Tag tag; std::vector<IdxAttr> attrs; };
+    Reader::csptr strings; // .debug_str
+    Reader::csptr io; // .debug_names
+    std::unordered_map<size_t, IdxAbbrev> abbrevs;
+    size_t dwarfLen = 4;
+    uint32_t cuCount = 0;
+    uint32_t bucketCount = 0;
+    uint32_t nameCount = 0;
+    // section offsets of the tables following the header.
+    Elf::Off cuTable = 0;
+    Elf::Off buckets = 0;
+    Elf::Off hashes = 0;
+    Elf::Off stringOffsets = 0;
+    Elf::Off entryOffsets = 0;
+    Elf::Off entryPool = 0;
+    bool valid = false;
+public:
+    explicit DebugNames(const Info &);
+    explicit operator bool() const { return valid; }
+    // debug_info-relative offsets of the DIEs known by "name".
+    std::vector<Elf::Off> lookup(const std::string &name) const;
+};
+
 // Data stored in a BLOCK form attribute.
 struct Block {
    Elf::Off offset;
@@ -158,6 +195,9 @@ enum class ContainsAddr { YES, NO, UNKNOWN };
 class Ranges : public std::vector<std::pair<uintmax_t, uintmax_t>> {
    public:
       Ranges(const DIE &, uintmax_t base);
+      // Is addr covered by any of the ranges? (they are sorted by start
+      // address at construction, so this is a binary search)
+      [[nodiscard]] bool contains(uintmax_t addr) const;
 };
 
 // An abstract "DIE" -
@@ -259,7 +299,7 @@ public:
     // Get the named attribute from thie DIE.
     [[nodiscard]] Attribute attribute(AttrName name, bool local = false) const;
 
-    [[nodiscard]] std::string name() const;
+    [[nodiscard]] std::string_view name() const;
     [[nodiscard]] Attributes attributes() const { return Attributes(*this); }
 
     // Get the DIE's type tag.
@@ -329,7 +369,7 @@ public:
 class LineState {
 public:
     LineState() = delete;
-    FileEntry *file;
+    const FileEntry *file;
     uintmax_t addr;
     unsigned line;
     unsigned column;
@@ -340,10 +380,45 @@ public:
     bool epilogue_begin:1;
     unsigned isa;
     unsigned discriminator;
-    explicit LineState(LineInfo *);
+    explicit LineState(const LineInfo *);
+};
+
+// One retained row of the line number matrix - just the fields we consume.
+struct LineRow {
+    Elf::Addr addr;
+    const FileEntry *file;
+    unsigned line;
+    bool end_sequence;
 };
 
 class LineInfo {
+    // A run of the line program terminated by DW_LNE_end_sequence. The state
+    // machine resets completely between sequences, so each one can be decoded
+    // independently; we note their boundaries when the table is built, and
+    // only decode the rows of a sequence the first time an address inside it
+    // is queried.
+    struct Sequence {
+        Elf::Addr lowAddr;
+        Elf::Addr highAddr; // address of the end_sequence row (exclusive).
+        Elf::Off offset; // of the first opcode in the sequence.
+        std::vector<LineRow> rows; // decoded on demand.
+    };
+    mutable std::vector<Sequence> sequences; // sorted by lowAddr.
+
+    // Header state required to run the line program after build() returns.
+    Reader::csptr io;
+    Elf::Off programEnd = 0;
+    unsigned char address_size = ELF_BYTES;
+    uint8_t min_insn_length = 1;
+    int line_base = 0;
+    uint8_t line_range = 1;
+
+    // Run the state machine over one sequence, reporting the rows if
+    // requested, and the sequence's address bounds.
+    void processSequence(DWARFReader &, Elf::Off end, std::vector<LineRow> *rows,
+          Elf::Addr &low, Elf::Addr &high) const;
+    void decodeRows(Sequence &) const;
+
 public:
     LineInfo(const LineInfo &) = delete;
     LineInfo(LineInfo &&) = delete;
@@ -357,8 +432,21 @@ public:
     std::vector<int> opcode_lengths;
     std::vector<std::string> directories;
     std::vector<FileEntry> files;
-    std::vector<LineState> matrix;
     void build(DWARFReader &, Unit &);
+
+    // Find the file/line covering addr - binary searches the sequence table,
+    // then the rows of the covering sequence. Returns true on a hit.
+    bool sourceFromAddr(Elf::Addr addr, std::vector<std::pair<std::string, int>> &info) const;
+
+    // Visit every row of the matrix in address order - for dumping, without
+    // materializing the whole matrix.
+    template <typename Func> void eachRow(Func f) const {
+        for (auto &seq : sequences) {
+            decodeRows(seq);
+            for (const auto &row : seq.rows)
+                f(row);
+        }
+    }
 };
 
 struct MacroVisitor;
@@ -370,6 +458,11 @@ class Macros {
     void readD4(const Info &dwarf, intmax_t offset);
     int dwarflen;
     Reader::csptr io;
+    // Parsed DW_MACRO_import targets, keyed by section offset. Every unit
+    // imports the same transparent-include blocks, so each target's header is
+    // parsed once and the entries streamed from the section on each visit.
+    mutable std::map<intmax_t, std::unique_ptr<Macros>> imports;
+    mutable bool visiting = false; // cycle protection for imports.
 public:
     int debug_line_offset;
     uint16_t version;
@@ -378,9 +471,57 @@ public:
     bool visit(Unit &, MacroVisitor *) const;
 };
 
+/*
+ * A simple bump allocator. Decoding a unit's DIE tree generates a swarm of
+ * small allocations that all share a lifetime - they die together when the
+ * unit is purged. Carving them out of a per-unit arena is much cheaper than
+ * individual mallocs, and the memory comes back in one go. Allocations are
+ * never freed individually: holders keep a reference to the arena itself, and
+ * the chunks are released when the last such reference is dropped.
+ */
+class Arena {
+    static constexpr size_t chunkSize = 16 * 1024;
+    std::vector<std::unique_ptr<char[]>> chunks;
+    size_t used = chunkSize; // no room in the (as-yet nonexistent) current chunk.
+public:
+    void *allocate(size_t size, size_t align);
+    template <typename T, typename... Args> T *make(Args &&...args) {
+        return new (allocate(sizeof (T), alignof (T))) T(std::forward<Args>(args)...);
+    }
+};
+
+// Standard allocator interface over an Arena. "deallocate" is a no-op - the
+// memory is reclaimed when the arena itself dies.
+template <typename T> class ArenaAllocator {
+    std::shared_ptr<Arena> arena;
+    template <typename U> friend class ArenaAllocator;
+public:
+    using value_type = T;
+    ArenaAllocator(std::shared_ptr<Arena> arena_) noexcept : arena(std::move(arena_)) {}
+    template <typename U> ArenaAllocator(const ArenaAllocator<U> &rhs) noexcept : arena(rhs.arena) {}
+    T *allocate(size_t count) {
+        return static_cast<T *>(arena->allocate(count * sizeof (T), alignof (T)));
+    }
+    void deallocate(T *, size_t) noexcept {}
+    bool operator == (const ArenaAllocator &rhs) const noexcept { return arena == rhs.arena; }
+    bool operator != (const ArenaAllocator &rhs) const noexcept { return arena != rhs.arena; }
+};
+
 // A (partial-) compilation unit.
 class Unit : public std::enable_shared_from_this<Unit> {
 
+    // One lock per unit shards contention when several threads symbolize at
+    // once: all the lazily-built state below - abbreviations, raw DIEs, the
+    // address index, line and macro data - is guarded by it. Recursive,
+    // because the builders re-enter the unit: an address-index build decodes
+    // DIEs, an inline-chain walk queries the address index.
+    mutable std::recursive_mutex unitLock;
+
+    // Abbreviation codes are small, dense integers in practice, so most live
+    // in a flat vector indexed directly by code - DIE decode rate is bounded
+    // by this lookup. Outliers overflow into a map.
+    static constexpr size_t maxFlatAbbrev = 256;
+    std::vector<std::optional<Abbreviation>> flatAbbreviations;
     using Abbreviations = std::unordered_map<size_t, Abbreviation>;
 
     // We store DIEs as their "raw" counterparts - when used by the API, we
@@ -407,6 +548,46 @@ class Unit : public std::enable_shared_from_this<Unit> {
     using RangesForOffset = std::map<Elf::Addr, std::unique_ptr<Ranges>>;
     RangesForOffset rangesForOffset;
 
+    // Sorted interval table over the code ranges of the unit's subprograms
+    // and inlined subroutines, built lazily on the first address query so
+    // subsequent lookups are a binary search rather than a walk of the DIE
+    // tree. Entries hold offsets only, so the table survives a purge().
+    struct AddrEntry {
+        Elf::Addr start;
+        Elf::Addr end; // exclusive.
+        Elf::Off die;
+        Elf::Off parent; // nearest enclosing indexed DIE, or 0 for top-level.
+        Tag tag;
+    };
+    std::vector<AddrEntry> addrIndex;
+    Elf::Addr addrIndexMaxRange = 0; // longest interval - bounds index scans.
+    bool addrIndexBuilt = false;
+    void buildAddrIndex(const DIE &die, Elf::Off parentIndexed);
+
+    // Decoded inline call chains, keyed by address. Hot frames repeat across
+    // threads and snapshots, so the walk down the inline tree happens once.
+    std::map<Elf::Addr, std::vector<Elf::Off>> inlineChains;
+
+    // The matching split compilation unit from the .dwo named by this unit's
+    // root DIE, resolved lazily by split().
+    std::shared_ptr<Unit> splitUnit;
+    bool splitLoaded = false;
+
+    // Sibling offsets discovered by walking a DIE's children when
+    // DW_AT_sibling is absent. Offsets only, so - like the address index -
+    // the memo survives a purge(), and re-skipping the same subtree never
+    // decodes its entries again.
+    friend DIE;
+    std::unordered_map<Elf::Off, Elf::Off> siblingOffsets;
+
+    // Materialized DWARF 5 indexed-form tables: the unit's contributions to
+    // .debug_str_offsets and .debug_addr, slurped whole on first indexed
+    // access so strx/addrx resolution is an array load, not a section read.
+    std::vector<uintmax_t> strOffsets;
+    std::vector<Elf::Addr> addrs;
+    bool strOffsetsLoaded = false;
+    bool addrsLoaded = false;
+
 public:
 
     Unit() = delete;
@@ -434,8 +615,28 @@ public:
     uint8_t addrlen; // size of addresses in this unit.
     std::array<unsigned char, 8> id; // Unit ID for DWO.
 
+    // For a unit from a .dwo, the skeleton unit that referenced it - the
+    // skeleton's file holds the .debug_addr table its addrx forms index.
+    Unit *skeleton = nullptr;
+
     Unit(const Info *, DWARFReader &);
 
+    // Backing store for raw DIEs and their attribute data. Replaced wholesale
+    // by purge() - anything still holding a DIE keeps the old arena alive
+    // through its allocator.
+    std::shared_ptr<Arena> arena = std::make_shared<Arena>();
+
+    // The result of classifying a location expression, keyed by the
+    // expression's offset in .debug_info. The overwhelming majority of
+    // expressions are a lone DW_OP_call_frame_cfa or DW_OP_fbreg, so the
+    // evaluator (dwarfproc.cc) compiles each expression once and then skips
+    // bytecode interpretation for those forms on every subsequent frame.
+    struct CompiledLocation {
+        enum Kind { UNCOMPILED, INTERPRET, CFA, FBREG } kind = UNCOMPILED;
+        intmax_t offset = 0;
+    };
+    std::map<Elf::Off, CompiledLocation> locationCache;
+
     void purge(); // Remove all "raw" DIEs from allEntries, potentially freeing memory.
 
     // Is a given DIE the root for this unit?
@@ -446,10 +647,25 @@ public:
     // Get the root DIE for this unit
     DIE root();
 
+    // For a skeleton unit (-gsplit-dwarf), the matching split compile unit
+    // from the .dwo file named by the root DIE, loaded lazily through the
+    // image cache. Returns nullptr if this unit isn't a skeleton, or the
+    // .dwo can't be found.
+    Unit::sptr split();
+
     // Given a (debug_info-relative) offset, return the DIE at that offset in this
     // unit. To convert from unit-relative offset, just subtract the unit's offset.
     DIE offsetToDIE(const DIE &parent, Elf::Off offset);
 
+    // Find the highest DIE with the given tag below "start" covering the
+    // given address, using the lazily-built interval index. Only
+    // DW_TAG_subprogram and DW_TAG_inlined_subroutine are indexed.
+    DIE findEntryForAddr(Elf::Addr addr, Tag t, const DIE &start);
+
+    // The chain of inlined subroutines containing addr within "function",
+    // outermost first, as DIE offsets.
+    const std::vector<Elf::Off> &inlineChain(Elf::Addr addr, const DIE &function);
+
     std::string name(); // name from the root DIE.
 
     // Get line- and macro- information for this unit.
@@ -511,11 +727,26 @@ struct RegisterUnwind {
 // it is the result of execting the location instructions in the FDE and CIE
 // to a specific address.
 struct CallFrame {
-    std::map<int, RegisterUnwind> registers;
+    // The registers we can actually restore have small, dense DWARF numbers
+    // (see archreg.h), so the rules live in a flat array indexed by register
+    // number rather than a map: DW_CFA_remember_state and the copy of the
+    // CIE's initial frame are then trivial copies, and execInsns allocates
+    // nothing. UNDEF - the zero value - marks a slot with no rule. Rules for
+    // numbers beyond the table (vector registers, mostly) land in a scratch
+    // slot, as setReg can't restore those anyway.
+    static constexpr int maxReg = 64;
+    std::array<RegisterUnwind, maxReg> registers {};
     int cfaReg;
     RegisterUnwind cfaValue;
+    RegisterUnwind &reg(int i) { return i >= 0 && i < maxReg ? registers[i] : scratch; }
+    const RegisterUnwind &reg(int i) const {
+        static const RegisterUnwind undef {};
+        return i >= 0 && i < maxReg ? registers[i] : undef;
+    }
     CallFrame();
     // default copy constructor is valid.
+private:
+    RegisterUnwind scratch {}; // sink for writes of out-of-range register rules.
 };
 
 // A CIE is a Common Information Entry, describing attributes of code and some
@@ -535,9 +766,19 @@ struct CIE {
     Elf::Off end;
     std::pair<uintmax_t,bool> personality;
     std::string augmentation;
+    // The unwind state after executing the CIE's initial instructions,
+    // computed once at construction. Every FDE program associated with this
+    // CIE starts from this state, so execInsns only has to run the FDE's
+    // delta program for each frame.
+    CallFrame initialFrame;
     CIE(const CFI *, DWARFReader &, Elf::Off);
     CIE() = default;
-    CallFrame execInsns(DWARFReader &r, uintmax_t addr, uintmax_t wantAddr) const;
+    // Execute the CFA program, returning the unwind rules in effect at
+    // wantAddr. If rowStart/rowEnd are supplied, they are filled with the
+    // address range over which the returned rules hold, so callers can cache
+    // the result for a whole row of the unwind table rather than one PC.
+    CallFrame execInsns(DWARFReader &r, uintmax_t addr, uintmax_t wantAddr,
+            uintmax_t *rowStart = nullptr, uintmax_t *rowEnd = nullptr) const;
 };
 
 /*
@@ -547,7 +788,7 @@ class CFI {
 public:
     using CIEs = std::map<Elf::Addr, CIE>;
     using FDEs = std::vector<std::unique_ptr<FDE>>;
-    [[nodiscard]] const CIE &getCIE(Elf::Addr off) const { return cies.at(off); }
+    [[nodiscard]] const CIE &getCIE(Elf::Addr off) const;
     [[nodiscard]] const CIEs &getCIEs() const;
     [[nodiscard]] const FDEs &getFDEs() const;
     [[nodiscard]] const FDE *findFDE(Elf::Addr) const;
@@ -583,6 +824,9 @@ private:
 
     ExceptionHandlingEncoding fdeTableEnc; // the encoding format of the entries in fdeTable.
     mutable Reader::csptr fdeTable; // the start of the table in the eh_frame_hdr section.
+
+    // serializes lazy FDE/CIE decoding, so threads can be unwound in parallel.
+    mutable std::mutex fdeLock;
     std::pair<bool, std::unique_ptr<FDE>> putFDEorCIE( DWARFReader &reader ) const;
 
     // cieOFF set to -1 if this is CIE, set to offset of associated CIE for an FDE
@@ -658,14 +902,32 @@ public:
     // ".gnu_debugaltlink"
     Info::sptr getAltDwarf() const;
 
+    // Find the split (.dwo) unit matching a skeleton unit, loading the file
+    // named by the skeleton's root DIE via the image cache. Used by
+    // Unit::split().
+    Unit::sptr findSplitUnit(Unit &) const;
+
     const std::list<PubnameUnit> &pubnames() const;
 
+    // The .debug_names accelerator table (which may be invalid, if the
+    // section is absent).
+    const DebugNames &names() const;
+
+    // Find the DIEs known by "name", preferring the .debug_names accelerator,
+    // and falling back to a scan of legacy .debug_pubnames data.
+    std::vector<DIE> lookupName(const std::string &name) const;
+
     // get a unit, given an offset.
     Unit::sptr getUnit(Elf::Off offset) const;
 
     // Iterate over all units in the ELF object.
     Units getUnits() const;
 
+    // Decode all units concurrently, so a subsequent iteration serves them
+    // from the cache. Only safe where the object's readers can be shared
+    // across threads (e.g., mmap-backed images).
+    void preloadUnits() const;
+
     // Given a debug_info-relative offset, find the associated DIE.
     DIE offsetToDIE(Elf::Off) const;
 
@@ -677,14 +939,30 @@ public:
     // optimization, there may be more than one functions for the specific
     // address.
     std::vector<std::pair<std::string, int>> sourceFromAddr(uintmax_t addr) const;
+    // batch variant: resolve a snapshot's worth of addresses in one pass,
+    // grouping them by unit so each line table is found and built once.
+    std::map<uintmax_t, std::vector<std::pair<std::string, int>>>
+        sourceFromAddrs(std::vector<uintmax_t> addrs) const;
+
+    // Get a stable, zero-copy view of the string at "offset" in the given
+    // section - a pointer into the mapped image where the reader supports it,
+    // an interned copy otherwise. Views remain valid for the Info's life.
+    std::string_view stringAt(const Elf::Section &, Elf::Off offset) const;
+
+    // Intern a synthesized string, returning a view with the Info's lifetime.
+    std::string_view intern(std::string &&) const;
 
     std::unique_ptr<LineInfo> linesAt(intmax_t, Unit &) const;
 
     // The ELF object this DWARF data is associated with
     const Elf::Object::sptr elf;
 
-    // Cached call frames for specific return addresses.
-    std::map<Elf::Addr, CallFrame> callFrameForAddr;
+    // Cached rows of the unwind table: row start address -> (row end, unwind
+    // rules), shared by every thread unwinding through this object. frameLock
+    // guards it, and the lazy CFI construction, when threads unwind in
+    // parallel.
+    std::map<Elf::Addr, std::pair<Elf::Addr, CallFrame>> callFrameForAddr;
+    mutable std::mutex frameLock;
 
     CFI *getCFI(FIType = FI_BEST) const;
 
@@ -704,6 +982,15 @@ private:
     // These are mutable so we can lazy-eval them when getters are called, and
     // maintain logical constness.
     mutable std::unique_ptr<std::list<PubnameUnit>> pubnameUnits { nullptr };
+    // name -> debug_info offset over the legacy pubnames data, built on the
+    // first lookupName that falls back to it, so repeated queries hash
+    // rather than scan. The per-unit structure above is kept only for
+    // dwarf-dump.
+    mutable std::unique_ptr<std::unordered_multimap<std::string, Elf::Off>>
+        pubnameIdx { nullptr };
+    const std::unordered_multimap<std::string, Elf::Off> &pubnameIndex() const;
+    mutable std::unique_ptr<DebugNames> debugNames { nullptr };
+    mutable std::unordered_set<std::string> internedStrings; // for stringAt/intern.
     mutable std::map<Elf::Off, Unit::sptr> units;
     mutable Info::sptr altDwarf;
     mutable std::unique_ptr<ARanges> aranges; // maps starting address to length + unit offset.
@@ -713,8 +1000,31 @@ private:
     mutable bool altImageLoaded { false };
     mutable bool unitRangesCached { false };
 
+    // Cross-run address-to-unit index, mmapped from the cache directory -
+    // saved the first time we have to walk every unit to build range data,
+    // so later runs on the same binary binary-search the mapping instead.
+    mutable Reader::csptr unitIndex;
+    mutable size_t unitIndexCount { 0 };
+    mutable bool unitIndexTried { false };
+
+    // Locks over the lazy state above, so threads can share an Info.
+    // unitsLock guards just the units map - kept distinct from lazyLock
+    // because index builds iterate getUnits() and must be able to create
+    // units. lazyLock serializes the remaining one-shot builds: pubnames,
+    // aranges and the unit index, debug_names, and the alt debug image.
+    // stringsLock covers interning, which can happen under either.
+    mutable std::mutex unitsLock;
+    mutable std::mutex lazyLock;
+    mutable std::mutex stringsLock;
+    bool loadUnitIndex() const;
+    void saveUnitIndex() const;
+
     void decodeARangeSet(DWARFReader &) const;
+    // Build arange entries from unit root DIEs when .debug_aranges is absent
+    // or incomplete. Runs at most once.
+    void synthesizeARanges() const;
     std::string getAltImageName() const;
+    std::string getAltImageID() const;
 };
 
 /*
@@ -725,6 +1035,7 @@ class ImageCache : public Elf::ImageCache {
     int dwarfHits;
     int dwarfLookups;
     std::map<Elf::Object::sptr, Info::sptr> dwarfCache;
+    std::mutex dwarfLock; // guards dwarfCache and the counters.
 public:
     Info::sptr getDwarf(const std::string &);
     Info::sptr getDwarf(Elf::Object::sptr);
@@ -769,6 +1080,9 @@ public:
 
     [[nodiscard]] bool valid() const { return formp != nullptr; }
     explicit operator std::string() const;
+    // Zero-copy access for string forms: views into mapped section data where
+    // possible, interned on the Info otherwise. Valid for the Info's life.
+    explicit operator std::string_view() const;
     explicit operator intmax_t() const;
     explicit operator uintmax_t() const;
     explicit operator bool() const { return valid() && value().flag; }
@@ -824,6 +1138,13 @@ enum DW_RLE {
 #undef DW_RLE
 };
 
+enum DW_IDX {
+#define DW_IDX(name, value) name = (value),
+#include "libpstack/dwarf/idx.h"
+#undef DW_IDX
+    DW_IDX_max = 0xffff
+};
+
 struct MacroVisitor {
    virtual bool define([[maybe_unused]] int line, [[maybe_unused]] const std::string &text) { return true; }
    virtual bool undef([[maybe_unused]] int line, [[maybe_unused]] const std::string &text) { return true; }
@@ -1,5 +1,6 @@
 #include <string>
 #include <cassert>
+#include <cstring>
 #include "libpstack/elf.h"
 #include "libpstack/reader.h"
 #include <stdint.h>
@@ -9,67 +10,107 @@ namespace pstack::Dwarf {
  * A DWARF Reader is a wrapper for a reader that keeps a current position in the
  * underlying reader, and provides operations to read values in DWARF standard
  * encodings, advancing the offset as it does so.
+ *
+ * When the underlying reader's backing store is contiguous in memory (the
+ * common case - mmap'd ELF images and their section views), we keep a raw
+ * pointer to the content, and decode directly from that, avoiding a virtual
+ * read call and memcpy per scalar.
  */
 class DWARFReader {
     Elf::Off off;
     Elf::Off end;
+    const char *base; // non-null if io's backing store is contiguous.
 public:
     Reader::csptr io;
     unsigned addrLen;
     DWARFReader(Reader::csptr io_, Elf::Off off_ = 0, size_t end_ = std::numeric_limits<size_t>::max())
         : off(off_)
         , end(end_ == std::numeric_limits<size_t>::max() ? io_->size() : end_)
+        , base(io_->window(0, end))
         , io(std::move(io_))
         , addrLen(ELF_BITS / 8)
         {
         }
+    // fast path: a pointer into the contiguous backing store for size bytes
+    // at the current offset, advancing over them. nullptr if we must go
+    // through the Reader interface instead.
+    const unsigned char *take(size_t size) {
+        if (base == nullptr || off + size > end)
+            return nullptr;
+        auto p = reinterpret_cast<const unsigned char *>(base) + off;
+        off += size;
+        return p;
+    }
     void getBytes(size_t size, unsigned char *to) {
+       if (const auto *p = take(size)) {
+          memcpy(to, p, size);
+          return;
+       }
        io->readObj(off, to, size);
        off += size;
     }
     uint32_t getu32() {
         unsigned char q[4];
-        io->readObj(off, q, 4);
-        off += sizeof q;
+        getBytes(4, q);
         return q[0] | q[1] << 8 | q[2] << 16 | uint32_t(q[3] << 24);
     }
     uint16_t getu16() {
         unsigned char q[2];
-        io->readObj(off, q, 2);
-        off += sizeof q;
+        getBytes(2, q);
         return q[0] | q[1] << 8;
     }
     uint8_t getu8() {
+        if (const auto *p = take(1))
+            return *p;
         unsigned char q;
         io->readObj(off, &q, 1);
         off++;
         return q;
     }
+    uint64_t getu64() {
+        unsigned char q[8];
+        getBytes(8, q);
+        uint64_t lo = q[0] | q[1] << 8 | q[2] << 16 | uint32_t(q[3] << 24);
+        uint64_t hi = q[4] | q[5] << 8 | q[6] << 16 | uint32_t(q[7] << 24);
+        return lo | hi << 32;
+    }
     int8_t gets8() {
-        int8_t q;
-        io->readObj(off, &q, 1);
-        off += 1;
-        return q;
+        return int8_t(getu8());
     }
+    // The length passed here is a per-unit constant in practice - dwarfLen
+    // or addrLen, each 4 or 8 - so hand the power-of-two widths to the
+    // fixed-size decoders above, which the compiler reduces to straight
+    // unaligned loads on the contiguous fast path. The byte loop remains
+    // only for the oddball widths (eg, DW_FORM_addr on 3-byte targets).
     uintmax_t getuint(size_t len) {
+        switch (len) {
+        case 1: return getu8();
+        case 2: return getu16();
+        case 4: return getu32();
+        case 8: return getu64();
+        }
         uintmax_t rc = 0;
         uint8_t bytes[16];
         if (len > 16)
             throw Exception() << "can't deal with ints of size " << len;
-        io->readObj(off, bytes, len);
-        off += len;
+        getBytes(len, bytes);
         uint8_t *p = bytes + len;
         for (size_t i = 1; i <= len; i++)
             rc = rc << 8 | p[-i];
         return rc;
     }
     intmax_t getint(size_t len) {
+        switch (len) {
+        case 1: return gets8();
+        case 2: return int16_t(getu16());
+        case 4: return int32_t(getu32());
+        case 8: return int64_t(getu64());
+        }
         intmax_t rc;
         uint8_t bytes[16];
         if (len > 16 || len < 1)
             throw Exception() << "can't deal with ints of size " << len;
-        io->readObj(off, bytes, len);
-        off += len;
+        getBytes(len, bytes);
         uint8_t *p = bytes + len;
         rc = (p[-1] & 0x80) ? -1 : 0;
         for (size_t i = 1; i <= len; i++)
@@ -78,11 +119,21 @@ public:
     }
 
     uintmax_t getuleb128() {
+        if (likely(base != nullptr) && off < end) {
+            auto v = readleb128<uintmax_t>(base + off);
+            off += v.second;
+            return v.first;
+        }
         auto v = io->readULEB128(off);
         skip(v.second);
         return v.first;
     }
     intmax_t getsleb128() {
+        if (likely(base != nullptr) && off < end) {
+            auto v = readleb128<intmax_t>(base + off);
+            off += v.second;
+            return v.first;
+        }
         auto v = io->readSLEB128(off);
         skip(v.second);
         return v.first;
@@ -94,6 +145,11 @@ public:
     intmax_t readFormSigned(Form f);
 
     std::string getstring() {
+        if (likely(base != nullptr) && off < end) {
+            std::string s(base + off);
+            off += s.size() + 1;
+            return s;
+        }
         std::string s = io->readString(off);
         off += s.size() + 1;
         return s;
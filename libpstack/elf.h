@@ -42,6 +42,10 @@
 #include <memory>
 #include <optional>
 #include <utility>
+#include <future>
+#include <atomic>
+#include <chrono>
+#include <mutex>
 
 
 #include "libpstack/json.h"
@@ -68,6 +72,15 @@ typedef struct {
 } Elf64_Chdr;
 #endif
 
+// Compression types for SHF_COMPRESSED sections. ELFCOMPRESS_ZSTD in
+// particular postdates many system headers.
+#ifndef ELFCOMPRESS_ZLIB
+#define ELFCOMPRESS_ZLIB 1
+#endif
+#ifndef ELFCOMPRESS_ZSTD
+#define ELFCOMPRESS_ZSTD 2
+#endif
+
 namespace pstack::Elf {
 class Object;
 class ImageCache;
@@ -143,6 +156,8 @@ public:
     static int sectiontype() { return SHT_HASH; }
     SymHash(Reader::csptr hash_, Reader::csptr syms_, Reader::csptr strings_);
     std::pair<uint32_t, Sym> findSymbol(const std::string &name); // fills sym, and returns index.
+    // batch lookup: probe for all names in one pass, returning only hits.
+    std::map<std::string, std::pair<uint32_t, Sym>> findSymbols(const std::vector<std::string> &names);
 };
 
 /*
@@ -165,6 +180,7 @@ class GnuHash {
     [[nodiscard]] uint32_t bloomoff(size_t idx) const noexcept { return sizeof header + idx * sizeof(Off); }
     [[nodiscard]] uint32_t bucketoff(size_t idx) const noexcept { return bloomoff(header.bloom_size) + idx * 4; }
     [[nodiscard]] uint32_t chainoff(size_t idx) const noexcept { return bucketoff(header.nbuckets) + idx * 4; }
+    std::pair<uint32_t, Sym> lookup(const char *name, uint32_t symhash) const;
 public:
     static const char *tablename() noexcept { return ".gnu.hash"; }
     static int sectiontype() { return SHT_GNU_HASH; }
@@ -180,6 +196,9 @@ public:
     [[nodiscard]] std::pair<uint32_t, Sym> findSymbol(const std::string &name) const {
        return findSymbol(name.c_str());
     }
+    // batch lookup: hash each name once and probe for all of them in one
+    // pass, returning only hits.
+    std::map<std::string, std::pair<uint32_t, Sym>> findSymbols(const std::vector<std::string> &names) const;
 };
 
 /*
@@ -241,12 +260,18 @@ public:
     SymbolSection(Reader::csptr symbols_, Reader::csptr strings_)
        : symbols(symbols_), strings(strings_), array(*symbols)
     {}
+    size_t size() const { return symbols->size() / sizeof (Sym); }
     std::string name(const Sym &sym) const { return strings->readString(sym.st_name); }
 };
 
 struct SymbolVersioning {
     std::map<unsigned, std::string> versions;
     std::map<std::string, std::vector<int>> files;
+    // Flat caches derived from the above when the tables are decoded, so a
+    // per-symbol version query is two array hops rather than a section read
+    // and a map lookup per call.
+    std::vector<Half> symbols; // .gnu.version: symbol index -> version index.
+    std::vector<const std::string *> byIndex; // version index -> name.
 };
 
 // An ELF object - a shared lib, executable, or object file
@@ -274,7 +299,13 @@ public:
     // object, or the associated debug ELF object.
     const Section &getDebugSection(const std::string &name, Word type) const;
 
-    std::map<int, std::vector<Dyn>> dynamic;
+    // All section headers, materializing them if needed.
+    const SectionHeaders &sections() const { ensureSections(); return sectionHeaders; }
+
+    // entries from the .dynamic section, keyed by tag. Filled in lazily with
+    // the section headers; access via an Object method or call sections()
+    // first. (mutable: materialized by ensureSections() from const accessors)
+    mutable std::map<int, std::vector<Dyn>> dynamic;
 
     // Accessing segments.
     const ProgramHeaders &getSegments(Word type) const;
@@ -282,6 +313,8 @@ public:
 
     std::optional<std::pair<Sym, std::string>> findSymbolByAddress(Addr addr, int type);
     std::pair<Sym, size_t> findDynamicSymbol(const std::string &name);
+    // batch version of the above - names found are returned keyed by name.
+    std::map<std::string, std::pair<Sym, size_t>> findDynamicSymbols(const std::vector<std::string> &names);
     std::pair<Sym, size_t> findDebugSymbol(const std::string &name);
 
     Reader::csptr io;
@@ -291,6 +324,8 @@ public:
     const Ehdr &getHeader() const { return elfHeader; }
     const Phdr *getSegmentForAddress(Off) const;
     Notes notes() const { return Notes(this); }
+    // hex rendering of the GNU build-id note, or "" if there's none.
+    std::string buildID() const;
     // symbol table data as extracted from .gnu.debugdata -
     // https://sourceware.org/gdb/current/onlinedocs/gdb/MiniDebugInfo.html
     Addr endVA() const;
@@ -300,7 +335,7 @@ public:
     SymbolSection *debugSymbols();
     SymbolSection *dynamicSymbols();
     const SymbolVersioning *symbolVersions() const;
-    const Section *gnu_version;
+    mutable const Section *gnu_version = nullptr;
     VersionIdx versionIdxForSymbol( size_t symbolIdx ) const;
 private:
     mutable std::unique_ptr<SymbolVersioning> symbolVersions_;
@@ -308,13 +343,38 @@ private:
     mutable Object::sptr debugData;
     Ehdr elfHeader;
     ImageCache &imageCache;
-    SectionHeaders sectionHeaders;
-    std::map<std::string, size_t> namedSection;
+    // Section headers (and the name map, dynamic entries and version section
+    // found via them) are parsed on first touch: most mapped objects in a
+    // stack sample only ever need their program headers. "dynamic" and
+    // "gnu_version" stay public for established callers, which all arrive
+    // via an accessor that has already called ensureSections().
+    mutable bool sectionsLoaded = false;
+    void ensureSections() const;
+    mutable SectionHeaders sectionHeaders;
+    mutable std::map<std::string, size_t> namedSection;
     std::map<Word, ProgramHeaders> programHeaders;
 
     std::unique_ptr<SymbolSection> debugSymbols_;
     std::unique_ptr<SymbolSection> dynamicSymbols_;
 
+    // Lazily-built address-sorted index over a symbol table, so
+    // findSymbolByAddress is a binary search rather than a scan of every
+    // symbol per query.
+    struct AddressIndex {
+        struct Ent {
+            Addr value;
+            Addr size;
+            uint32_t idx;
+            unsigned char info;
+            Half shndx;
+        };
+        std::vector<Ent> ents; // sorted by value.
+        Addr maxSize = 0; // bounds backward scan over overlapping symbols.
+    };
+    std::unique_ptr<AddressIndex> debugAddressIndex;
+    std::unique_ptr<AddressIndex> dynamicAddressIndex;
+    AddressIndex &getAddressIndex(std::unique_ptr<AddressIndex> &, SymbolSection *);
+
     SymbolSection *getSymtab(std::unique_ptr<SymbolSection> &table, const char *name, int type) const;
 
     mutable bool debugLoaded; // We've at least attempted to load debugObject: don't try again
@@ -345,7 +405,23 @@ private:
 
     // used to cache the debug symbol table by name. Popualted first time something requests such a symbol
     std::unique_ptr<std::map<std::string, size_t>> cachedSymbols;
-    mutable const Phdr *lastSegmentForAddress; // cache of last segment returned for a specific address.
+    // memory-mapped persistent version of the above, keyed on build-id under
+    // the user's cache directory. (see findDebugSymbol)
+    Reader::csptr symbolIndex;
+    size_t symbolIndexCount = 0;
+    bool loadSymbolIndex();
+    void saveSymbolIndex();
+    // cache of last segment returned for a specific address. Atomic, as
+    // concurrent unwinds share the object; a stale value just costs a lookup.
+    mutable std::atomic<const Phdr *> lastSegmentForAddress;
+
+    // Serializes the lazily-parsed state above - section headers, symbol
+    // tables and indexes, version data, and the separate debug images - so a
+    // background DWARF prefetch can share an object with the unwinding
+    // thread. Recursive, because the builders call back into the section
+    // accessors. Per-object, so distinct images don't contend.
+    mutable std::recursive_mutex elfLock;
+    friend class Section; // Section::io() locks its owning object.
 };
 
 // These are the architecture specific types representing the NT_PRSTATUS registers.
@@ -431,9 +507,40 @@ extern std::vector<std::string> globalDebugDirectories;
  * & st_ino + st_dev)
  */
 class ImageCache {
-    std::map<std::string, Object::sptr> cache;
+    struct Entry {
+        Object::sptr object;
+        uint64_t lastUse; // tick of most recent lookup, for LRU eviction.
+    };
+    std::map<std::string, Entry> cache;
     int elfHits;
     int elfLookups;
+    uint64_t useClock = 0;
+    size_t memoryBudget = 0; // in bytes - 0 means unlimited.
+    size_t usage() const;
+    void enforceBudget(std::unique_lock<std::mutex> &);
+    Object::sptr getIfLoadedLocked(const std::string &name);
+    // guards the image map and its bookkeeping, so images can be looked up
+    // and loaded from multiple threads.
+    mutable std::mutex imagesLock;
+    // in-flight debuginfod downloads, keyed by build-id. (no-ops without
+    // debuginfod support compiled in.)
+    std::map<std::string, std::future<std::string>> debuginfodFutures;
+    std::mutex debuginfodLock;
+    // Debug-file probes that failed, keyed by path, each stamped with the
+    // mtime its containing directory had when the probe failed. The entry is
+    // trusted while that mtime is unchanged - installing debuginfo touches
+    // the directory, which invalidates the entries under it. Guarded by
+    // imagesLock.
+    std::map<std::string, time_t> negativeProbes;
+    // Directory mtimes, re-stat()ed at most every few seconds: a scan that
+    // probes the same debug directories for every image pays one stat per
+    // directory, not one per probe.
+    struct DirTime {
+        time_t mtime;
+        std::chrono::steady_clock::time_point checked;
+    };
+    std::map<std::string, DirTime> dirTimes;
+    time_t debugDirMtime(const std::string &dir);
 public:
     ImageCache();
     virtual ~ImageCache() noexcept;
@@ -441,6 +548,22 @@ public:
     Object::sptr getImageForName(const std::string &name, bool isDebug = false);
     Object::sptr getImageIfLoaded(const std::string &name);
     Object::sptr getDebugImage(const std::string &name);
+    // Shared vDSO: every process on a host maps one identical image, so batch
+    // scans over many PIDs should parse it (and hang unwind data off it)
+    // once. The remote bytes are copied and the cache keyed by their hash;
+    // the returned Object reads the local copy, so it outlives the process it
+    // was first seen in.
+    Object::sptr getVdsoImage(const Reader &remote);
+    // Bound the memory retained by cached images: once the (approximate,
+    // image-size based) total exceeds the budget, least-recently-used objects
+    // are flushed. Existing holders of an evicted Object keep it alive.
+    void setMemoryBudget(size_t bytes);
+    // Fetch debug info over debuginfod (which keeps its own persistent local
+    // cache), blocking on any prefetch already in flight for this build-id.
+    Object::sptr getDebugImageForBuildID(const std::string &buildID);
+    // Kick off background debuginfod downloads for a set of build-ids, so
+    // network latency overlaps with other work.
+    void prefetchDebugImages(const std::vector<std::string> &buildIDs);
 };
 
 extern bool noExtDebug; // if set, don't look for exernal ELF info, i.e., usinb debuglink, or buildid.
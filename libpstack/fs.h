@@ -9,6 +9,10 @@ namespace pstack {
 std::string dirname(const std::string &);
 std::string basename(const std::string &);
 std::string linkResolve(std::string name);
+
+// The per-user pstack cache directory ($XDG_CACHE_HOME/pstack, or
+// ~/.cache/pstack), created on demand. "" if it can't be determined.
+std::string cacheDirectory();
 int openfile(const std::string &filename, int mode = O_RDONLY, int umask = 0777);
 
 extern std::vector<std::pair<std::string, std::string>> pathReplacements;
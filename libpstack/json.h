@@ -3,8 +3,12 @@
 #include <iostream>
 #include <functional>
 #include <type_traits>
+#include <charconv>
 #include <cstdlib>
 #include <iomanip>
+#include <streambuf>
+#include <string_view>
+#include <vector>
 
 /*
  * General purpose way of printing out JSON objects.
@@ -71,7 +75,14 @@ operator << (std::ostream &os, const JSON<unsigned char, C>&json) {
 
 template <typename T, typename C>
 typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, unsigned char>::value, std::ostream>::type &
-operator << (std::ostream &os, const JSON<T, C>&json) { return os << json.object; }
+operator << (std::ostream &os, const JSON<T, C>&json) {
+   // format directly - iostream integer output is a measurable cost when
+   // dumping large images.
+   char buf[24];
+   auto res = std::to_chars(buf, buf + sizeof buf, json.object);
+   os.write(buf, res.ptr - buf);
+   return os;
+}
 
 /*
  * A printer for JSON boolean types: print "true" or "false"
@@ -170,8 +181,8 @@ operator << (std::ostream &os, const JSON<Container, Context> &container) {
 }
 
 struct Escape {
-    std::string value;
-    Escape(std::string value_) : value(value_) { }
+    std::string_view value;
+    Escape(std::string_view value_) : value(value_) { }
 };
 
 struct JSONEncodingError : public std::exception {
@@ -182,44 +193,60 @@ struct JSONEncodingError : public std::exception {
 
 inline std::ostream & operator << (std::ostream &o, const Escape &escape)
 {
-    auto flags(o.flags());
-    for (auto i = escape.value.begin(); i != escape.value.end();) {
-        int c;
-        switch (c = (unsigned char)*i++) {
-            case '\b': o << "\\b"; break;
-            case '\f': o << "\\f"; break;
-            case '\n': o << "\\n"; break;
-            case '"': o << "\\\""; break;
-            case '\\': o << "\\\\"; break;
-            case '\r': o << "\\r"; break;
-            case '\t': o << "\\t"; break;
+    // Write runs of characters that need no escaping in one go - for typical
+    // symbol names that's the entire string - and handle the exceptions as
+    // they interrupt a run.
+    const auto &str = escape.value;
+    size_t run = 0;
+    for (size_t i = 0; i < str.size();) {
+        int c = (unsigned char)str[i];
+        const char *simple = nullptr;
+        switch (c) {
+            case '\b': simple = "\\b"; break;
+            case '\f': simple = "\\f"; break;
+            case '\n': simple = "\\n"; break;
+            case '"': simple = "\\\""; break;
+            case '\\': simple = "\\\\"; break;
+            case '\r': simple = "\\r"; break;
+            case '\t': simple = "\\t"; break;
             default:
-                if (unsigned(c) < 32) {
-                    o << "\\u" << std::hex << unsigned(c);
-                } else if (c & 0x80) {
-                    // multibyte UTF-8: build up the unicode codepoint.
-                    unsigned long v = c;
-                    int count = 0;
-                    for (int mask = 0x80; mask & v; mask >>= 1) {
-                        if (mask == 0)
-                            throw JSONEncodingError("malformed UTF-8 string");
-                        count++;
-                        v &= ~mask;
-                    }
-                    while (--count) {
-                        c = (unsigned char)*i++;
-                        if ((c & 0xc0) != 0x80)
-                            throw JSONEncodingError("illegal character in multibyte sequence");
-                        v = (v << 6) | (c & 0x3f);
-                    }
-                    o << "\\u" << std::hex << std::setfill('0') << std::setw(4) << v;
-                } else {
-                    o << (char)c;
+                if (unsigned(c) >= 32 && (c & 0x80) == 0) {
+                    ++i;
+                    continue;
                 }
                 break;
         }
+        o.write(str.data() + run, i - run);
+        ++i;
+        unsigned long v = c;
+        if (simple != nullptr) {
+            o.write(simple, 2);
+        } else {
+            if (c & 0x80) {
+                // multibyte UTF-8: build up the unicode codepoint.
+                int count = 0;
+                for (int mask = 0x80; mask & v; mask >>= 1) {
+                    count++;
+                    v &= ~mask;
+                }
+                while (--count) {
+                    if (i == str.size())
+                        throw JSONEncodingError("malformed UTF-8 string");
+                    c = (unsigned char)str[i++];
+                    if ((c & 0xc0) != 0x80)
+                        throw JSONEncodingError("illegal character in multibyte sequence");
+                    v = (v << 6) | (c & 0x3f);
+                }
+            }
+            static const char digits[] = "0123456789abcdef";
+            char u[6] = { '\\', 'u' };
+            for (int shift = 12, pos = 2; shift >= 0; shift -= 4)
+                u[pos++] = digits[(v >> shift) & 0xf];
+            o.write(u, sizeof u);
+        }
+        run = i;
     }
-    o.flags(flags);
+    o.write(str.data() + run, str.size() - run);
     return o;
 }
 
@@ -239,6 +266,12 @@ operator << (std::ostream &os, const JSON<const char *, C> &json) {
    return os << "\"" << Escape(json.object) << "\"";
 }
 
+template <typename C>
+std::ostream &
+operator << (std::ostream &os, const JSON<std::string_view, C> &json) {
+   return os << "\"" << Escape(json.object) << "\"";
+}
+
 /*
  * A mapping type that converts the entries in a container to a different type
  * as you iterate over the original container.
@@ -273,6 +306,45 @@ public:
     Mapper(const Container &container_): container(container_) {}
 };
 
+/*
+ * A streambuf with a large output buffer. The dump options produce
+ * gigabytes of JSON, and big text traces megabytes, in fragments of a few
+ * bytes; interposing one of these between the formatters and the real
+ * stream means the underlying stream only ever sees large writes.
+ */
+class OutputBuffer : public std::streambuf {
+   std::streambuf *downstream;
+   std::vector<char> buffer;
+   int flush() {
+      auto count = pptr() - pbase();
+      if (count != 0 && downstream->sputn(pbase(), count) != count)
+         return -1;
+      pbump(int(-count));
+      return 0;
+   }
+   int_type overflow(int_type c) override {
+      if (flush() == -1)
+         return traits_type::eof();
+      if (c != traits_type::eof()) {
+         *pptr() = char_type(c);
+         pbump(1);
+      }
+      return traits_type::not_eof(c);
+   }
+   int sync() override {
+      return flush() == -1 ? -1 : downstream->pubsync();
+   }
+public:
+   OutputBuffer(std::ostream &os, size_t size = 1024 * 1024)
+      : downstream(os.rdbuf())
+      , buffer(size) {
+      setp(&buffer[0], &buffer[0] + buffer.size());
+   }
+   ~OutputBuffer() {
+      flush();
+   }
+};
+
 /* Helper for rendering compound types. */
 class JObject {
    std::ostream &os;
@@ -290,6 +362,34 @@ class JObject {
          sep = ", ";
          return *this;
       }
+      // start a field whose value the caller streams itself, eg, via JArray.
+      template <typename K> std::ostream &streamField(const K &k) {
+         os << sep << json(k) << ":";
+         sep = ", ";
+         return os;
+      }
+      operator std::ostream &() { return os; }
+};
+
+/*
+ * The streaming counterpart for arrays: emit elements as they are
+ * produced, rather than materializing a container just to serialize it.
+ */
+class JArray {
+   std::ostream &os;
+   const char *sep;
+   public:
+      JArray(std::ostream &os_) : os(os_), sep("") {
+         os << "[ ";
+      }
+      ~JArray() {
+         os << " ]";
+      }
+      template <typename V, typename C = char> JArray &element(const V &v, const C &c = C()) {
+         os << sep << json(v, c);
+         sep = ",\n";
+         return *this;
+      }
       operator std::ostream &() { return os; }
 };
 
@@ -0,0 +1,40 @@
+#ifndef LIBPSTACK_LZ4READER_H
+#define LIBPSTACK_LZ4READER_H
+
+#include <map>
+#include <vector>
+#include <lz4frame.h>
+#include "libpstack/reader.h"
+
+namespace pstack {
+/*
+ * Provides a decoded view of an lz4-framed downstream (eg, a core compressed
+ * by systemd-coredump on older systems). Like ZstdReader, lz4 frames only
+ * decode forwards, so we advance on demand in fixed-size blocks and cache
+ * each decoded block for reads behind the frontier.
+ */
+class Lz4Reader : public Reader {
+    Lz4Reader(const Lz4Reader &) = delete;
+    Lz4Reader() = delete;
+    Reader::csptr upstream;
+    LZ4F_dctx *ctx;
+    mutable std::map<Off, std::vector<char>> blocks; // keyed by uncompressed offset.
+    mutable std::vector<char> input;
+    mutable size_t inputPos = 0;
+    mutable size_t inputAvail = 0;
+    mutable Off inputOffset = 0; // upstream offset for the next input refill.
+    mutable Off decoded = 0; // uncompressed bytes produced so far.
+    mutable Off knownSize;
+    mutable bool eof = false;
+    void decodeTo(Off offset) const;
+public:
+    Lz4Reader(Reader::csptr upstream_);
+    ~Lz4Reader();
+    size_t read(Off, size_t, char *) const override;
+    void describe(std::ostream &) const override;
+    Off size() const override;
+    std::string filename() const override { return upstream->filename(); }
+};
+}
+
+#endif
@@ -19,6 +19,11 @@ class LzmaReader : public Reader {
     size_t pos = 0;
     Reader::csptr upstream;
     mutable std::map<Off, std::vector<unsigned char>> lzBlocks;
+    // memoized span and content of the most recently used block.
+    mutable Off lastBlockStart = 0;
+    mutable Off lastBlockEnd = 0;
+    mutable const std::vector<unsigned char> *lastBlock = nullptr;
+    const std::vector<unsigned char> &getBlock(Off offset, Off &blockStart) const;
 public:
     LzmaReader(Reader::csptr upstream_);
     ~LzmaReader();
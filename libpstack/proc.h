@@ -7,7 +7,9 @@ extern "C" {
 #include <thread_db.h>
 }
 
+#include <future>
 #include <map>
+#include <mutex>
 #include <variant>
 #include <set>
 #include <stack>
@@ -27,6 +29,10 @@ struct PstackOptions {
     bool dolocals = false;
     bool nothreaddb = false;
     bool nodienames = false; // don't use names from DWARF dies in backtraces.
+    // chase frame-pointer links where possible, falling back to DWARF when
+    // the chain breaks. Much cheaper, but needs -fno-omit-frame-pointer
+    // targets, and may misattribute leaf frames mid-prologue.
+    bool fast = false;
     int maxdepth = std::numeric_limits<int>::max();
     int maxframes = 20;
     std::ostream *output = &std::cout;
@@ -88,10 +94,17 @@ struct CodeLocation {
     const Elf::Phdr *phdr_;
     mutable const Dwarf::CIE *cie_;
     mutable const Dwarf::FDE *fde_;
+    // distinguishes "no FDE covers this PC" from "not searched yet", so
+    // unwind misses are cached as firmly as hits: a PC with no unwind info
+    // costs one table search ever, not one per thread per sample.
+    mutable bool fdeSearched_ = false;
     mutable const Dwarf::CFI *cfi_;
     Dwarf::CallFrame frame_;
     mutable Dwarf::DIE die_;
     mutable Elf::MaybeNamedSymbol symbol_;
+    // CodeLocations are shared - by frames with the same PC, and by repeated
+    // samples of the same process - so the lazy lookups are serialized.
+    mutable std::mutex lazyLock;
 
     std::vector<std::pair<std::string, int>> source() const;
     const Elf::MaybeNamedSymbol &symbol() const;
@@ -226,10 +239,58 @@ public:
 class Process : public ps_prochandle {
     Elf::Addr entry;
     Elf::Addr interpBase;
+    Elf::Addr rdebugAddr = 0; // the rtld's r_debug, as located by load().
     void loadSharedObjects(Elf::Addr);
+public:
+    // A symbol for JIT-generated code, published by the runtime through
+    // /tmp/perf-<pid>.map or a jitdump file. These cover addresses outside
+    // any mapped ELF object, so Node/Java frames get names too.
+    struct JitSymbol {
+        Elf::Addr start;
+        Elf::Addr end;
+        std::string name;
+    };
+private:
+    std::vector<JitSymbol> jitSymbols; // sorted by start address.
+    bool jitSymbolsLoaded = false;
+    void loadJitSymbols();
+    // Background DWARF warm-up, started by load() once the link map has been
+    // walked and joined in the destructor. See prefetchDwarf().
+    std::future<void> dwarfPrefetch;
+    void prefetchDwarf();
 public:
     std::map<Elf::Addr, MappedObject> objects;
+    // serializes on-demand loading of mapped objects via findSegment, so
+    // threads can be unwound in parallel.
+    mutable std::mutex objectsLock;
+    // most recent findSegment hit, under objectsLock.
+    std::tuple<Elf::Addr, Elf::Object::sptr, const Elf::Phdr *> lastSegment;
+    // most recent findSegment miss, as the unmapped interval the address fell
+    // in - scans probe holes in runs, just like they probe mappings.
+    std::pair<Elf::Addr, Elf::Addr> lastHole { 1, 0 };
+    // Everything we've derived about each code address so far. The DWARF and
+    // ELF data reachable from a CodeLocation is stable while the object stays
+    // mapped, so threads parked at the same PC, and repeated samples of the
+    // same process (eg, with -b), share one entry rather than re-resolving.
+    // Failed lookups are cached as null entries - bad IPs repeat, too.
+    std::map<Elf::Addr, std::shared_ptr<CodeLocation>> codeLocations;
+    mutable std::mutex locationsLock;
+    // Past resolveSymbolDetail hits, keyed by symbol name and whether debug
+    // symbols were considered. The name of the providing object rides along,
+    // so a caller's object filter can be re-applied to cached entries.
+    std::map<std::pair<std::string, bool>,
+        std::tuple<std::string, Elf::Object::sptr, Elf::Addr, Elf::Sym>> symbolCache;
+    // Lookups made on libthread_db's behalf, keyed by (object, symbol).
+    // thread_db repeats the same queries on every thread enumeration, and
+    // retries symbols a given libpthread just doesn't export, so misses are
+    // cached too (as address 0).
+    std::map<std::pair<std::string, std::string>, Elf::Addr> globalLookups;
+    Elf::Addr globalLookup(const char *objectName, const char *symbolName);
+    mutable std::mutex symbolsLock;
     Elf::Addr vdsoBase;
+    // Find the JIT symbol covering addr, if any. The tables are loaded once,
+    // on the first address that misses the mapped objects.
+    const JitSymbol *findJitSymbol(Elf::Addr addr);
     virtual Elf::Addr findRDebugAddr();
 
 protected:
@@ -282,9 +343,22 @@ public:
     std::tuple<Elf::Object::sptr, Elf::Addr, Elf::Sym>
         resolveSymbolDetail(const char *name, bool includeDebug,
                 std::function<bool(std::string_view)> match = [](std::string_view) { return true; });
-    virtual std::list<ThreadStack> getStacks();
+
+    // batch version of resolveSymbolDetail: resolve several names with a
+    // single pass over the loaded objects, probing each object's hash table
+    // once for all outstanding names. Returns the names found - no exception
+    // for misses.
+    std::map<std::string, std::tuple<Elf::Object::sptr, Elf::Addr, Elf::Sym>>
+        resolveSymbolsDetail(const std::vector<std::string> &names, bool includeDebug,
+                std::function<bool(std::string_view)> match = [](std::string_view) { return true; });
+    virtual std::vector<ThreadStack> getStacks();
     virtual ~Process();
     void load();
+    // Re-synchronize with the target's link map, for callers holding one
+    // Process across many samples. Objects still mapped keep their parsed
+    // ELF/DWARF/unwind state warm; we load what dlopen added, drop what
+    // dlclose removed, and leave derived caches alone if nothing changed.
+    void reload();
     virtual pid_t getPID() const = 0;
     virtual std::vector<AddressRange> addressSpace() const = 0;
     static std::shared_ptr<Process> load(Elf::Object::sptr exe, std::string id, const PstackOptions &options, Dwarf::ImageCache &cache);
@@ -308,6 +382,24 @@ public:
     LiveReader(pid_t, const std::string &);
 };
 
+// Reads the address space of a live process with process_vm_readv, saving a
+// trip through the VFS for each access compared to pread on /proc/<pid>/mem.
+// If the syscall is unavailable (old kernel, or blocked by seccomp/YAMA), it
+// quietly falls back to the /proc path. Wrapped in a CacheReader by
+// LiveProcess, so each page of the target is fetched at most once per stop.
+class VmReader final : public Reader {
+    pid_t pid;
+    mutable bool usable = true;
+    LiveReader fallback;
+public:
+    VmReader(pid_t);
+    size_t read(Off, size_t, char *) const override;
+    void readv(std::vector<ReadRange> &) const override;
+    void describe(std::ostream &os) const override { fallback.describe(os); }
+    std::string filename() const override { return fallback.filename(); }
+    Off size() const override { return std::numeric_limits<Off>::max(); }
+};
+
 // Name of the file /proc/<pid>/name, after symlink dereferencing
 std::string procname(pid_t pid, const std::string &);
 
@@ -315,12 +407,25 @@ struct LiveThreadList;
 class LiveProcess final : public Process {
     pid_t pid;
 
+    // procname() results for this process, resolved once. Monitoring loops
+    // call stopProcess/addressSpace every sample, and re-resolving
+    // /proc/<pid>/... paths costs a readlink each time for names that can't
+    // change over the life of the attach.
+    mutable std::map<std::string, std::string> procPaths;
+    mutable Reader::csptr auxv; // /proc/<pid>/auxv, opened on first use.
+    const std::string &procPath(const std::string &base) const;
+
     struct Lwp {
         int stopCount = 0;
         int ptraceErr = 0; // 0 if ptrace worked, otherwise, errno.
         timeval stoppedAt { 0, 0 };
     };
     std::map<pid_t, Lwp> stoppedLWPs;
+    // Initiate a stop of one LWP without waiting for it, and reap its stop
+    // notification. Splitting these lets stopProcess interrupt all the LWPs
+    // before waiting on any, so they stop concurrently.
+    bool interrupt(lwpid_t);
+    void reap(lwpid_t);
 public:
     // attach to existing process.
     LiveProcess(Elf::Object::sptr &, pid_t, const PstackOptions &, Dwarf::ImageCache &, bool alreadyStopped=false);
@@ -340,11 +445,24 @@ protected:
 };
 
 
+/*
+ * Async-signal-safe capture of the calling thread's stack, for use from a
+ * fatal signal handler: no allocation, no locks, just the interrupted
+ * context's registers and a walk of the frame-pointer chain into the
+ * caller's preallocated buffer. Returns the number of entries stored in
+ * ips. Symbolize them once it's safe to allocate again with
+ * SelfProcess::frameStack() and dumpStackText().
+ */
+size_t threadFrames(const ucontext_t *, Elf::Addr *ips, size_t maxframes);
+
 class SelfProcess : public Process {
     pid_t pid;
 public:
     // attach to existing process.
     SelfProcess(const Elf::Object::sptr &, const PstackOptions &, Dwarf::ImageCache &);
+    // Rebuild a symbolizable ThreadStack from addresses captured by
+    // threadFrames, after the signal handler is done.
+    ThreadStack frameStack(const Elf::Addr *ips, size_t count);
     void listLWPs(std::function<void(lwpid_t)>) override;
     virtual size_t getRegs(lwpid_t pid, int code, size_t sz, void *reg) override;
     virtual void stop(pid_t) override;
@@ -367,14 +485,23 @@ protected:
     virtual size_t read(Off remoteAddr, size_t size, char *ptr) const override;
 public:
     CoreReader (Process *, Elf::Object::sptr);
+    // With an mmap'd core, ranges that lie entirely within one PT_LOAD's
+    // file content can be served as pointers into the mapping, no copy.
+    const char *window(Off remoteAddr, size_t size) const override;
     virtual void describe(std::ostream &os) const override;
     Off size() const override { return std::numeric_limits<Off>::max(); }
     std::string filename() const override { return "process memory"; }
 };
 
 class CoreProcess final : public Process {
-    std::vector<Elf::NoteDesc> notes;
-    std::map<lwpid_t, size_t> lwpToPrStatusIdx;
+    // Notes indexed once at construction: per-LWP notes (those following an
+    // NT_PRSTATUS, up to the next one) are keyed by (type, lwpid);
+    // process-wide notes by (type, 0). Register fetch per thread is then a
+    // map lookup rather than a rescan of the note headers.
+    std::map<std::pair<int, lwpid_t>, Reader::csptr> noteIndex;
+    // Decoded NT_PRSTATUS contents, in note order - the register set every
+    // thread's unwind starts from, so avoid re-reading even the note.
+    std::map<lwpid_t, prstatus_t> prStatuses;
     prpsinfo_t prpsinfo;
 public:
     Elf::Object::sptr coreImage;
@@ -421,6 +548,11 @@ struct FileNoteHeader {
     Elf::Off pageSize;
 };
 
+// Write an ELF core-file snapshot of the process to <path>, gcore-style.
+// The target is stopped while its memory is streamed out by a pool of
+// worker threads; zero and unreadable pages become holes in the file.
+void gcore(Process &, const std::string &path);
+
 struct FileEntry {
     Elf::Off start;
     Elf::Off end;
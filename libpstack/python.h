@@ -8,6 +8,7 @@
 #define V2HEX(major, minor) ((major << 24) | (minor << 16))
 struct _object;
 struct _typeobject;
+struct _ts;
 
 namespace pstack {
 
@@ -43,6 +44,9 @@ template <int V, typename T> T readPyObj(const Reader &r, off_t offset) {
 
 template <int V> std::string readString(const Reader &r, const Elf::Addr addr);
 template <int V> void printArguments(const PythonPrinter<V> *, const _object *, Elf::Addr addr);
+// walk and print the frames of one thread. Specialized for 3.11+, where
+// frames are no longer heap-allocated PyFrameObjects.
+template <int V> void printFrames(const PythonPrinter<V> *, const _ts *);
 template <int V> int getKwonlyArgCount(const _object *);
 
 template <int V>
@@ -57,17 +61,41 @@ public:
     static std::set<const PythonTypePrinter *> all;
 };
 
-template <int PyV>
-struct PythonPrinter {
-    void print(Elf::Addr remoteAddr) const;
+/*
+ * Decoded remote python structures that stay stable for the life of a
+ * process: the interpreter discovery itself, types, code objects, line
+ * tables and interned strings. Types are immortal in practice, so one of
+ * these lives alongside each traced process, outliving the printer, and
+ * repeated snapshots (pstack's repeat loop) don't re-read tp_name and
+ * friends every iteration. Raw bytes for the code objects, as the python
+ * types aren't visible outside the versioned translation units.
+ */
+struct PythonCache {
     struct freetype {
         void operator()(_typeobject *to) {
             free(to);
         }
     };
-    mutable std::map<const _typeobject *, std::unique_ptr<_typeobject, freetype>> types;
+    std::map<const _typeobject *, std::unique_ptr<_typeobject, freetype>> types;
+    std::map<Elf::Addr, std::vector<char>> codeObjects;
+    std::map<Elf::Addr, std::vector<unsigned char>> lineTables;
+    std::map<Elf::Addr, std::string> strings;
+    std::map<Elf::Addr, std::string> cStrings; // raw C strings - tp_name, mostly.
+    // interpreter discovery, done once per process.
+    bool interpProbed = false;
+    PyInterpInfo interp;
+};
+
+template <int PyV>
+struct PythonPrinter {
+    void print(Elf::Addr remoteAddr) const;
+    // the tp_name of the object at remoteAddr, for census-style tallies -
+    // reads the object header and (via the cache) its type, "?" on failure.
+    std::string objectType(Elf::Addr remoteAddr) const;
+    PythonCache &cache;
 
-    PythonPrinter(Procman::Process &proc_, std::ostream &os_, const PyInterpInfo &info_);
+    PythonPrinter(Procman::Process &proc_, std::ostream &os_, const PyInterpInfo &info_,
+          PythonCache &cache_);
     const char *prefix() const;
     void printInterpreters(bool withModules);
     Elf::Addr printThread(Elf::Addr);
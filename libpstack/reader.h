@@ -1,17 +1,29 @@
 #ifndef pstack_reader_h
 #define pstack_reader_h
 
+#include <atomic>
 #include <climits>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <unordered_map>
 #include <limits>
-#include <list>
+#include <optional>
+#include <vector>
 #include <array>
 #include "libpstack/exception.h"
 
 namespace pstack {
 
+// Deduplicate a string against the process-wide intern pool, returning a
+// reference to the pooled copy. Entries are never removed, so the reference
+// (and the characters behind it) stay valid for the life of the process.
+// Symbol and debug-string names repeat heavily across objects - every DSO
+// linked against libstdc++ shares thousands of mangled names - so caches
+// that would otherwise hold their own copy should hold a pointer into the
+// pool instead.
+const std::string &internString(std::string &&s);
+
 // Reader provides the basic random-access IO to a range of bytes.  The most
 // basic reader is a FileReader, which allows you to access the content of a
 // file from offset 0 through to the length of the file.
@@ -47,13 +59,40 @@ public:
 
     // Helper to read a single object.
     template <typename Obj> Obj readObj(Off offset) const;
+
+    // Non-throwing variants, for speculative probes - frame-pointer
+    // unwinding, pointer chasing, etc., where a failed read is expected and
+    // shouldn't pay for exception construction. Indicate success rather than
+    // throwing; the throwing API remains for genuinely exceptional failures.
+    template <typename Obj> [[nodiscard]] bool tryReadObj(Off offset, Obj *object, size_t count = 1) const noexcept;
+    template <typename Obj> [[nodiscard]] std::optional<Obj> tryReadObj(Off offset) const noexcept;
     // read a sequence of count bytes at offset off. May give a short return.
     virtual size_t read(Off off, size_t count, char *ptr) const = 0;
 
+    // One range of a scattered read: count bytes at offset into ptr, with
+    // got filled in with the bytes actually transferred.
+    struct ReadRange {
+        Off offset;
+        size_t count;
+        char *ptr;
+        size_t got = 0;
+    };
+    // Read several discontiguous ranges in one operation where the backing
+    // store supports it (see VmReader) - used to gather all of a frame's
+    // argument values with a single syscall. The default loops over read(),
+    // and failed ranges just report zero bytes.
+    virtual void readv(std::vector<ReadRange> &ranges) const;
+
     // read a LEB128 encoded integer.
     virtual std::pair<uintmax_t, size_t> readULEB128(Off off) const;
     virtual std::pair<intmax_t, size_t> readSLEB128(Off off) const;
 
+    // Return a pointer to count bytes of content at offset, if the backing
+    // store for this reader is contiguous in memory (as for MemReader and
+    // MmapReader). Returns nullptr otherwise - callers must then fall back
+    // to read()/readObj().
+    virtual const char *window(Off /*offset*/, size_t /*count*/) const { return nullptr; }
+
     // describe this reader.
     virtual void describe(std::ostream &os) const = 0;
 
@@ -95,10 +134,44 @@ Reader::readObj(Off offset) const
    return t;
 }
 
+template <typename Obj> bool
+Reader::tryReadObj(Off offset, Obj *object, size_t count) const noexcept
+{
+    if (count == 0)
+        return true;
+    // most readers indicate failure with a short return; the try block
+    // covers the few that throw (eg, NullReader).
+    try {
+        return read(offset, count * sizeof *object, (char *)object)
+            == count * sizeof *object;
+    }
+    catch (...) {
+        return false;
+    }
+}
+
+template <typename Obj> std::optional<Obj>
+Reader::tryReadObj(Off offset) const noexcept
+{
+    Obj t;
+    if (tryReadObj(offset, &t))
+        return t;
+    return std::nullopt;
+}
+
 // Reader implementations
 class FileReader : public Reader {
     std::string name;
     int file;
+    // Sequential-scan detection: when a read starts where the previous one
+    // ended, the kernel is advised of a growing window ahead of it, so disk
+    // latency overlaps with the caller's parsing. Best-effort - the fields
+    // are relaxed atomics, and a racing reader at worst resets the window.
+    static constexpr Off initialWindow = 64 * 1024;
+    static constexpr Off maxWindow = 4 * 1024 * 1024;
+    mutable std::atomic<Off> expected { 0 }; // where a sequential read would start.
+    mutable std::atomic<Off> window { 0 };   // current readahead window; 0 = not sequential.
+    mutable std::atomic<Off> advised { 0 };  // advised so far, up to here.
 protected:
     mutable Off fileSize;
 public:
@@ -114,27 +187,53 @@ public:
 
 class CacheReader final : public Reader {
     Reader::csptr upstream;
-    mutable std::unordered_map<Off, std::string> stringCache;
-    static const size_t PAGESIZE = 256;
-    static const size_t MAXPAGES = 16;
+    // offset -> interned string. The values live in the process-wide pool,
+    // so a name cached by many readers costs one allocation, not one each.
+    mutable std::unordered_map<Off, const std::string *> stringCache;
+    static const size_t MINPAGES = 16;
+    static const size_t MAXPAGES = 1024;
+    size_t pagesize;
     class Page {
     public:
         Off offset;
         size_t len;
-        std::array<char, PAGESIZE> data;
+        Page *lruPrev = nullptr; // intrusive LRU chain, most recent at head.
+        Page *lruNext = nullptr;
+        std::vector<char> data;
         void load(const Reader &r, Off offset_);
+        explicit Page(size_t pagesize_) : offset(0), len(0), data(pagesize_) {}
     };
-    mutable std::list<std::unique_ptr<Page>> pages;
+    mutable std::unordered_map<Off, std::unique_ptr<Page>> pages;
+    mutable Page *lruHead = nullptr;
+    mutable Page *lruTail = nullptr;
+    mutable size_t maxpages = MINPAGES;
+    mutable size_t hits = 0;
+    mutable size_t misses = 0;
+    // The page and string caches are shared mutable state - serialize access
+    // so the reader can back concurrent unwinding.
+    mutable std::mutex cacheLock;
     Page &getPage(Off pageoff) const;
+    void lruUnlink(Page *) const;
+    void lruInsert(Page *) const;
 public:
     void flush();
     size_t read(Off off, size_t count, char *ptr) const override;
+    // Scattered values are one-shot reads - pass them straight to the
+    // upstream reader's vectored path rather than faulting pages in one at
+    // a time.
+    void readv(std::vector<ReadRange> &ranges) const override {
+        upstream->readv(ranges);
+    }
     void describe(std::ostream &os) const override {
         // this must be the same as the underlying stream: we sometimes rely on the
         // FileReader's filename
         os << *upstream;
     }
-    explicit CacheReader(Reader::csptr upstream_);
+    explicit CacheReader(Reader::csptr upstream_, size_t pagesize_ = 4096);
+    ~CacheReader();
+    const char *window(Off offset, size_t count) const override {
+        return upstream->window(offset, count);
+    }
     std::string readString(Off off) const override;
     Off size() const override { return upstream->size(); }
     std::string filename() const override { return upstream->filename(); }
@@ -147,6 +246,7 @@ public:
     size_t len;
     const char *data;
     size_t read(Off off, size_t count, char *ptr) const override;
+    const char *window(Off offset, size_t count) const override;
     MemReader(const std::string &, size_t, const char *);
     void describe(std::ostream &os) const override;
     Off size() const override { return len; }
@@ -159,7 +259,9 @@ public:
 
 class MmapReader final : public MemReader {
 public:
-    MmapReader(const std::string &name_);
+    // readahead hints the kernel to fault the whole file in eagerly - good
+    // for ELF images we'll walk front-to-back, bad for enormous core files.
+    MmapReader(const std::string &name_, bool readahead = true);
     ~MmapReader();
     std::string filename() const override { return descr; }
 };
@@ -185,7 +287,18 @@ public:
     std::string readString(Off absoff) const override {
         return upstream->readString(absoff + offset);
     }
+    std::pair<uintmax_t, size_t> readULEB128(Off off) const override {
+        return upstream->readULEB128(off + offset);
+    }
+    std::pair<intmax_t, size_t> readSLEB128(Off off) const override {
+        return upstream->readSLEB128(off + offset);
+    }
+    // Flatten at view() time: let the upstream build the view directly, so a
+    // view of an offset reader over an in-memory reader yields the upstream's
+    // zero-copy variant rather than stacking another indirection.
+    csptr view(const std::string &name, Off start, Off length=std::numeric_limits<Off>::max()) const override;
     virtual size_t read(Off off, size_t count, char *ptr) const override;
+    const char *window(Off off, size_t count) const override;
     OffsetReader(std::string, Reader::csptr upstream_, Off offset_, Off length_ = std::numeric_limits<Off>::max());
     void describe(std::ostream &os) const override {
         os << name << " [" << offset << "," << offset + length << "] of " << *upstream;
@@ -210,6 +323,10 @@ class ReaderArray {
    mutable size_t cacheEnd = 0; // after last valid item in cache.
    mutable size_t eof;
    mutable std::array<T, cachesize> cache;
+   // Zero-copy view of the whole array when the backing reader can window
+   // it (mmaped files, in-memory buffers): iteration then reads straight
+   // from the mapping with no per-chunk copies at all.
+   const T *contents = nullptr;
 
 public:
    class iterator {
@@ -239,8 +356,13 @@ public:
          reader(reader_),
          base(offset),
          eof( ( reader.size() - base ) / sizeof(T) ) {
-      if(reader.size() != std::numeric_limits<size_t>::max() && reader.size() % sizeof (T) != 0) {
-         throw ( Exception() << "end of data while reading array" );
+      auto size = reader.size();
+      if (size != std::numeric_limits<size_t>::max()) {
+         if (size % sizeof (T) != 0)
+            throw ( Exception() << "end of data while reading array" );
+         auto p = reader.window(base, size - base);
+         if (p != nullptr && reinterpret_cast<uintptr_t>(p) % alignof(T) == 0)
+            contents = reinterpret_cast<const T *>(p);
       }
    }
 };
@@ -255,6 +377,11 @@ typename ReaderArray<T, cachesize>::iterator &ReaderArray<T, cachesize>::iterato
 #define unlikely(x)     __builtin_expect(!!(x), 0)
 
 template <typename T, size_t cachesize> const T &ReaderArray<T, cachesize>::getitem(size_t idx) const {
+   if (contents != nullptr) {
+      if (unlikely(idx >= eof))
+         throw ( Exception() << "end of data while reading array" );
+      return contents[idx];
+   }
    if (unlikely(cacheStart > idx || idx >= cacheEnd)) {
       size_t rc = reader.read(idx * sizeof(T) + base, cachesize * sizeof (T), reinterpret_cast<char *>(cache.data()));
       cacheStart = idx;
@@ -268,20 +395,34 @@ template <typename T, size_t cachesize> const T &ReaderArray<T, cachesize>::geti
 
 template <typename T, typename Iter> static inline std::pair<T, size_t> readleb128(Iter start) {
    static_assert(CHAR_BIT == 8);
-   T result = 0;
-   unsigned shift = 0;
-   unsigned char byte;
-   for (auto it = start;; ++it) {
-      byte = *it;
+   using U_T = typename std::make_unsigned<T>::type;
+   auto it = start;
+   unsigned char byte = *it;
+   // Single-byte encodings (abbreviation codes, attribute forms, most
+   // line-table operands) dominate real DWARF - decode them without the
+   // shift bookkeeping of the general loop. We can't speculatively load a
+   // whole word here, as the encoding may end right at the edge of the
+   // backing mapping.
+   if (likely((byte & 0x80) == 0)) {
+      T result = T(byte & 0x7f);
+      if constexpr (std::is_signed_v<T>) {
+         if (byte & 0x40)
+            result |= T(~U_T(0) << 7);
+      }
+      return { result, 1 };
+   }
+   T result = T(byte & 0x7f);
+   unsigned shift = 7;
+   for (;;) {
+      byte = *++it;
       result |= T(byte & 0x7f) << shift;
       shift += 7;
       if ((byte & 0x80) == 0) {
          if constexpr (std::is_signed_v<T>) {
-            using U_T = typename std::make_unsigned<T>::type;
             if (shift < sizeof(T) * CHAR_BIT && (byte & 0x40))
                result |= ~U_T(0) << shift;
          }
-         return { result, it - start + 1 };
+         return { result, size_t(it - start) + 1 };
       }
    };
 }
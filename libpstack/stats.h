@@ -0,0 +1,52 @@
+#ifndef pstack_stats_h
+#define pstack_stats_h
+
+#include <atomic>
+#include <chrono>
+#include <iosfwd>
+
+namespace pstack::stats {
+
+/*
+ * Process-wide performance counters, in the spirit of ImageCache's
+ * hit/lookup counts, but visible across subsystems. Counting uses relaxed
+ * atomics and is cheap enough to leave permanently enabled; pstack's
+ * --perf-stats option dumps the registry as JSON on exit, so a slow
+ * snapshot can be attributed to the subsystem that ate it.
+ */
+extern std::atomic<uintmax_t> readerOps;        // physical read calls.
+extern std::atomic<uintmax_t> readerBytes;      // ...and the bytes they moved.
+extern std::atomic<uintmax_t> cacheHits;        // CacheReader page hits.
+extern std::atomic<uintmax_t> cacheMisses;      // ...and misses.
+extern std::atomic<uintmax_t> fdesDecoded;
+extern std::atomic<uintmax_t> diesMaterialized;
+extern std::atomic<uintmax_t> symbolsScanned;   // symbols examined during lookups.
+
+inline void count(std::atomic<uintmax_t> &counter, uintmax_t n = 1) {
+   counter.fetch_add(n, std::memory_order_relaxed);
+}
+
+// Accumulated wall time per phase. Symbolization happens while printing, so
+// ph_symbolize is a subset of ph_print.
+enum Phase { ph_load, ph_unwind, ph_symbolize, ph_print, ph_count };
+extern std::atomic<uintmax_t> phaseNsec[ph_count];
+
+// Accumulates the wall time of its scope against a phase.
+class Timer {
+   Phase phase;
+   std::chrono::steady_clock::time_point start;
+public:
+   Timer(Phase phase_) : phase(phase_), start(std::chrono::steady_clock::now()) {}
+   Timer(const Timer &) = delete;
+   Timer &operator = (const Timer &) = delete;
+   ~Timer() {
+      count(phaseNsec[phase], std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - start).count());
+   }
+};
+
+void dump(std::ostream &);
+
+}
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef LIBPSTACK_ZSTDREADER_H
+#define LIBPSTACK_ZSTDREADER_H
+
+#include <map>
+#include <vector>
+#include <zstd.h>
+#include "libpstack/reader.h"
+
+namespace pstack {
+/*
+ * Provides a decoded view of a zstd-compressed downstream (eg, a core left
+ * compressed on disk by systemd-coredump). Plain zstd streams don't support
+ * random access, so we decode forwards on demand in fixed-size blocks,
+ * caching each block as it's produced - reads behind the decode frontier are
+ * served from the cache rather than by rewinding the stream.
+ */
+class ZstdReader : public Reader {
+    ZstdReader(const ZstdReader &) = delete;
+    ZstdReader() = delete;
+    Reader::csptr upstream;
+    ZSTD_DStream *stream;
+    mutable std::map<Off, std::vector<char>> blocks; // keyed by uncompressed offset.
+    mutable std::vector<char> input;
+    mutable size_t inputPos = 0;
+    mutable size_t inputAvail = 0;
+    mutable Off inputOffset = 0; // upstream offset for the next input refill.
+    mutable Off decoded = 0; // uncompressed bytes produced so far.
+    mutable Off knownSize;
+    mutable bool eof = false;
+    void decodeTo(Off offset) const;
+public:
+    ZstdReader(Reader::csptr upstream_);
+    ~ZstdReader();
+    size_t read(Off, size_t, char *) const override;
+    void describe(std::ostream &) const override;
+    Off size() const override;
+    std::string filename() const override { return upstream->filename(); }
+};
+}
+
+#endif
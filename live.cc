@@ -7,6 +7,7 @@
 #include <sys/ptrace.h>
 #include <sys/types.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
 
 #include <dirent.h>
 #include <err.h>
@@ -28,11 +29,84 @@ LiveReader::LiveReader(pid_t pid, const std::string &base) : FileReader(procname
    fileSize = std::numeric_limits<Reader::Off>::max();
 }
 
+VmReader::VmReader(pid_t pid_)
+    : pid(pid_)
+    , fallback(pid_, "mem")
+{
+}
+
+size_t
+VmReader::read(Off off, size_t count, char *ptr) const
+{
+    if (!usable)
+        return fallback.read(off, count, ptr);
+    iovec local { .iov_base = ptr, .iov_len = count };
+    iovec remote { .iov_base = reinterpret_cast<void *>(off), .iov_len = count };
+    ssize_t rc = process_vm_readv(pid, &local, 1, &remote, 1, 0);
+    if (rc >= 0)
+        return rc;
+    if (errno == ENOSYS || errno == EPERM) {
+        // No process_vm_readv for us - stick to /proc/<pid>/mem from here on.
+        if (verbose > 0)
+            *debug << "process_vm_readv unavailable for " << pid << " ("
+               << strerror(errno) << "), falling back to procfs\n";
+        usable = false;
+        return fallback.read(off, count, ptr);
+    }
+    // EFAULT etc. - treat like a failed pread of the same range.
+    throw (Exception()
+        << "read " << count
+        << " at " << (void *)off
+        << " on " << *this
+        << " failed: " << strerror(errno));
+}
+
+void
+VmReader::readv(std::vector<ReadRange> &ranges) const
+{
+    if (!usable || ranges.empty() || ranges.size() > IOV_MAX) {
+        Reader::readv(ranges);
+        return;
+    }
+    std::vector<iovec> local, remote;
+    local.reserve(ranges.size());
+    remote.reserve(ranges.size());
+    for (auto &range : ranges) {
+        local.push_back({ .iov_base = range.ptr, .iov_len = range.count });
+        remote.push_back({ .iov_base = reinterpret_cast<void *>(range.offset),
+              .iov_len = range.count });
+    }
+    ssize_t rc = process_vm_readv(pid, local.data(), local.size(),
+          remote.data(), remote.size(), 0);
+    if (rc < 0) {
+        // read() deals with ENOSYS/EPERM fallback; anything else is handled
+        // per-range there, too.
+        Reader::readv(ranges);
+        return;
+    }
+    // The kernel stops at the first range it can't fully read - credit the
+    // transferred bytes in order, and retry anything left short one at a
+    // time, as some later ranges may still be readable.
+    auto left = size_t(rc);
+    for (auto &range : ranges) {
+        range.got = std::min(left, range.count);
+        left -= range.got;
+        if (range.got != range.count) {
+            try {
+                range.got = read(range.offset, range.count, range.ptr);
+            }
+            catch (const std::exception &) {
+                range.got = 0;
+            }
+        }
+    }
+}
+
 LiveProcess::LiveProcess(Elf::Object::sptr &ex, pid_t pid_,
             const PstackOptions &options, Dwarf::ImageCache &imageCache, bool alreadyStopped)
     : Process(
             ex ? ex : imageCache.getImageForName(procname(pid_, "exe")),
-            std::make_shared<CacheReader>(std::make_shared<LiveReader>(pid_, "mem")),
+            std::make_shared<CacheReader>(std::make_shared<VmReader>(pid_)),
             options, imageCache)
     , pid(pid_)
 {
@@ -41,8 +115,18 @@ LiveProcess::LiveProcess(Elf::Object::sptr &ex, pid_t pid_,
        stoppedLWPs[pid].stopCount = 1;
 }
 
+const std::string &
+LiveProcess::procPath(const std::string &base) const {
+    auto [it, isnew] = procPaths.emplace(base, "");
+    if (isnew)
+        it->second = procname(pid, base);
+    return it->second;
+}
+
 Reader::csptr LiveProcess::getAUXV() const {
-    return std::make_shared<LiveReader>(pid, "auxv");
+    if (auxv == nullptr)
+        auxv = std::make_shared<LiveReader>(pid, "auxv");
+    return auxv;
 }
 
 size_t
@@ -113,7 +197,9 @@ LiveProcess::stopProcess()
     // /proc/<pid>/task/<tid> of a task we have suspended, rather than the main
     // process
     std::set<lwpid_t> suspended;
-    stop(pid);
+    std::vector<lwpid_t> interrupted;
+    if (interrupt(pid))
+        interrupted.push_back(pid);
     suspended.insert(pid);
 
     /*
@@ -121,11 +207,17 @@ LiveProcess::stopProcess()
      * threads. Stopping the threads with thread_db actually just returns an
      * error in linux, but stopping everything here ensures that we are not
      * racing the process threads to read the thread list later.
+     *
+     * Issue the interrupts for every LWP we haven't seen before reaping any
+     * of the stop notifications - the LWPs then stop concurrently, so the
+     * process is perturbed for about one stop's latency rather than the sum
+     * of them all. Going around the loop again catches threads that were
+     * spawned while we were stopping their creators.
      */
     size_t lastStopCount;
     do {
         lastStopCount = suspended.size();
-        std::string dirName = procname(pid, "task");
+        const std::string &dirName = procPath("task");
         DIR *d = opendir(dirName.c_str());
         if (d != nullptr) {
             for (dirent *de; (de = readdir(d)) != nullptr; ) {
@@ -133,12 +225,15 @@ LiveProcess::stopProcess()
                 lwpid_t tid = strtol(de->d_name, &p, 0);
                 if (*p == 0) {
                     auto [_, isnew ] = suspended.insert(tid);
-                    if (isnew)
-                        stop(tid);
+                    if (isnew && interrupt(tid))
+                        interrupted.push_back(tid);
                 }
             }
         }
         closedir(d);
+        for (auto tid : interrupted)
+            reap(tid);
+        interrupted.clear();
         // if we found any threads, log it as debug. If we went around more than once, always log.
         if (lastStopCount != suspended.size() && (verbose >= 2 || lastStopCount != 1))
             *debug << "found " << suspended.size() - lastStopCount << " new LWPs after first " << lastStopCount << "\n";
@@ -184,20 +279,35 @@ LiveProcess::resumeProcess()
        */
 }
 
-void
-LiveProcess::stop(lwpid_t tid) {
+// Initiate a stop of an LWP, without waiting for it to arrive in its stopped
+// state. Returns true if the caller should reap() the notification.
+bool
+LiveProcess::interrupt(lwpid_t tid) {
    auto &tcb = stoppedLWPs[tid];
    if (tcb.stopCount++ != 0)
-      return;
+      return false;
 
    gettimeofday(&tcb.stoppedAt, nullptr);
-   if (ptrace(PT_ATTACH, tid, 0, 0) != 0) {
-      tcb.ptraceErr = errno;
-      *debug << "failed to stop LWP " << tid << ": ptrace failed: " << strerror(errno) << "\n";
-      return;
+   if (ptrace(PTRACE_SEIZE, tid, 0, 0) == 0) {
+      if (ptrace(PTRACE_INTERRUPT, tid, 0, 0) == 0) {
+         tcb.ptraceErr = 0;
+         return true;
+      }
+   } else if (errno == EIO || errno == EINVAL) {
+      // No PTRACE_SEIZE on this kernel: PT_ATTACH also leaves a stop
+      // notification for reap(), it just injects a signal to do it.
+      if (ptrace(PT_ATTACH, tid, 0, 0) == 0) {
+         tcb.ptraceErr = 0;
+         return true;
+      }
    }
-   tcb.ptraceErr = 0;
+   tcb.ptraceErr = errno;
+   *debug << "failed to stop LWP " << tid << ": ptrace failed: " << strerror(errno) << "\n";
+   return false;
+}
 
+void
+LiveProcess::reap(lwpid_t tid) {
    int status = 0;
    pid_t waitedpid = waitpid(tid, &status, tid == this->pid ? 0 : __WCLONE);
    if (waitedpid == -1)
@@ -206,8 +316,14 @@ LiveProcess::stop(lwpid_t tid) {
       *debug << "suspend LWP " << tid << std::endl;
 }
 
+void
+LiveProcess::stop(lwpid_t tid) {
+   if (interrupt(tid))
+      reap(tid);
+}
+
 std::vector<AddressRange>
-LiveProcess::addressSpace() const { return procAddressSpace(procname(pid, "maps")); }
+LiveProcess::addressSpace() const { return procAddressSpace(procPath("maps")); }
 
 std::vector<AddressRange>
 Process::procAddressSpace(const std::string &fn) {
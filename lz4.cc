@@ -0,0 +1,105 @@
+#include "libpstack/lz4reader.h"
+#include "libpstack/global.h"
+
+#include <string.h>
+
+namespace pstack {
+
+// Granularity of the decoded-block cache - see zstd.cc for the tradeoff.
+static constexpr size_t blockSize = 1024 * 1024;
+
+Lz4Reader::Lz4Reader(Reader::csptr upstream_)
+    : upstream{std::move(upstream_)}
+    , ctx{}
+{
+    auto rc = LZ4F_createDecompressionContext(&ctx, LZ4F_VERSION);
+    if (LZ4F_isError(rc) != 0u)
+        throw (Exception() << "can't create lz4 context: " << LZ4F_getErrorName(rc));
+    // The frame header records the content size if the compressor provided
+    // it. If not, size() has to decode the entire stream to find out.
+    char header[LZ4F_HEADER_SIZE_MAX];
+    size_t srcSize = upstream->read(0, sizeof header, header);
+    LZ4F_frameInfo_t info{};
+    rc = LZ4F_getFrameInfo(ctx, &info, header, &srcSize);
+    if (LZ4F_isError(rc) != 0u)
+        throw (Exception() << "can't decode lz4 frame header: " << LZ4F_getErrorName(rc));
+    knownSize = info.contentSize != 0 ? Off(info.contentSize) : Off(-1);
+    // getFrameInfo consumed the header - reset so decodeTo can process the
+    // stream from the top without tracking how far the probe got.
+    LZ4F_resetDecompressionContext(ctx);
+    input.resize(blockSize);
+    if (verbose >= 2)
+        *debug << "lz4 inflate: " << *this << "\n";
+}
+
+// Advance the decode frontier until "offset" bytes of output exist (or the
+// stream is exhausted), filing each blockSize chunk of output in the cache.
+void
+Lz4Reader::decodeTo(Off offset) const
+{
+    while (decoded < offset && !eof) {
+        if (inputPos == inputAvail) {
+            inputAvail = upstream->read(inputOffset, input.size(), &input[0]);
+            inputOffset += inputAvail;
+            inputPos = 0;
+            if (inputAvail == 0) {
+                eof = true;
+                break;
+            }
+        }
+        Off blockStart = decoded - decoded % blockSize;
+        auto &block = blocks[blockStart];
+        if (block.empty())
+            block.resize(blockSize);
+        size_t dstSize = block.size() - size_t(decoded - blockStart);
+        size_t srcSize = inputAvail - inputPos;
+        auto rc = LZ4F_decompress(ctx, &block[decoded - blockStart], &dstSize,
+                &input[inputPos], &srcSize, nullptr);
+        if (LZ4F_isError(rc) != 0u)
+            throw (Exception() << "lz4 decode failed at offset " << decoded
+                    << ": " << LZ4F_getErrorName(rc));
+        inputPos += srcSize;
+        decoded += Off(dstSize);
+    }
+}
+
+size_t
+Lz4Reader::read(Off offset, size_t size, char *data) const
+{
+    decodeTo(offset + Off(size));
+    size_t startSize = size;
+    while (size != 0 && offset < decoded) {
+        Off blockStart = offset - offset % blockSize;
+        const auto &block = blocks.at(blockStart);
+        size_t blockOff = offset - blockStart;
+        size_t amount = std::min(Off(std::min(block.size() - blockOff, size)),
+                decoded - offset);
+        memcpy(data, &block[blockOff], amount);
+        size -= amount;
+        offset += amount;
+        data += amount;
+    }
+    return startSize - size;
+}
+
+Reader::Off
+Lz4Reader::size() const
+{
+    if (knownSize == Off(-1)) {
+        decodeTo(std::numeric_limits<Off>::max());
+        knownSize = decoded;
+    }
+    return knownSize;
+}
+
+void
+Lz4Reader::describe(std::ostream &os) const
+{
+    os << "lz4 compressed " << *upstream;
+}
+
+Lz4Reader::~Lz4Reader()
+{
+    LZ4F_freeDecompressionContext(ctx);
+}
+}
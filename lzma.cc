@@ -45,38 +45,57 @@ LzmaReader::size() const
     return lzma_index_uncompressed_size(index);
 }
 
+const std::vector<unsigned char> &
+LzmaReader::getBlock(Off offset, Off &blockStart) const
+{
+    // Reads tend to cluster in one block (eg, binary probes into the sorted
+    // .gnu_debugdata symbol table), so check the last block used before
+    // walking the index again.
+    if (lastBlock != nullptr && offset >= lastBlockStart && offset < lastBlockEnd) {
+        blockStart = lastBlockStart;
+        return *lastBlock;
+    }
+    lzma_index_iter iter{};
+    lzma_index_iter_init(&iter, index);
+    if (bool(lzma_index_iter_locate(&iter, offset)))
+        throw (Exception() << "can't locate offset " << offset << " in index");
+    auto &uncompressed = lzBlocks[iter.block.uncompressed_stream_offset];
+    if (uncompressed.empty()) {
+        std::vector<unsigned char>compressed(iter.block.total_size);
+        upstream->readObj(iter.block.compressed_file_offset, &compressed[0], compressed.size());
+        lzma_block block{};
+        lzma_filter filters[LZMA_FILTERS_MAX + 1];
+        block.filters = filters;
+        block.header_size = lzma_block_header_size_decode(compressed[0]);
+        int rc = lzma_block_header_decode(&block, allocator(), &compressed[0]);
+        if (rc != LZMA_OK)
+            throw (Exception() << "can't decode block header: " << rc);
+        uncompressed.resize(iter.block.uncompressed_size);
+        size_t compressed_pos = block.header_size;
+        size_t uncompressed_pos = 0;
+        rc = lzma_block_buffer_decode(&block, allocator(),
+                &compressed[0], &compressed_pos, compressed.size(),
+                &uncompressed[0], &uncompressed_pos, uncompressed.size());
+        for (auto i = 0;  block.filters[i].id != LZMA_VLI_UNKNOWN; ++i)
+            allocator()->free(allocator(), block.filters[i].options);
+        if ( rc != LZMA_OK)
+            throw (Exception() << "can't decode block buffer: " << rc);
+    }
+    blockStart = iter.block.uncompressed_stream_offset;
+    lastBlockStart = blockStart;
+    lastBlockEnd = blockStart + uncompressed.size();
+    lastBlock = &uncompressed;
+    return uncompressed;
+}
+
 size_t
 LzmaReader::read(Off offset, size_t size, char *data) const
 {
     size_t startSize = size;
     while (size != 0) {
-        lzma_index_iter iter{};
-        lzma_index_iter_init(&iter, index);
-        if (bool(lzma_index_iter_locate(&iter, offset)))
-            throw (Exception() << "can't locate offset " << offset << " in index");
-        auto &uncompressed = lzBlocks[iter.block.uncompressed_stream_offset];
-        if (uncompressed.empty()) {
-            std::vector<unsigned char>compressed(iter.block.total_size);
-            upstream->readObj(iter.block.compressed_file_offset, &compressed[0], compressed.size());
-            lzma_block block{};
-            lzma_filter filters[LZMA_FILTERS_MAX + 1];
-            block.filters = filters;
-            block.header_size = lzma_block_header_size_decode(compressed[0]);
-            int rc = lzma_block_header_decode(&block, allocator(), &compressed[0]);
-            if (rc != LZMA_OK)
-                throw (Exception() << "can't decode block header: " << rc);
-            uncompressed.resize(iter.block.uncompressed_size);
-            size_t compressed_pos = block.header_size;
-            size_t uncompressed_pos = 0;
-            rc = lzma_block_buffer_decode(&block, allocator(),
-                    &compressed[0], &compressed_pos, compressed.size(),
-                    &uncompressed[0], &uncompressed_pos, uncompressed.size());
-            for (auto i = 0;  block.filters[i].id != LZMA_VLI_UNKNOWN; ++i)
-                allocator()->free(allocator(), block.filters[i].options);
-            if ( rc != LZMA_OK)
-                throw (Exception() << "can't decode block buffer: " << rc);
-        }
-        size_t blockOff = offset - iter.block.uncompressed_stream_offset;
+        Off blockStart;
+        auto &uncompressed = getBlock(offset, blockStart);
+        size_t blockOff = offset - blockStart;
         auto amount = std::min(uncompressed.size() - blockOff, size);
         memcpy(data, &uncompressed[blockOff], amount);
         size -= amount;
@@ -47,12 +47,12 @@ ps_pglobal_lookup(struct ps_prochandle *ph, const char *ld_object_name,
 {
     auto p = static_cast<Process *>(ph);
     try {
-        *ld_symbol_addr = psaddr_t(intptr_t(p->resolveSymbol(ld_symbol_name, true,
-            [ld_object_name](std::string_view name) {
-                auto bn = basename(std::string(name));
-                return bn == ld_object_name || bn == "libc.so.6";
-            }
-            )));
+        // memoized on the Process - thread_db asks the same questions on
+        // every thread enumeration.
+        auto addr = p->globalLookup(ld_object_name, ld_symbol_name);
+        if (addr == 0)
+            return PS_ERR;
+        *ld_symbol_addr = psaddr_t(intptr_t(addr));
         return PS_OK;
     }
     catch (...) {
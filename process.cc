@@ -3,20 +3,34 @@
 #include <link.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <future>
 #include <iomanip>
+#include <sstream>
 #include <iostream>
 #include <limits>
 #include <set>
+#include <thread>
 #include <sys/ucontext.h>
 #include <sys/wait.h>
 #include <csignal>
 
 #include "libpstack/archreg.h"
 #include "libpstack/dwarf.h"
+#include "libpstack/fs.h"
 #include "libpstack/proc.h"
+#include "libpstack/stats.h"
 #include "libpstack/global.h"
 #include "libpstack/stringify.h"
 #include "libpstack/ioflag.h"
+#ifdef WITH_ZSTD
+#include "libpstack/zstdreader.h"
+#endif
+#ifdef WITH_LZ4
+#include "libpstack/lz4reader.h"
+#endif
 
 #if defined(__amd64__)
 #define BP(regs) (regs.rbp)
@@ -173,20 +187,22 @@ Process::load()
         throw (Exception() << "no executable image located for process");
 
     try {
-        Elf::Addr r_debug_addr = findRDebugAddr();
-        bool isStatic = r_debug_addr == 0 || r_debug_addr == Elf::Addr(-1);
+        rdebugAddr = findRDebugAddr();
+        bool isStatic = rdebugAddr == 0 || rdebugAddr == Elf::Addr(-1);
 
         if (isStatic)
             addElfObject("", execImage, 0);
         else
-            loadSharedObjects(r_debug_addr);
+            loadSharedObjects(rdebugAddr);
     }
     catch (const Exception &) {
         // We were unable to read the link map.
         // The primary cause is that the core file is truncated.
         // Go do the Hail Mary version.
-        if (loadSharedObjectsFromFileNote())
+        if (loadSharedObjectsFromFileNote()) {
+            prefetchDwarf();
             return;
+        }
         throw;
     }
 
@@ -199,7 +215,7 @@ Process::load()
                 *debug << "failed to load thread agent: " << the << std::endl;
         }
     }
-
+    prefetchDwarf();
 }
 
 Dwarf::Info::sptr
@@ -208,6 +224,48 @@ Process::getDwarf(Elf::Object::sptr elf) const
     return imageCache.getDwarf(elf);
 }
 
+/*
+ * Once the link map is walked we know every object an unwind can touch, so
+ * parse their frame and unit header data on a spare core while the main
+ * thread is stopping threads and capturing their registers. The ELF and
+ * DWARF caches are safe for concurrent readers, so the unwind either finds
+ * the data warm, or waits briefly on the lock of the object being parsed.
+ */
+void
+Process::prefetchDwarf()
+{
+    std::vector<MappedObject> snapshot;
+    {
+        std::lock_guard<std::mutex> guard(objectsLock);
+        for (auto &entry : objects)
+            snapshot.push_back(entry.second);
+    }
+    dwarfPrefetch = std::async(std::launch::async,
+          [this, snapshot = std::move(snapshot)] () mutable {
+        for (auto &mapped : snapshot) {
+            try {
+                // our copy of the MappedObject resolves its image privately -
+                // the real entry in "objects" caches it under objectsLock.
+                auto elf = mapped.object(imageCache);
+                if (elf == nullptr)
+                    continue;
+                auto info = getDwarf(elf);
+                if (info == nullptr)
+                    continue;
+                info->getCFI();
+                // just the unit headers: roots and DIEs still decode on demand.
+                for (const auto &unit : info->getUnits())
+                    (void)unit;
+            }
+            catch (const std::exception &ex) {
+                if (verbose >= 2)
+                    *debug << "DWARF prefetch for " << mapped.name()
+                        << " failed: " << ex.what() << "\n";
+            }
+        }
+    });
+}
+
 
 const char *
 auxtype2str(int auxtype) {
@@ -240,7 +298,7 @@ Process::processAUXV(const Reader &auxio)
                 }
                 case AT_SYSINFO_EHDR: {
                     try {
-                        auto elf = std::make_shared<Elf::Object>(imageCache, io->view("(vdso image)", hdr, 65536));
+                        auto elf = imageCache.getVdsoImage(*io->view("(vdso image)", hdr, 65536));
                         vdsoBase = hdr;
                         addElfObject("(vdso image)", elf, hdr);
                         vdsoImage = elf;
@@ -329,6 +387,7 @@ PrintableFrame::PrintableFrame(Process &proc, const StackFrame &frame)
     , functionOffset(std::numeric_limits<Elf::Addr>::max())
     , frame(frame)
 {
+    stats::Timer timer(stats::ph_symbolize);
     auto location = frame.scopeIP(proc);
 
     if (location.elf() == nullptr)
@@ -352,13 +411,11 @@ PrintableFrame::PrintableFrame(Process &proc, const StackFrame &frame)
                     // below in the ELF fallback code.
                 }
             }
-            while (function) {
-                auto inl = function.findEntryForAddr(objIp, Dwarf::DW_TAG_inlined_subroutine);
-                if (!inl)
-                    break;
-                inlined.push_back(inl);
-                function = std::move(inl);
-            }
+            // Expand the inline call chain. The unit caches it per address,
+            // so repeated snapshots of hot functions don't re-walk the tree.
+            const auto &unit = function.getUnit();
+            for (auto off : unit->inlineChain(objIp, function))
+                inlined.push_back(unit->offsetToDIE(Dwarf::DIE(), off));
         }
     }
     if (functionOffset == std::numeric_limits<Elf::Addr>::max()) {
@@ -384,10 +441,13 @@ struct RemoteValue {
     const Process &p;
     const Elf::Addr addr;
     const Dwarf::DIE type;
-    RemoteValue(const Process &p_, Elf::Addr addr_, Dwarf::DIE type_)
+    const std::vector<char> *pre; // content already fetched by a vectored read, if any.
+    RemoteValue(const Process &p_, Elf::Addr addr_, Dwarf::DIE type_,
+          const std::vector<char> *pre_ = nullptr)
         : p(p_)
         , addr(addr_)
         , type(type_)
+        , pre(pre_)
     {}
 };
 
@@ -436,11 +496,15 @@ operator << (std::ostream &os, const RemoteValue &rv)
     auto sizeAttr = type.attribute(DW_AT_byte_size);
     if (sizeAttr.valid()) {
         size = uintmax_t(sizeAttr);
-        buf.resize(size);
-        auto rc = rv.p.io->read(rv.addr, size, &buf[0]);
-        if (rc != size) {
-            return os << "<error reading " << size << " bytes from " << rv.addr
-               << ", got " << rc << ">";
+        if (rv.pre != nullptr && rv.pre->size() == size) {
+            buf = *rv.pre;
+        } else {
+            buf.resize(size);
+            auto rc = rv.p.io->read(rv.addr, size, &buf[0]);
+            if (rc != size) {
+                return os << "<error reading " << size << " bytes from " << rv.addr
+                   << ", got " << rc << ">";
+            }
         }
     } else {
        size = 0;
@@ -564,42 +628,96 @@ operator << (std::ostream &os, const ArgPrint &ap)
     if (!location.die() || !ap.p.options.doargs)
         return os;
     using namespace Dwarf;
-    const char *sep = "";
+
+    // Resolve each parameter's location first, so the memory-resident values
+    // can all be fetched with one vectored read - issuing a separate target
+    // read per argument costs a round trip each.
+    struct Arg {
+        DIE child;
+        DIE type;
+        Elf::Addr addr = 0;
+        bool haveLoc = false;
+        bool isValue = false;
+        int inReg = 0;
+        std::string evalError;
+        std::vector<char> buf;
+        bool prefetched = false;
+    };
+    std::vector<Arg> args;
     for (auto child : location.die().children()) {
-        switch (child.tag()) {
-            case DW_TAG_formal_parameter: {
-                auto name = child.name();
-                auto type = DIE(child.attribute(DW_AT_type));
-                Elf::Addr addr = 0;
-                os << sep << name;
-                if (type) {
-                    auto attr = child.attribute(Dwarf::DW_AT_location);
-
-                    if (attr.valid()) {
-                        ExpressionStack fbstack;
-                        addr = fbstack.eval(ap.p, attr, &ap.frame, location.elfReloc());
-                        os << "=";
-                        try {
-                           if (fbstack.isValue)
-                              os << ProcPtr(ap.p, type, addr) << "{r" << fbstack.inReg << "}"; // note the value may be in *multiple* registers.
-                           else
-                              os << RemoteValue(ap.p, addr, type);
-                        }
-                        catch (const Exception &ex) {
-                           os << "<" << ex.what() << ">";
-                        }
-                    } else {
-                        auto constVal = child.attribute(Dwarf::DW_AT_const_value);
-                        if (constVal.valid())
-                            os << "=" << intmax_t(constVal);
-                    }
+        if (child.tag() != DW_TAG_formal_parameter)
+            continue;
+        Arg arg;
+        arg.child = child;
+        arg.type = DIE(child.attribute(DW_AT_type));
+        if (arg.type) {
+            auto attr = child.attribute(Dwarf::DW_AT_location);
+            if (attr.valid()) {
+                arg.haveLoc = true;
+                ExpressionStack fbstack;
+                try {
+                    arg.addr = fbstack.eval(ap.p, attr, &ap.frame, location.elfReloc());
+                    arg.isValue = fbstack.isValue;
+                    arg.inReg = fbstack.inReg;
+                }
+                catch (const Exception &ex) {
+                    arg.evalError = ex.what();
                 }
-                sep = ", ";
-                break;
             }
-            default:
-                break;
         }
+        args.push_back(std::move(arg));
+    }
+
+    std::vector<Reader::ReadRange> ranges;
+    std::vector<Arg *> fetched;
+    for (auto &arg : args) {
+        if (!arg.haveLoc || arg.isValue || arg.evalError != "" || arg.addr == 0)
+            continue;
+        // strip qualifiers the same way the value printer does, so the sizes
+        // line up with what it will want.
+        auto type = arg.type;
+        while (type.tag() == DW_TAG_typedef || type.tag() == DW_TAG_const_type)
+            type = DIE(type.attribute(DW_AT_type));
+        auto sizeAttr = type.attribute(DW_AT_byte_size);
+        if (!sizeAttr.valid())
+            continue;
+        arg.buf.resize(uintmax_t(sizeAttr));
+        ranges.push_back({ Reader::Off(arg.addr), arg.buf.size(), arg.buf.data() });
+        fetched.push_back(&arg);
+    }
+    if (!ranges.empty()) {
+        ap.p.io->readv(ranges);
+        for (size_t i = 0; i < ranges.size(); ++i)
+            // short reads fall back to an individual read, which reports the
+            // failure in the output.
+            fetched[i]->prefetched = ranges[i].got == fetched[i]->buf.size();
+    }
+
+    const char *sep = "";
+    for (auto &arg : args) {
+        os << sep << arg.child.name();
+        if (arg.type) {
+            if (arg.evalError != "") {
+                os << "=<" << arg.evalError << ">";
+            } else if (arg.haveLoc) {
+                os << "=";
+                try {
+                    if (arg.isValue)
+                        os << ProcPtr(ap.p, arg.type, arg.addr) << "{r" << arg.inReg << "}"; // note the value may be in *multiple* registers.
+                    else
+                        os << RemoteValue(ap.p, arg.addr, arg.type,
+                              arg.prefetched ? &arg.buf : nullptr);
+                }
+                catch (const Exception &ex) {
+                    os << "<" << ex.what() << ">";
+                }
+            } else {
+                auto constVal = arg.child.attribute(Dwarf::DW_AT_const_value);
+                if (constVal.valid())
+                    os << "=" << intmax_t(constVal);
+            }
+        }
+        sep = ", ";
     }
     return os;
 }
@@ -702,7 +820,12 @@ Process::dumpFrameText(std::ostream &os, const StackFrame &frame, int frameNo)
         if (src.first != "")
            os << " at " << src.first << ":" << std::dec << src.second;
     } else {
-        os << " no information for frame";
+        auto jit = findJitSymbol(frame.rawIP());
+        if (jit != nullptr)
+            os << " in " << jit->name << "()+" << frame.rawIP() - jit->start
+                << " [JIT]";
+        else
+            os << " no information for frame";
     }
     if (verbose)
        os << " via " << frame.mechanism;
@@ -714,6 +837,7 @@ void
 Process::addElfObject(std::string_view name, const Elf::Object::sptr &obj, Elf::Addr load)
 {
     objects.emplace(std::make_pair(load, MappedObject{ name, obj }));
+    lastHole = { 1, 0 }; // the new mapping may fall inside a cached miss.
     if (verbose >= 2) {
         IOFlagSave _(*debug);
         *debug << "object " << name << " loaded at address "
@@ -721,6 +845,104 @@ Process::addElfObject(std::string_view name, const Elf::Object::sptr &obj, Elf::
     }
 }
 
+/*
+ * JITs that cooperate with perf publish symbols for their generated code in
+ * one of two ways: text lines of "start size name" in /tmp/perf-<pid>.map,
+ * or a binary jitdump file that the runtime keeps mapped into its address
+ * space precisely so tools can discover it. Load both once into a single
+ * sorted table - frames that fall outside every ELF object are then looked
+ * up here before we declare them unknown.
+ */
+void
+Process::loadJitSymbols()
+{
+    jitSymbolsLoaded = true;
+
+    std::ifstream mapFile(stringify("/tmp/perf-", getPID(), ".map"));
+    for (std::string line; std::getline(mapFile, line); ) {
+        std::istringstream ls(line);
+        Elf::Addr start, size;
+        std::string name;
+        ls >> std::hex >> start >> size;
+        std::getline(ls >> std::ws, name);
+        if (!ls.fail() && name != "")
+            jitSymbols.push_back({start, start + size, name});
+    }
+
+    for (const auto &range : addressSpace()) {
+        const auto &path = range.backing.path;
+        auto base = path.rfind('/');
+        auto file = base == std::string::npos ? path : path.substr(base + 1);
+        if (file.compare(0, 4, "jit-") != 0 ||
+                file.compare(file.size() > 5 ? file.size() - 5 : 0, 5, ".dump") != 0)
+            continue;
+        try {
+            auto io = loadFile(path);
+            struct {
+                uint32_t magic;
+                uint32_t version;
+                uint32_t totalSize;
+                uint32_t elfMach;
+                uint32_t pad1;
+                uint32_t pid;
+                uint64_t timestamp;
+                uint64_t flags;
+            } header;
+            io->readObj(0, &header);
+            if (header.magic != 0x4A695444) // "JiTD"
+                continue;
+            struct {
+                uint32_t id;
+                uint32_t totalSize;
+                uint64_t timestamp;
+            } rec;
+            for (Reader::Off off = header.totalSize;
+                    io->read(off, sizeof rec, reinterpret_cast<char *>(&rec)) == sizeof rec
+                        && rec.totalSize >= sizeof rec;
+                    off += rec.totalSize) {
+                if (rec.id != 0) // JIT_CODE_LOAD
+                    continue;
+                struct {
+                    uint32_t pid;
+                    uint32_t tid;
+                    uint64_t vma;
+                    uint64_t codeAddr;
+                    uint64_t codeSize;
+                    uint64_t codeIndex;
+                } load;
+                io->readObj(off + sizeof rec, &load);
+                auto name = io->readString(off + sizeof rec + sizeof load);
+                jitSymbols.push_back({Elf::Addr(load.codeAddr),
+                        Elf::Addr(load.codeAddr + load.codeSize), name});
+            }
+        }
+        catch (const std::exception &ex) {
+            if (verbose > 0)
+                *debug << "failed to read jitdump " << path << ": " << ex.what() << "\n";
+        }
+    }
+    // A method re-JITted at the same address supersedes the old code: sorting
+    // stably and preferring the later entry on lookup handles that.
+    std::stable_sort(jitSymbols.begin(), jitSymbols.end(),
+            [](const JitSymbol &l, const JitSymbol &r) { return l.start < r.start; });
+    if (verbose > 0 && !jitSymbols.empty())
+        *debug << "loaded " << jitSymbols.size() << " JIT symbols for process "
+            << getPID() << "\n";
+}
+
+const Process::JitSymbol *
+Process::findJitSymbol(Elf::Addr addr)
+{
+    if (!jitSymbolsLoaded)
+        loadJitSymbols();
+    auto it = std::upper_bound(jitSymbols.begin(), jitSymbols.end(), addr,
+            [](Elf::Addr addr, const JitSymbol &sym) { return addr < sym.start; });
+    if (it == jitSymbols.begin())
+        return nullptr;
+    --it; // among entries sharing a start, this is the most recent.
+    return addr < it->end ? &*it : nullptr;
+}
+
 /*
  * Grovel through the rtld's internals to find any shared libraries.
  */
@@ -769,6 +991,99 @@ Process::loadSharedObjects(Elf::Addr rdebugAddr)
             continue;
         }
     }
+
+#ifdef WITH_DEBUGINFOD
+    // Start background debug info downloads for everything we just mapped,
+    // so network latency overlaps with unwinding rather than serializing in
+    // front of it.
+    if (getenv("DEBUGINFOD_URLS") != nullptr) {
+        std::vector<std::string> buildIDs;
+        for (auto &[addr, mapped] : objects) {
+            try {
+                auto id = mapped.object(imageCache)->buildID();
+                if (id != "")
+                    buildIDs.push_back(id);
+            }
+            catch (const std::exception &ex) {
+                continue;
+            }
+        }
+        imageCache.prefetchDebugImages(buildIDs);
+    }
+#endif
+}
+
+/*
+ * Bring "objects" back in sync with the target's link map. The walk of the
+ * map is the cheap part - what we avoid is re-opening and re-parsing ELF and
+ * DWARF for objects that are still mapped, which is almost all of them on
+ * any given sample. The per-address caches derived from the mapping are only
+ * invalidated if a dlopen or dlclose actually changed it.
+ */
+void
+Process::reload()
+{
+    if (rdebugAddr == 0 || rdebugAddr == Elf::Addr(-1))
+        return; // statically linked: the object list can't change.
+
+    StopProcess here(this);
+    struct r_debug rDebug;
+    io->readObj(rdebugAddr, &rDebug);
+
+    // Gather the current link map, keyed the same way as "objects".
+    std::map<Elf::Addr, std::string> current;
+    struct link_map map;
+    for (auto mapAddr = Elf::Addr(rDebug.r_map); mapAddr != 0; mapAddr = Elf::Addr(map.l_next)) {
+        io->readObj(mapAddr, &map);
+        if (mapAddr == Elf::Addr(rDebug.r_map)) {
+            current[map.l_addr] = "(exe)";
+        } else if (map.l_addr != vdsoBase && map.l_name != 0) {
+            std::string path = io->readString(Elf::Off(map.l_name));
+            if (path != "")
+                current[map.l_addr] = path;
+        }
+    }
+
+    bool changed = false;
+    {
+        std::lock_guard<std::mutex> guard(objectsLock);
+        for (auto it = objects.begin(); it != objects.end(); ) {
+            if (it->first != vdsoBase && current.find(it->first) == current.end()) {
+                if (verbose >= 2)
+                    *debug << "dropping dlclose'd object " << it->second.name() << "\n";
+                it = objects.erase(it);
+                changed = true;
+            } else {
+                ++it;
+            }
+        }
+        for (auto &[addr, path] : current) {
+            if (objects.find(addr) != objects.end())
+                continue;
+            changed = true;
+            try {
+                addElfObject(path, path == "(exe)" ? execImage : nullptr, addr);
+            }
+            catch (const std::exception &e) {
+                if (debug)
+                    *debug << "warning: can't load text for '" << path << "' at "
+                        << (void *)addr << ": " << e.what() << "\n";
+            }
+        }
+        if (changed) {
+            lastSegment = {};
+            lastHole = { 1, 0 };
+        }
+    }
+    if (changed) {
+        {
+            std::lock_guard<std::mutex> guard(locationsLock);
+            codeLocations.clear();
+        }
+        std::lock_guard<std::mutex> guard(symbolsLock);
+        symbolCache.clear();
+        globalLookups.clear();
+    }
 }
 
 Elf::Addr
@@ -809,19 +1124,84 @@ Process::findRDebugAddr()
     return 0;
 }
 
+/*
+ * Resolve a symbol for libthread_db's ps_pglobal_lookup callback, memoized
+ * on the Process. The underlying search is bounded by the symbol cache, but
+ * thread_db also probes for symbols its target library simply doesn't have,
+ * and repeats the whole sequence on every enumeration - so record misses
+ * here as well, as address 0.
+ */
+Elf::Addr
+Process::globalLookup(const char *objectName, const char *symbolName)
+{
+    auto key = std::make_pair(std::string(objectName), std::string(symbolName));
+    {
+        std::lock_guard<std::mutex> guard(symbolsLock);
+        auto it = globalLookups.find(key);
+        if (it != globalLookups.end())
+            return it->second;
+    }
+    Elf::Addr addr = 0;
+    try {
+        addr = resolveSymbol(symbolName, true,
+            [objectName](std::string_view name) {
+                auto bn = basename(std::string(name));
+                return bn == objectName || bn == "libc.so.6";
+            });
+    }
+    catch (const std::exception &) {
+        // fall through with 0 - the miss is worth remembering, too.
+    }
+    std::lock_guard<std::mutex> guard(symbolsLock);
+    return globalLookups.emplace(std::move(key), addr).first->second;
+}
+
 std::tuple<Elf::Addr, Elf::Object::sptr, const Elf::Phdr *>
 Process::findSegment(Elf::Addr addr)
 {
-    auto it = objects.lower_bound(addr);
-    if (it != objects.begin()) {
-       --it;
+    std::lock_guard<std::mutex> guard(objectsLock);
+
+    // Scans (canal chasing references, sequential core reads) resolve runs of
+    // addresses from the same mapping - check the previous hit before
+    // searching, like Elf::Object does for its segments.
+    {
+        const auto &[lastAddr, lastObj, lastPhdr] = lastSegment;
+        if (lastObj != nullptr) {
+            Elf::Addr off = addr - lastAddr;
+            if (lastPhdr->p_vaddr <= off && off < lastPhdr->p_vaddr + lastPhdr->p_memsz)
+                return lastSegment;
+        }
+    }
+
+    // Misses cluster the same way - a scan walking a gap between mappings
+    // probes the same hole over and over, and each probe otherwise goes back
+    // through the image cache. Remember the last hole we derived.
+    if (addr >= lastHole.first && addr < lastHole.second)
+        return std::tuple<Elf::Addr, Elf::Object::sptr, const Elf::Phdr *>();
+
+    auto next = objects.lower_bound(addr);
+    Elf::Addr holeStart = addr;
+    Elf::Addr holeEnd = next == objects.end()
+        ? std::numeric_limits<Elf::Addr>::max()
+        : next->first;
+    if (next != objects.begin()) {
+       auto it = std::prev(next);
        auto obj = it->second.object(imageCache);
        if (it->first + obj->endVA() >= addr) {
            auto segment = obj->getSegmentForAddress(addr - it->first);
-           if (segment)
-               return std::make_tuple(it->first, obj, segment);
+           if (segment) {
+               lastSegment = std::make_tuple(it->first, obj, segment);
+               return lastSegment;
+           }
+           // Inside the object's span, but between its segments: punt on
+           // working out the extent of the gap, and just fail this address.
+           holeEnd = holeStart;
+       } else {
+           holeStart = it->first + obj->endVA();
        }
     }
+    if (holeStart < holeEnd)
+        lastHole = std::make_pair(holeStart, holeEnd);
     return std::tuple<Elf::Addr, Elf::Object::sptr, const Elf::Phdr *>();
 }
 
@@ -829,22 +1209,70 @@ std::tuple<Elf::Object::sptr, Elf::Addr, Elf::Sym>
 Process::resolveSymbolDetail(const char *name, bool includeDebug,
         std::function<bool(std::string_view)> match)
 {
+    // Resolutions repeat - thread_db asks for the same handful of symbols on
+    // every enumeration, and repeat mode re-resolves each sample - so
+    // remember past hits. A cached entry is only usable if the caller's
+    // object filter accepts the object we found it in; otherwise scan again.
+    auto key = std::make_pair(std::string(name), includeDebug);
+    {
+        std::lock_guard<std::mutex> guard(symbolsLock);
+        auto it = symbolCache.find(key);
+        if (it != symbolCache.end() && match(std::get<0>(it->second)))
+            return std::make_tuple(std::get<1>(it->second),
+                    std::get<2>(it->second), std::get<3>(it->second));
+    }
     for (auto &loaded : objects) {
         if (!match(loaded.second.name()))
            continue;
         auto obj = loaded.second.object(imageCache);
         auto [sym,idx] = obj->findDynamicSymbol(name);
-        if (sym.st_shndx != SHN_UNDEF)
+        bool found = sym.st_shndx != SHN_UNDEF;
+        if (!found && includeDebug) {
+           auto [dsym, didx] = obj->findDebugSymbol(name);
+           sym = dsym;
+           found = sym.st_shndx != SHN_UNDEF;
+        }
+        if (found) {
+           std::lock_guard<std::mutex> guard(symbolsLock);
+           symbolCache[key] = std::make_tuple(
+                   loaded.second.name(), obj, loaded.first, sym);
            return std::make_tuple(obj, loaded.first, sym);
-        if (includeDebug) {
-           auto [sym, idx] = loaded.second.object(imageCache)->findDebugSymbol(name);
-           if (sym.st_shndx != SHN_UNDEF)
-              return std::make_tuple(obj, loaded.first, sym);
         }
     }
     throw (Exception() << "symbol " << name << " not found");
 }
 
+std::map<std::string, std::tuple<Elf::Object::sptr, Elf::Addr, Elf::Sym>>
+Process::resolveSymbolsDetail(const std::vector<std::string> &names, bool includeDebug,
+        std::function<bool(std::string_view)> match)
+{
+    std::map<std::string, std::tuple<Elf::Object::sptr, Elf::Addr, Elf::Sym>> rv;
+    std::vector<std::string> outstanding = names;
+    for (auto &loaded : objects) {
+        if (outstanding.empty())
+            break;
+        if (!match(loaded.second.name()))
+           continue;
+        auto obj = loaded.second.object(imageCache);
+        for (const auto &[name, hit] : obj->findDynamicSymbols(outstanding))
+            rv[name] = std::make_tuple(obj, loaded.first, hit.first);
+        if (includeDebug) {
+            for (const auto &name : outstanding) {
+                if (rv.find(name) != rv.end())
+                    continue;
+                auto [sym, idx] = obj->findDebugSymbol(name);
+                if (sym.st_shndx != SHN_UNDEF)
+                    rv[name] = std::make_tuple(obj, loaded.first, sym);
+            }
+        }
+        outstanding.erase(
+                std::remove_if(outstanding.begin(), outstanding.end(),
+                    [&rv] (const std::string &name) { return rv.find(name) != rv.end(); }),
+                outstanding.end());
+    }
+    return rv;
+}
+
 Elf::Addr
 Process::resolveSymbol(const char *name, bool includeDebug,
         std::function<bool(std::string_view)> match)
@@ -856,9 +1284,11 @@ Process::resolveSymbol(const char *name, bool includeDebug,
 
 Process::~Process()
 {
-    // don't leave the VDSO in the cache - a new copy will be entered for a new
-    // process.
-    imageCache.flush(vdsoImage);
+    // the prefetch task captures "this" - it must not outlive us.
+    if (dwarfPrefetch.valid())
+        dwarfPrefetch.wait();
+    // The vDSO stays in the cache: it's keyed by content, backed by our own
+    // copy of the image, and shared with every other process on the host.
     td_ta_delete(agent);
 }
 
@@ -889,6 +1319,42 @@ ThreadStack::unwind(Process &p, Elf::CoreRegisters &regs)
         for (int frameCount = 0; frameCount < p.options.maxframes; frameCount++) {
             auto &prev = stack.back();
 
+#if defined(__amd64__) || defined(__i386__)
+            // Fast mode: chase the frame-pointer chain while it looks sane,
+            // and only pay for DWARF unwinding when it breaks. Same recovery
+            // as the frame-pointer fallback below, but tried first.
+            if (p.options.fast && prev.rawIP() != 0) {
+                try {
+                    Elf::Addr oldBp = BP(prev.regs);
+                    if (oldBp == 0)
+                        break; // end of the chain.
+                    Elf::Addr newBp, newIp;
+                    if (oldBp > SP(prev.regs) &&
+                            p.io->read(oldBp + ELF_BYTES, sizeof newIp, (char *)&newIp) == sizeof newIp &&
+                            p.io->read(oldBp, sizeof newBp, (char *)&newBp) == sizeof newBp &&
+                            newBp > oldBp && newIp > 4096) {
+                        // insist the return address lands in executable text -
+                        // the numeric checks alone pass for junk on stacks of
+                        // binaries without frame pointers.
+                        auto [reloc, obj, phdr] = p.findSegment(newIp);
+                        (void)reloc;
+                        if (obj != nullptr && phdr != nullptr && (phdr->p_flags & PF_X) != 0) {
+                            Elf::CoreRegisters newRegs = prev.regs;
+                            SP(newRegs) = oldBp + ELF_BYTES * 2;
+                            BP(newRegs) = newBp;
+                            IP(newRegs) = newIp;
+                            stack.emplace_back(UnwindMechanism::FRAMEPOINTER, newRegs);
+                            stack.back().cfa = newBp;
+                            continue;
+                        }
+                    }
+                }
+                catch (const std::exception &ex) {
+                    // can't read the chain - let DWARF have a go.
+                }
+            }
+#endif
+
             try {
                 auto maybeNewRegs = prev.unwind(p);
                 if (!maybeNewRegs)
@@ -964,14 +1430,16 @@ ThreadStack::unwind(Process &p, Elf::CoreRegisters &regs)
                        siginfo_t si;
                        ucontext_t uc;
                     };
-                    auto sigframe = p.io->readObj<rt_sigframe>(prev.regs.sp);
-                    Elf::CoreRegisters newRegs;
-                    for (int i = 0; i < 31; ++i)
-                       newRegs.regs[i] = sigframe.uc.uc_mcontext.regs[i];
-                    newRegs.sp = sigframe.uc.uc_mcontext.sp;
-                    newRegs.pc = sigframe.uc.uc_mcontext.pc;
-                    stack.emplace_back(UnwindMechanism::TRAMPOLINE, newRegs);
-                    continue;
+                    rt_sigframe sigframe;
+                    if (p.io->tryReadObj(prev.regs.sp, &sigframe)) {
+                        Elf::CoreRegisters newRegs;
+                        for (int i = 0; i < 31; ++i)
+                           newRegs.regs[i] = sigframe.uc.uc_mcontext.regs[i];
+                        newRegs.sp = sigframe.uc.uc_mcontext.sp;
+                        newRegs.pc = sigframe.uc.uc_mcontext.pc;
+                        stack.emplace_back(UnwindMechanism::TRAMPOLINE, newRegs);
+                        continue;
+                    }
                 }
 
 #elif defined(__i386__)
@@ -990,17 +1458,21 @@ ThreadStack::unwind(Process &p, Elf::CoreRegisters &regs)
                         sigContextAddr = SP(prev.regs) + 4;
                     else {
                         auto [restoreRtSym,idx] = obj->findDebugSymbol("__restore_rt");
-                        if (restoreRtSym.st_shndx != SHN_UNDEF && objip == restoreRtSym.st_value)
-                            sigContextAddr = p.io->readObj<Elf::Addr>(SP(prev.regs) + 8) + 20;
+                        if (restoreRtSym.st_shndx != SHN_UNDEF && objip == restoreRtSym.st_value) {
+                            Elf::Addr ctx;
+                            if (p.io->tryReadObj(SP(prev.regs) + 8, &ctx))
+                                sigContextAddr = ctx + 20;
+                        }
                     }
                     if (sigContextAddr != 0) {
                        // This mapping is based on DWARF regnos, and ucontext.h
                        gregset_t regs;
-                       p.io->readObj(sigContextAddr, &regs);
-                       Elf::CoreRegisters core;
-                       gregset2core(core, regs);
-                       stack.emplace_back(UnwindMechanism::TRAMPOLINE, core);
-                       continue;
+                       if (p.io->tryReadObj(sigContextAddr, &regs)) {
+                          Elf::CoreRegisters core;
+                          gregset2core(core, regs);
+                          stack.emplace_back(UnwindMechanism::TRAMPOLINE, core);
+                          continue;
+                       }
                     }
                 }
 #endif
@@ -1021,9 +1493,10 @@ ThreadStack::unwind(Process &p, Elf::CoreRegisters &regs)
                       // null base pointer means we're done.
                       break;
                    }
-                   p.io->readObj(oldBp + ELF_BYTES, &newIp);
-                   p.io->readObj(oldBp, &newBp);
-                   if (newBp > oldBp && newIp > 4096) {
+                   // speculative - the frame pointer is often junk here.
+                   if (p.io->tryReadObj(oldBp + ELF_BYTES, &newIp) &&
+                         p.io->tryReadObj(oldBp, &newBp) &&
+                         newBp > oldBp && newIp > 4096) {
                        Elf::CoreRegisters newRegs = prev.regs;
                        SP(newRegs) = oldBp + ELF_BYTES * 2;
                        BP(newRegs) = newBp;
@@ -1056,10 +1529,43 @@ Process::load(Elf::Object::sptr exec, std::string id, const PstackOptions &optio
        else
           throw Exception() << "process " << pid << ": " << strerror(errno);
     } else {
-       // don't use imagecache for cores. We don't want to mmap them (they can
-       // be enormous, esp. from a leaky process), use loadFile and a caching
-       // reader on the underlying file instead.
-       auto core = std::make_shared<Elf::Object>(imageCache, loadFile(id));
+       // don't use imagecache for cores - we only ever open one, and don't
+       // want it competing for the cache's memory budget. Map it rather than
+       // buffering reads: CoreReader can then hand out zero-copy windows into
+       // segment content, so scanning the whole address space (eg, canal)
+       // becomes a pointer walk through the page cache. Skip the readahead
+       // hint - cores can be enormous, esp. from a leaky process, and most of
+       // the image is often never touched. If the mapping fails (eg, the core
+       // is on a filesystem that can't mmap), fall back to a caching reader
+       // on the underlying file.
+       Reader::csptr coreio;
+       try {
+          coreio = std::make_shared<MmapReader>(id, false);
+       } catch (const Exception &ex) {
+          if (verbose != 0)
+             *debug << "can't map core " << id << ": " << ex.what()
+                << ": falling back to file reader" << std::endl;
+          coreio = loadFile(id);
+       }
+       // systemd-coredump and friends leave cores compressed on disk. Sniff
+       // the magic, and decode in-process rather than making the user
+       // decompress tens of gigabytes to a temporary file first.
+       uint32_t magic = 0;
+       coreio->read(0, sizeof magic, reinterpret_cast<char *>(&magic));
+       if (magic == 0xfd2fb528) {
+#ifdef WITH_ZSTD
+          coreio = std::make_shared<ZstdReader>(std::move(coreio));
+#else
+          throw (Exception() << id << " is zstd compressed, and pstack was built without zstd support");
+#endif
+       } else if (magic == 0x184d2204) {
+#ifdef WITH_LZ4
+          coreio = std::make_shared<Lz4Reader>(std::move(coreio));
+#else
+          throw (Exception() << id << " is lz4 compressed, and pstack was built without lz4 support");
+#endif
+       }
+       auto core = std::make_shared<Elf::Object>(imageCache, std::move(coreio));
        if (core->getHeader().e_type != ET_CORE)
           return nullptr; // image is ELF, but not a core - just return null
        proc = std::make_shared<CoreProcess>(exec, core, options, imageCache);
@@ -1068,9 +1574,10 @@ Process::load(Elf::Object::sptr exec, std::string id, const PstackOptions &optio
     return proc;
 }
 
-std::list<ThreadStack>
+std::vector<ThreadStack>
 Process::getStacks() {
-    std::list<ThreadStack> threadStacks;
+    std::vector<ThreadStack> threadStacks;
+    std::vector<Elf::CoreRegisters> regsets; // parallel to threadStacks.
     std::set<pid_t> tracedLwps;
     StopProcess processSuspender(this);
 
@@ -1081,22 +1588,27 @@ Process::getStacks() {
      * threading systems where there is not a 1:1 correspondence between
      * userland pthreads and kernel LWPs
      */
-    listThreads([this, &threadStacks, &tracedLwps] (
-                       const td_thrhandle_t *thr) {
-        Elf::CoreRegisters regs;
-        td_err_e the;
+    // On 1:1 threading systems (ie, every extant Linux), the LWP enumeration
+    // below yields the same stacks - thread_db only contributes the pthread
+    // ids, at the cost of a burst of symbol lookups and target reads. Fast
+    // mode skips it and takes the LWPs directly.
+    if (agent != nullptr && !options.fast)
+        listThreads([&threadStacks, &regsets, &tracedLwps] (
+                           const td_thrhandle_t *thr) {
+            Elf::CoreRegisters regs;
+            td_err_e the;
 #ifdef __linux__
-        the = td_thr_getgregs(thr, (elf_greg_t *) &regs);
+            the = td_thr_getgregs(thr, (elf_greg_t *) &regs);
 #else
-        the = td_thr_getgregs(thr, &regs);
+            the = td_thr_getgregs(thr, &regs);
 #endif
-        if (the == TD_OK) {
-            threadStacks.push_back(ThreadStack());
-            td_thr_get_info(thr, &threadStacks.back().info);
-            threadStacks.back().unwind(*this, regs);
-            tracedLwps.insert(threadStacks.back().info.ti_lid);
-        }
-    });
+            if (the == TD_OK) {
+                threadStacks.push_back(ThreadStack());
+                td_thr_get_info(thr, &threadStacks.back().info);
+                regsets.push_back(regs);
+                tracedLwps.insert(threadStacks.back().info.ti_lid);
+            }
+        });
 
      /*
       * Now find LWPs, the kernel scheduled entities.  If we saw a thread above
@@ -1109,16 +1621,46 @@ Process::getStacks() {
       * There are no extant linux systems that I'm aware of that use a non-1:1
       * thread model, so we can't really test this.
       */
-    listLWPs([this, &threadStacks, &tracedLwps](lwpid_t lwpid) {
+    listLWPs([this, &threadStacks, &regsets, &tracedLwps](lwpid_t lwpid) {
         if (tracedLwps.find(lwpid) == tracedLwps.end()) {
             threadStacks.push_back(ThreadStack());
             threadStacks.back().info.ti_lid = lwpid;
             Elf::CoreRegisters regs;
             this->getRegset<Elf::CoreRegisters, NT_PRSTATUS>(lwpid,  regs);
-            threadStacks.back().unwind(*this, regs);
+            regsets.push_back(regs);
         }
     });
 
+    /*
+     * With all the register sets captured, each thread's unwind is
+     * independent, so spread the work over the available cores - the caches
+     * the unwinder touches (page cache, image caches, frame tables) are
+     * internally locked. This shrinks the time the target spends stopped
+     * roughly by the core count.
+     */
+    auto nthreads = std::min<size_t>(std::thread::hardware_concurrency(), threadStacks.size());
+    if (nthreads > 1) {
+        std::atomic<size_t> next { 0 };
+        std::vector<std::future<void>> work;
+        work.reserve(nthreads);
+        for (size_t t = 0; t < nthreads; ++t) {
+            work.push_back(std::async(std::launch::async, [&] {
+                for (;;) {
+                    size_t i = next++;
+                    if (i >= threadStacks.size())
+                        return;
+                    threadStacks[i].unwind(*this, regsets[i]);
+                }
+            }));
+        }
+        for (auto &w : work)
+            w.get();
+    } else {
+        size_t i = 0;
+        for (auto &ts : threadStacks)
+            ts.unwind(*this, regsets[i++]);
+    }
+
     /*
      * if we don't need to print arguments to functions, we now have the full
      * backtrace and don't need to read anything more from the process.
@@ -3,6 +3,8 @@
 #include "libpstack/global.h"
 #include "libpstack/proc.h"
 #include "libpstack/fs.h"
+#include "libpstack/stringify.h"
+#include "libpstack/stats.h"
 #if defined(WITH_PYTHON2) || defined(WITH_PYTHON3)
 #define WITH_PYTHON
 #include "libpstack/python.h"
@@ -18,8 +20,13 @@
 #include <csignal>
 #include <cassert>
 #include <algorithm>
+#include <atomic>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
 
 #define XSTR(a) #a
 #define STR(a) XSTR(a)
@@ -28,21 +35,298 @@ namespace {
 using namespace pstack;
 
 bool doJson = false;
+bool doBinary = false;
+bool doDedupe = false;
+bool doFolded = false;
+bool doDelta = false;
+std::string gcorePrefix;
+bool perfStats = false;
 bool freeres = 0; // free things on exit (for debugging/valgrind/heapcheck)
 volatile bool interrupted = false;
 
+/*
+ * Binary stack output, for collectors that would otherwise burn CPU
+ * parsing the text format. Everything is a length-prefixed record in host
+ * byte order: one type byte, a 32-bit payload length, then the payload.
+ * Strings (object paths, symbol and source file names) are interned -
+ * the first use emits an 's' record, assigning ids sequentially from 1,
+ * and later records carry the id; 0 means "none".
+ *
+ * record types and payloads:
+ *  'v': format version, u32.
+ *  's': string-table entry: the string itself.
+ *  'p': start of a sample of a process: u32 pid.
+ *  't': start of a thread within a sample: u64 tid, u32 lwp.
+ *  'f': frame: u64 ip, u32 object id, u64 offset of ip in object,
+ *       u32 symbol id, u64 offset of ip in symbol, u32 source file id,
+ *       u32 line number.
+ */
+class BinaryWriter {
+    std::ostream &os;
+    std::map<std::string, uint32_t> strings;
+
+    template <typename T> static void pack(std::string &buf, T value) {
+        buf.append(reinterpret_cast<const char *>(&value), sizeof value);
+    }
+    void record(char type, const std::string &payload) {
+        os.put(type);
+        uint32_t len = payload.size();
+        os.write(reinterpret_cast<const char *>(&len), sizeof len);
+        os.write(payload.data(), len);
+    }
+    uint32_t intern(const std::string &str) {
+        if (str == "")
+            return 0;
+        auto [it, fresh] = strings.emplace(str, strings.size() + 1);
+        if (fresh)
+            record('s', str);
+        return it->second;
+    }
+    void frame(Procman::Process &proc, const Procman::StackFrame &frame) {
+        std::string buf;
+        pack(buf, uint64_t(frame.rawIP()));
+        Procman::ProcessLocation location = frame.scopeIP(proc);
+        uint32_t objectId = 0, symbolId = 0, fileId = 0, line = 0;
+        uint64_t objOffset = 0, symOffset = 0;
+        if (location.inObject()) {
+            objectId = intern(stringify(*location.elf()->io));
+            objOffset = location.objLocation();
+            auto sym = location.symbol();
+            if (sym) {
+                symbolId = intern(sym->second);
+                symOffset = location.objLocation() - sym->first.st_value;
+            }
+            if (!proc.options.nosrc) {
+                auto source = location.source();
+                if (!source.empty()) {
+                    fileId = intern(source[0].first);
+                    line = source[0].second;
+                }
+            }
+        }
+        pack(buf, objectId);
+        pack(buf, objOffset);
+        pack(buf, symbolId);
+        pack(buf, symOffset);
+        pack(buf, fileId);
+        pack(buf, line);
+        record('f', buf);
+    }
+public:
+    BinaryWriter(std::ostream &os_) : os(os_) {
+        std::string buf;
+        pack(buf, uint32_t(1));
+        record('v', buf);
+    }
+    void sample(Procman::Process &proc, const std::vector<Procman::ThreadStack> &stacks) {
+        std::string buf;
+        pack(buf, uint32_t(proc.getPID()));
+        record('p', buf);
+        for (auto &thread : stacks) {
+            buf.clear();
+            pack(buf, uint64_t(thread.info.ti_tid));
+            pack(buf, uint32_t(thread.info.ti_lid));
+            record('t', buf);
+            for (auto &f : thread.stack)
+                frame(proc, f);
+        }
+        os.flush();
+    }
+};
+
+/*
+ * Folded-stack accumulation for flamegraphs. Rather than dumping a full
+ * trace per sample and collapsing the text afterwards, stacks are folded
+ * as they are captured: each frame is symbolized once per unique IP and
+ * interned as a small integer, and each root-to-leaf path of ids is a
+ * key in a count map. At exit we emit one "main;a;b 42" line per unique
+ * stack - the format flamegraph.pl consumes directly.
+ */
+class FoldedWriter {
+    std::ostream &os;
+    std::vector<std::string> names; // interned frame names, indexed by id.
+    std::map<std::string, uint32_t> ids;
+    // Symbolization cache. IPs are stable over the repeat loop for a given
+    // process, so each unique address is resolved to a name exactly once.
+    std::map<Elf::Addr, uint32_t> byIP;
+    std::map<std::vector<uint32_t>, uintmax_t> counts;
+
+    uint32_t intern(const std::string &name) {
+        auto [it, fresh] = ids.emplace(name, names.size());
+        if (fresh)
+            names.push_back(name);
+        return it->second;
+    }
+    uint32_t frameId(Procman::Process &proc, const Procman::StackFrame &frame) {
+        auto [it, fresh] = byIP.emplace(frame.rawIP(), 0);
+        if (fresh) {
+            Procman::ProcessLocation location = frame.scopeIP(proc);
+            std::string name = "[unknown]";
+            if (location.inObject()) {
+                auto sym = location.symbol();
+                // fall back to the object name for stripped code, so the
+                // frame still attributes to the right library.
+                name = sym ? sym->second : stringify(*location.elf()->io);
+            }
+            it->second = intern(name);
+        }
+        return it->second;
+    }
+public:
+    FoldedWriter(std::ostream &os_) : os(os_) {}
+    void sample(Procman::Process &proc, const std::vector<Procman::ThreadStack> &stacks) {
+        for (auto &thread : stacks) {
+            std::vector<uint32_t> path;
+            path.reserve(thread.stack.size());
+            // folded format is root-first; our stacks are leaf-first.
+            for (auto i = thread.stack.rbegin(); i != thread.stack.rend(); ++i)
+                path.push_back(frameId(proc, *i));
+            ++counts[path];
+        }
+    }
+    ~FoldedWriter() {
+        for (const auto &[path, count] : counts) {
+            const char *sep = "";
+            for (auto id : path) {
+                os << sep << names[id];
+                sep = ";";
+            }
+            os << " " << count << "\n";
+        }
+        os.flush();
+    }
+};
+
+/*
+ * Delta output for the repeat loop: between two samples of a healthy
+ * service, most threads are parked exactly where they were, so emit only
+ * the threads whose stack changed since the previous iteration, with a
+ * periodic full keyframe so a collector can join the stream late. Threads
+ * are compared by a hash of their raw PC vector - the same key the dedup
+ * mode groups by - so an unchanged thread is never even symbolized.
+ */
+class DeltaWriter {
+    // every this many samples, emit the full trace regardless.
+    static constexpr uintmax_t keyframeInterval = 60;
+    pid_t pid = -1;
+    uintmax_t iteration = 0;
+    // (tid, lwp) -> hash of the previous sample's PC vector.
+    std::map<std::pair<uint64_t, uint32_t>, size_t> previous;
+public:
+    void sample(Procman::Process &proc, const std::vector<Procman::ThreadStack> &stacks) {
+        if (proc.getPID() != pid) {
+            // targets run their repeat loops serially - reset for a new one.
+            pid = proc.getPID();
+            iteration = 0;
+            previous.clear();
+        }
+        bool keyframe = iteration++ % keyframeInterval == 0;
+        std::map<std::pair<uint64_t, uint32_t>, size_t> current;
+        std::vector<const Procman::ThreadStack *> changed;
+        for (auto &s : stacks) {
+            size_t h = 0;
+            for (auto &frame : s.stack)
+                h = h * 131 + std::hash<Elf::Addr>()(frame.rawIP());
+            auto key = std::make_pair(uint64_t(s.info.ti_tid), uint32_t(s.info.ti_lid));
+            current.emplace(key, h);
+            auto it = previous.find(key);
+            if (keyframe || it == previous.end() || it->second != h)
+                changed.push_back(&s);
+        }
+        // exited threads simply stop appearing; a reader resynchronizes its
+        // idea of the thread set at each keyframe.
+        previous = std::move(current);
+        OutputBuffer buffered(*proc.options.output);
+        std::ostream bufos(&buffered);
+        bufos << "process: " << *proc.io;
+        if (!keyframe)
+            bufos << " (delta: " << changed.size() << " of "
+                << stacks.size() << " threads changed)";
+        bufos << "\n";
+        for (auto s : changed) {
+            proc.dumpStackText(bufos, *s);
+            bufos << "\n";
+        }
+    }
+};
+
 void
 pstack(Procman::Process &proc)
 {
+    std::unique_ptr<stats::Timer> phase;
+    if (perfStats)
+        phase = std::make_unique<stats::Timer>(stats::ph_unwind);
     const auto &threadStacks = proc.getStacks();
+    if (perfStats)
+        phase = std::make_unique<stats::Timer>(stats::ph_print);
     auto &os = *proc.options.output;
-    if (doJson) {
-        os << json(threadStacks, &proc);
+    if (doFolded) {
+        // keep the writer across the repeat loop - samples accumulate into
+        // its count map, and the folded lines are emitted when it is torn
+        // down at exit.
+        static FoldedWriter writer(os);
+        writer.sample(proc, threadStacks);
+    } else if (doBinary) {
+        // keep the writer, and with it the string table, across the repeat
+        // loop and multiple processes: strings are emitted only once.
+        static BinaryWriter writer(os);
+        writer.sample(proc, threadStacks);
+    } else if (doDelta) {
+        // keep the writer across the repeat loop - it holds the previous
+        // sample's per-thread hashes.
+        static DeltaWriter writer;
+        writer.sample(proc, threadStacks);
+    } else if (doJson) {
+        OutputBuffer buffered(os);
+        std::ostream bufos(&buffered);
+        bufos << json(threadStacks, &proc);
+    } else if (doDedupe) {
+        // Coalesce threads with identical stacks - in a homogeneous pool,
+        // most threads are parked in the same wait, and symbolizing and
+        // printing that stack once per thread is pure waste. Group by the
+        // raw PC vector so frames are symbolized once per unique stack.
+        OutputBuffer buffered(os);
+        std::ostream bufos(&buffered);
+        bufos << "process: " << *proc.io << "\n";
+        std::map<std::vector<Elf::Addr>, std::vector<const Procman::ThreadStack *>> unique;
+        std::vector<decltype(unique)::iterator> order; // first-seen order.
+        for (auto &s : threadStacks) {
+            std::vector<Elf::Addr> ips;
+            ips.reserve(s.stack.size());
+            for (auto &frame : s.stack)
+                ips.push_back(frame.rawIP());
+            auto [it, isnew] = unique.emplace(std::move(ips),
+                  std::vector<const Procman::ThreadStack *>());
+            if (isnew)
+                order.push_back(it);
+            it->second.push_back(&s);
+        }
+        for (auto it : order) {
+            const auto &threads = it->second;
+            if (threads.size() == 1) {
+                proc.dumpStackText(bufos, *threads[0]);
+            } else {
+                bufos << std::dec << threads.size() << " threads:";
+                for (auto t : threads)
+                    bufos << " " << (void *)t->info.ti_tid
+                       << "/lwp:" << t->info.ti_lid;
+                bufos << "\n";
+                int frameNo = 0;
+                for (auto &frame : threads[0]->stack)
+                    proc.dumpFrameText(bufos, frame, frameNo++);
+            }
+            bufos << "\n";
+        }
     } else {
-        os << "process: " << *proc.io << "\n";
+        // Buffer the trace: each thread produces hundreds of tiny ostream
+        // writes, and a flush per thread. Assemble the whole dump in memory
+        // and hand the underlying stream a few large writes instead.
+        OutputBuffer buffered(os);
+        std::ostream bufos(&buffered);
+        bufos << "process: " << *proc.io << "\n";
         for (auto &s : threadStacks) {
-            proc.dumpStackText(os, s);
-            os << std::endl;
+            proc.dumpStackText(bufos, s);
+            bufos << "\n";
         }
     }
 }
@@ -150,9 +434,9 @@ startChild(Elf::Object::sptr exe, const std::string &cmd,
 
 #ifdef WITH_PYTHON
 template<int V> void
-doPy(Procman::Process &proc, bool showModules, const PyInterpInfo &info) {
+doPy(Procman::Process &proc, bool showModules, const PyInterpInfo &info, PythonCache &cache) {
     Procman::StopProcess here(&proc);
-    PythonPrinter<V> printer(proc, *proc.options.output, info);
+    PythonPrinter<V> printer(proc, *proc.options.output, info, cache);
     if (!printer.interpFound())
         throw Exception() << "no python interpreter found";
     printer.printInterpreters(showModules);
@@ -169,21 +453,27 @@ doPy(Procman::Process &proc, bool showModules, const PyInterpInfo &info) {
  * @param showModules   Whether to show modules
  * @return              boolean of whether the process was a Python process or not
  */
-bool pystack(Procman::Process &proc, bool showModules) {
-    PyInterpInfo info = getPyInterpInfo(proc);
+bool pystack(Procman::Process &proc, bool showModules, PythonCache &cache) {
+    // interpreter discovery scans symbol tables - do it once per process,
+    // not once per iteration of the repeat loop.
+    if (!cache.interpProbed) {
+        cache.interp = getPyInterpInfo(proc);
+        cache.interpProbed = true;
+    }
+    const PyInterpInfo &info = cache.interp;
 
     if (info.libpython == nullptr) // not a python process or python interpreter not found
         return false;
 
     if (info.versionHex < V2HEX(3, 0)) { // Python 2.x
 #ifdef WITH_PYTHON2
-        doPy<2>(proc, showModules, info);
+        doPy<2>(proc, showModules, info, cache);
 #else
         throw (Exception() << "no support for discovered python 2 interpreter");
 #endif
     } else { // Python 3.x
 #ifdef WITH_PYTHON3
-        doPy<3>(proc, showModules, info);
+        doPy<3>(proc, showModules, info, cache);
 #else
         throw (Exception() << "no support for discovered python 3 interpreter");
 #endif
@@ -251,7 +541,9 @@ emain(int argc, char **argv, Dwarf::ImageCache &imageCache)
             "ELF file",
             "dump details of an ELF image in JSON and exit",
             [&](const char *arg) {
-                *options.output << json(Elf::Object(imageCache, loadFile(arg)));
+                OutputBuffer buffered(*options.output);
+                std::ostream os(&buffered);
+                os << json(Elf::Object(imageCache, std::make_shared<MmapReader>(arg)));
                 exitCode = 0; })
 
     .add("dwarf-dump",
@@ -259,9 +551,11 @@ emain(int argc, char **argv, Dwarf::ImageCache &imageCache)
             "ELF file",
             "dump details of DWARF information in an ELF image in JSON and exit",
             [&](const char *arg) {
-                auto dumpobj = std::make_shared<Elf::Object>(imageCache, loadFile(arg));
+                auto dumpobj = std::make_shared<Elf::Object>(imageCache, std::make_shared<MmapReader>(arg));
                 auto di = std::make_shared<Dwarf::Info>(dumpobj, imageCache);
-                *options.output << json(*di);
+                OutputBuffer buffered(*options.output);
+                std::ostream os(&buffered);
+                os << json(*di);
                 exitCode = 0; })
 
     .add("depth",
@@ -286,11 +580,52 @@ emain(int argc, char **argv, Dwarf::ImageCache &imageCache)
             "attempt to show the value of arguments to functions",
             Flags::setf(options.doargs))
 
+    .add("fast",
+            'f',
+            "unwind via frame pointers where possible, using DWARF only when "
+            "the chain breaks. Cheap, but needs frame pointers compiled in",
+            Flags::setf(options.fast))
+
     .add("json",
             'j',
             "use JSON output rather than plaintext",
             Flags::setf(doJson))
 
+    .add("binary",
+            'B',
+            "use length-prefixed binary output rather than plaintext",
+            Flags::setf(doBinary))
+
+    .add("gcore",
+            'C',
+            "prefix",
+            "write a core snapshot of each target to <prefix>.<pid> instead "
+            "of tracing it",
+            Flags::set<std::string>(gcorePrefix))
+
+    .add("folded",
+            'G',
+            "aggregate samples into folded stack lines (flamegraph.pl input), "
+            "emitted at exit; combine with -b to sample over time",
+            Flags::setf(doFolded))
+
+    .add("delta",
+            'z',
+            "print only threads whose stack changed since the previous "
+            "iteration of the repeat loop (see -b), with a periodic full "
+            "keyframe",
+            Flags::setf(doDelta))
+
+    .add("unique",
+            'u',
+            "print each unique stack once, with the list of threads sharing it",
+            Flags::setf(doDedupe))
+
+    .add("perf-stats",
+            'S',
+            "emit performance counters and per-phase timings as JSON on stderr at exit",
+            Flags::setf(perfStats))
+
     .add("no-src",
             's',
             "don't include source info",
@@ -380,10 +715,17 @@ emain(int argc, char **argv, Dwarf::ImageCache &imageCache)
         return usage(std::cerr, argv[0], flags);
 
     auto doStack = [=] (Procman::Process &proc) {
+        if (gcorePrefix != "") {
+            Procman::gcore(proc, stringify(gcorePrefix, ".", proc.getPID()));
+            return;
+        }
+#if defined(WITH_PYTHON)
+        PythonCache pycache; // persists over the repeat loop below.
+#endif
         while (!interrupted) {
 #if defined(WITH_PYTHON)
             if (doPython || printAllStacks) {
-                bool isPythonProcess = pystack(proc, pythonModules);
+                bool isPythonProcess = pystack(proc, pythonModules, pycache);
                 // error if -p but not python process
                 if (doPython && !isPythonProcess)
                     throw Exception() << "Couldn't find a Python interpreter";
@@ -393,23 +735,81 @@ emain(int argc, char **argv, Dwarf::ImageCache &imageCache)
             {
                 pstack(proc);
             }
-            if (sleepTime != 0.0)
+            if (sleepTime != 0.0) {
                 usleep(sleepTime * 1000000);
-            else
+                // Catch up with any dlopen/dlclose since the last sample
+                // rather than rebuilding the process from scratch.
+                proc.reload();
+            } else {
                 break;
+            }
         }
     };
+     // Gather the targets before tracing any. A bare ELF argument names the
+     // executable for the target that follows it, so classification of the
+     // arguments is inherently serial.
+     std::vector<std::pair<std::string, std::shared_ptr<Procman::Process>>> targets;
      for (int i = optind; i < argc; i++) {
          try {
+             std::unique_ptr<stats::Timer> phase;
+             if (perfStats)
+                 phase = std::make_unique<stats::Timer>(stats::ph_load);
              auto process = Procman::Process::load(exec, argv[i], options, imageCache); // this calls the load() instance member.
              if (process == nullptr)
                  exec = imageCache.getImageForName(argv[i]);
              else
-                 doStack(*process);
+                 targets.emplace_back(argv[i], process);
          } catch (const std::exception &e) {
              std::cerr << "trace of " << argv[i] << " failed: " << e.what() << "\n";
          }
      }
+
+     if (targets.size() > 1 && sleepTime == 0.0) {
+         // Trace the targets on a pool of threads. They all share the image
+         // cache, so common libraries are parsed once for the whole batch,
+         // and a slow target (eg, a huge core) doesn't hold up the rest.
+         // Each target's output is buffered and emitted whole as it
+         // completes, so streams don't interleave. Live targets are handled
+         // end-to-end by one worker - ptrace requires the attaching thread
+         // to make the subsequent calls.
+         std::mutex outputLock;
+         std::atomic<size_t> nextTarget { 0 };
+         auto worker = [&] {
+             for (;;) {
+                 size_t i = nextTarget++;
+                 if (i >= targets.size())
+                     return;
+                 auto &[id, process] = targets[i];
+                 std::ostringstream os;
+                 process->options.output = &os;
+                 std::string error;
+                 try {
+                     doStack(*process);
+                 } catch (const std::exception &e) {
+                     error = e.what();
+                 }
+                 std::lock_guard<std::mutex> lock(outputLock);
+                 *options.output << os.str();
+                 if (error != "")
+                     std::cerr << "trace of " << id << " failed: " << error << "\n";
+             }
+         };
+         std::vector<std::future<void>> workers;
+         auto nthreads = std::min<size_t>(std::thread::hardware_concurrency(), targets.size());
+         workers.reserve(nthreads);
+         for (size_t i = 0; i < nthreads; ++i)
+             workers.push_back(std::async(std::launch::async, worker));
+         for (auto &w : workers)
+             w.get();
+     } else {
+         for (auto &[id, process] : targets) {
+             try {
+                 doStack(*process);
+             } catch (const std::exception &e) {
+                 std::cerr << "trace of " << id << " failed: " << e.what() << "\n";
+             }
+         }
+     }
     return 0;
 }
 }
@@ -426,6 +826,8 @@ main(int argc, char **argv)
         sa.sa_flags = SA_RESETHAND;
         sigaction(SIGINT, &sa, nullptr);
         emain(argc, argv, imageCache);
+        if (perfStats)
+            stats::dump(std::clog);
 
         // Normally, exit without free'ing imagecache - don't waste effort
         // moving pointers around in a terminating process
@@ -6,19 +6,58 @@
 #include "libpstack/python.h"
 
 namespace pstack {
+// Code objects are immutable, and shared by every frame executing the same
+// function - read each exactly once per process via the printer's cache.
+template <int PyV>
+const PyCodeObject *
+getCode(const PythonPrinter<PyV> *pc, Elf::Addr addr)
+{
+    auto &buf = pc->cache.codeObjects[addr];
+    if (buf.empty()) {
+        buf.resize(sizeof (PyCodeObject));
+        readPyObj<PyV, PyCodeObject>(*pc->proc.io, addr, (PyCodeObject *)&buf[0]);
+    }
+    return (const PyCodeObject *)&buf[0];
+}
+
+// likewise for interned strings - function and file names, mostly.
+template <int PyV>
+const std::string &
+getString(const PythonPrinter<PyV> *pc, Elf::Addr addr)
+{
+    auto [it, fresh] = pc->cache.strings.emplace(addr, std::string());
+    if (fresh)
+        it->second = readString<PyV>(*pc->proc.io, addr);
+    return it->second;
+}
+
+// and raw C strings - type names, in practice.
+template <int PyV>
+const std::string &
+getCString(const PythonPrinter<PyV> *pc, Elf::Addr addr)
+{
+    auto [it, fresh] = pc->cache.cStrings.emplace(addr, std::string());
+    if (fresh)
+        it->second = pc->proc.io->readString(addr);
+    return it->second;
+}
+
+#if PY_VERSION_HEX < 0x030b0000
 // This reimplements PyCode_Addr2Line
 template<int PyV> int
-getLine(const Reader &proc, const PyCodeObject *code, const PyFrameObject *frame)
+getLine(const PythonPrinter<PyV> *pc, const PyCodeObject *code, const PyFrameObject *frame)
 {
-    auto lnotab = readPyObj<PyV, PyVarObject>(proc, Elf::Addr(code->co_lnotab));
-
-    unsigned char linedata[lnotab.ob_size];
-    proc.readObj(Elf::Addr(code->co_lnotab) + offsetof(PyBytesObject, ob_sval),
-            &linedata[0], lnotab.ob_size);
+    auto &linedata = pc->cache.lineTables[Elf::Addr(code->co_lnotab)];
+    if (linedata.empty()) {
+        auto lnotab = readPyObj<PyV, PyVarObject>(*pc->proc.io, Elf::Addr(code->co_lnotab));
+        linedata.resize(lnotab.ob_size);
+        pc->proc.io->readObj(Elf::Addr(code->co_lnotab) + offsetof(PyBytesObject, ob_sval),
+                &linedata[0], lnotab.ob_size);
+    }
     int line = code->co_firstlineno;
     int addr = 0;
-    unsigned char *p = linedata;
-    unsigned char *e = linedata + lnotab.ob_size;
+    const unsigned char *p = linedata.data();
+    const unsigned char *e = p + linedata.size();
     while (p < e) {
         addr += *p++;
         if (addr > frame->f_lasti) {
@@ -32,10 +71,11 @@ getLine(const Reader &proc, const PyCodeObject *code, const PyFrameObject *frame
     }
     return line;
 }
+#endif
 
 template <int PyV> class HeapPrinter final : public PythonTypePrinter<PyV> {
     Elf::Addr print(const PythonPrinter<PyV> *pc, const PyObject *, const PyTypeObject *pto, Elf::Addr remote) const override {
-        pc->os << pc->proc.io->readString(Elf::Addr(pto->tp_name));
+        pc->os << getCString<PyV>(pc, Elf::Addr(pto->tp_name));
         if (pto->tp_dictoffset > 0) {
             pc->os << "\n";
             pc->depth++;
@@ -110,7 +150,7 @@ template<int PyV> class ListPrinter final : public PythonTypePrinter<PyV> {
 template <int PyV> class TypePrinter final : public PythonTypePrinter<PyV> {
     Elf::Addr print(const PythonPrinter<PyV> *pc, const PyObject *pyo, const PyTypeObject *, Elf::Addr) const override {
         auto pto = (const _typeobject *)pyo;
-        pc->os << "type :\"" << pc->proc.io->readString(Elf::Addr(pto->tp_name)) << "\"";
+        pc->os << "type :\"" << getCString<PyV>(pc, Elf::Addr(pto->tp_name)) << "\"";
         return 0;
     }
     const char *type() const override { return "PyType_Type"; }
@@ -192,14 +232,15 @@ printTupleVars(const PythonPrinter<PyV> *pc, Elf::Addr namesAddr, Elf::Addr valu
 
 }
 
+#if PY_VERSION_HEX < 0x030b0000
 template <int PyV> class FramePrinter final : public PythonTypePrinter<PyV> {
     Elf::Addr print(const PythonPrinter<PyV> *pc, const PyObject *pyo, const PyTypeObject *, Elf::Addr remoteAddr) const override {
         auto pfo = (const PyFrameObject *)pyo;
         if (pfo->f_code != 0) {
-            const auto &code = readPyObj<PyV, PyCodeObject>(*pc->proc.io, Elf::Addr(pfo->f_code));
-            auto lineNo = getLine<PyV>(*pc->proc.io, &code, pfo);
-            auto func = readString<PyV>(*pc->proc.io, Elf::Addr(code.co_name));
-            auto file = readString<PyV>(*pc->proc.io, Elf::Addr(code.co_filename));
+            const auto &code = *getCode<PyV>(pc, Elf::Addr(pfo->f_code));
+            auto lineNo = getLine<PyV>(pc, &code, pfo);
+            const auto &func = getString<PyV>(pc, Elf::Addr(code.co_name));
+            const auto &file = getString<PyV>(pc, Elf::Addr(code.co_filename));
 
             pc->os << pc->prefix() << func;
 
@@ -239,6 +280,19 @@ template <int PyV> class FramePrinter final : public PythonTypePrinter<PyV> {
     bool dupdetect() const override { return true; }
 };
 
+/*
+ * Walk and print one thread's frames. Before 3.11 the thread state points
+ * at a chain of ordinary heap PyFrameObjects, so the type-printer machinery
+ * handles them; python3.cc specializes this for 3.11+, where frames moved
+ * into per-thread stack chunks.
+ */
+template <int PyV>
+void
+printFrames(const PythonPrinter<PyV> *pc, const _ts *thread)
+{
+    pc->print(Elf::Addr(thread->frame));
+}
+#endif
 
 template <int PyV>
 const char *
@@ -287,8 +341,10 @@ template <int PyV> bool PythonPrinter<PyV>::interpFound() const {
 
 
 template <int PyV>
-PythonPrinter<PyV>::PythonPrinter(Procman::Process &proc_, std::ostream &os_, const PyInterpInfo &info_)
-    : proc(proc_)
+PythonPrinter<PyV>::PythonPrinter(Procman::Process &proc_, std::ostream &os_, const PyInterpInfo &info_,
+      PythonCache &cache_)
+    : cache(cache_)
+    , proc(proc_)
     , os(os_)
     , depth(0)
     , interp_head(info_.interpreterHead)
@@ -305,7 +361,9 @@ PythonPrinter<PyV>::PythonPrinter(Procman::Process &proc_, std::ostream &os_, co
     static ListPrinter<PyV> listPrinter;
     static TypePrinter<PyV> typePrinter;
     static LongPrinter<PyV> longPrinter;
+#if PY_VERSION_HEX < 0x030b0000
     static FramePrinter<PyV> framePrinter;
+#endif
     static TuplePrinter<PyV> tuplePrinter;
 
     for (auto ps : PythonTypePrinter<PyV>::all) {
@@ -337,7 +395,7 @@ PythonPrinter<PyV>::print(Elf::Addr remoteAddr) const {
             auto it = printers.find(objtype);
             const PythonTypePrinter<PyV> *printer = it == printers.end() ? nullptr : it->second;
 
-            auto &pto = types[pyObjtype<PyV>(&baseObj)];
+            auto &pto = cache.types[pyObjtype<PyV>(&baseObj)];
             if (pto == nullptr) {
                 pto.reset((_typeobject *)malloc(sizeof(PyTypeObject)));
                 readPyObj<PyV, PyTypeObject>(*proc.io,
@@ -347,7 +405,7 @@ PythonPrinter<PyV>::print(Elf::Addr remoteAddr) const {
 
             if (printer == 0) {
                 std::string tn;
-                tn = proc.io->readString(Elf::Addr(pto->tp_name));
+                tn = getCString<PyV>(this, Elf::Addr(pto->tp_name));
                 if (tn == "NoneType") {
                     os << "None";
                     break;
@@ -395,8 +453,27 @@ PythonPrinter<PyV>::print(Elf::Addr remoteAddr) const {
     --depth;
 }
 
+template <int PyV>
+std::string
+PythonPrinter<PyV>::objectType(Elf::Addr remoteAddr) const {
+    try {
+        auto baseObj = readPyObj<PyV, PyVarObject>(*proc.io, remoteAddr);
+        auto &pto = cache.types[pyObjtype<PyV>(&baseObj)];
+        if (pto == nullptr) {
+            pto.reset((_typeobject *)malloc(sizeof(PyTypeObject)));
+            readPyObj<PyV, PyTypeObject>(*proc.io,
+                    (Elf::Addr)pyObjtype<PyV>(&baseObj),
+                    pto.get());
+        }
+        return getCString<PyV>(this, Elf::Addr(pto->tp_name));
+    }
+    catch (const std::exception &) {
+        return "?";
+    }
+}
+
 /*
- * process one python thread in an interpreter, at remote addr "ptr". 
+ * process one python thread in an interpreter, at remote addr "ptr".
  * returns the address of the next thread on the list.
  */
 template <int PyV>
@@ -414,7 +491,7 @@ PythonPrinter<PyV>::printThread(Elf::Addr ptr)
         os << "anonymous thread";
     }
     os << "\n";
-    print(Elf::Addr(thread.frame));
+    printFrames<PyV>(this, &thread);
     return Elf::Addr(thread.next);
 }
 
@@ -446,11 +523,12 @@ PythonPrinter<PyV>::printInterp(Elf::Addr ptr, bool showModules)
     return state.next;
 }
 
+#if PY_VERSION_HEX < 0x030b0000
 template <int PyV>
 void printArguments(const PythonPrinter<PyV> *pc, const PyObject *pyo, Elf::Addr remoteAddr) {
     const PyFrameObject* pfo = (PyFrameObject *)pyo;
 
-    const PyCodeObject &code = readPyObj<PyV, PyCodeObject>(*pc->proc.io, Elf::Addr(pfo->f_code));
+    const PyCodeObject &code = *getCode<PyV>(pc, Elf::Addr(pfo->f_code));
 
     auto flags = code.co_flags;
     int argCount = code.co_argcount;
@@ -508,7 +586,7 @@ void printArguments(const PythonPrinter<PyV> *pc, const PyObject *pyo, Elf::Addr
         pc->proc.io->readObj(localsAddr + argCount * sizeof(PyObject *), kwonlyArgs, kwonlyArgCount);
 
         for (int i = 0; i < kwonlyArgCount; i++) {
-            pc->os << readString<PyV>(*pc->proc.io, Elf::Addr(kwonlyArgNames[i])) << "=";
+            pc->os << getString<PyV>(pc, Elf::Addr(kwonlyArgNames[i])) << "=";
             pc->print(Elf::Addr(kwonlyArgs[i]));
             if (i < kwonlyArgCount - 1) pc->os << ", ";
         }
@@ -525,5 +603,6 @@ void printArguments(const PythonPrinter<PyV> *pc, const PyObject *pyo, Elf::Addr
     }
     pc->os << ")";
 }
+#endif
 
 }
@@ -138,6 +138,15 @@ int getKwonlyArgCount<3>(const PyObject *pyCode) {
 // this comes from python internals that requires us to include C++-incompatible
 // headers (stdatomic.h, for example). It's in its own (C) translation unit.
 extern "C" size_t pyInterpOffset();
+#if PY_VERSION_HEX >= 0x030b0000
+// likewise for the core-private _PyInterpreterFrame layout.
+extern "C" size_t pyFrameSize();
+extern "C" size_t pyFrameCodeOffset();
+extern "C" size_t pyFramePreviousOffset();
+extern "C" size_t pyFramePrevInstrOffset();
+
+template <> void printFrames<3>(const PythonPrinter<3> *, const _ts *);
+#endif
 
 template <>
 std::tuple<Elf::Object::sptr, Elf::Addr, Elf::Addr>
@@ -173,6 +182,154 @@ getInterpHead<3>(Procman::Process &proc) {
 
 namespace pstack {
 
+#if PY_VERSION_HEX >= 0x030b0000
+
+namespace {
+
+/*
+ * A local copy of one thread's frame storage. 3.11 lays frames out
+ * contiguously in per-thread stack chunks, so the whole stack usually costs
+ * one remote read per chunk rather than several per frame.
+ */
+struct StackChunks {
+    std::vector<std::pair<Elf::Addr, std::vector<char>>> chunks;
+    StackChunks(const Reader &r, Elf::Addr chunkAddr) {
+        while (chunkAddr) {
+            auto hdr = readPyObj<3, _PyStackChunk>(r, chunkAddr);
+            if (hdr.size == 0 || hdr.size > 1024 * 1024)
+                break;
+            std::vector<char> buf(hdr.size);
+            if (r.read(chunkAddr, hdr.size, buf.data()) != hdr.size)
+                break;
+            chunks.emplace_back(chunkAddr, std::move(buf));
+            chunkAddr = Elf::Addr(hdr.previous);
+        }
+    }
+    const char *local(Elf::Addr addr, size_t len) const {
+        for (auto &[base, buf] : chunks)
+            if (addr >= base && addr - base + len <= buf.size())
+                return buf.data() + (addr - base);
+        return nullptr;
+    }
+};
+
+// varints in the location table: 6 bits per byte, bit 6 is "continue".
+unsigned varint(const unsigned char *&p) {
+    unsigned shift = 0;
+    unsigned val = 0;
+    unsigned char byte;
+    do {
+        byte = *p++;
+        val |= unsigned(byte & 0x3f) << shift;
+        shift += 6;
+    } while ((byte & 0x40) != 0);
+    return val;
+}
+
+int svarint(const unsigned char *&p) {
+    unsigned val = varint(p);
+    return (val & 1) != 0 ? -int(val >> 1) : int(val >> 1);
+}
+
+/*
+ * Map an instruction offset (in code units) to a line number. 3.11 replaced
+ * co_lnotab with the compressed location table decoded here; this is the
+ * line-number subset of what getLine does for older interpreters.
+ */
+int getLine311(const PythonPrinter<3> *pc, const PyCodeObject *code, int lasti) {
+    auto &linedata = pc->cache.lineTables[Elf::Addr(code->co_linetable)];
+    if (linedata.empty()) {
+        auto linetable = readPyObj<3, PyVarObject>(*pc->proc.io, Elf::Addr(code->co_linetable));
+        linedata.resize(linetable.ob_size);
+        pc->proc.io->readObj(Elf::Addr(code->co_linetable) + offsetof(PyBytesObject, ob_sval),
+                &linedata[0], linetable.ob_size);
+    }
+    const unsigned char *p = linedata.data();
+    const unsigned char *e = p + linedata.size();
+    int line = code->co_firstlineno;
+    int addr = 0;
+    while (p < e) {
+        unsigned char first = *p++;
+        int form = (first >> 3) & 15;
+        int units = (first & 7) + 1;
+        switch (form) {
+            case 15: // no location
+                break;
+            case 14: // long form: line delta, end line, column, end column
+                line += svarint(p);
+                varint(p);
+                varint(p);
+                varint(p);
+                break;
+            case 13: // no column info
+                line += svarint(p);
+                break;
+            case 12: case 11: case 10: // one-line forms, delta in the code
+                line += form - 10;
+                p += 2;
+                break;
+            default: // short forms: same line, packed column info
+                p += 1;
+                break;
+        }
+        addr += units;
+        if (addr > lasti)
+            break;
+    }
+    return line;
+}
+
+}
+
+/*
+ * 3.11 threads run on a chain of _PyInterpreterFrames rather than heap
+ * PyFrameObjects, so the generic object printer can't walk them. Pull the
+ * thread's stack chunks local and decode the frames from there; frames
+ * living outside the chunks (generators, mostly) are read individually.
+ */
+template <>
+void
+printFrames<3>(const PythonPrinter<3> *pc, const _ts *thread)
+{
+    StackChunks chunks(*pc->proc.io, Elf::Addr(thread->datastack_chunk));
+    const size_t framesize = pyFrameSize();
+    std::vector<char> copy(framesize);
+    pc->depth++;
+    try {
+        auto cframe = readPyObj<3, _PyCFrame>(*pc->proc.io, Elf::Addr(thread->cframe));
+        for (Elf::Addr frameAddr = Elf::Addr(cframe.current_frame); frameAddr; ) {
+            const char *frame = chunks.local(frameAddr, framesize);
+            if (frame == nullptr) {
+                pc->proc.io->readObj(frameAddr, &copy[0], framesize);
+                frame = copy.data();
+            }
+            auto field = [frame](size_t off) {
+                return *(const Elf::Addr *)(frame + off);
+            };
+            Elf::Addr codeAddr = field(pyFrameCodeOffset());
+            Elf::Addr next = field(pyFramePreviousOffset());
+            if (codeAddr != 0) {
+                const auto &code = *getCode<3>(pc, codeAddr);
+                // prev_instr points into the code object's inline bytecode.
+                int lasti = int(field(pyFramePrevInstrOffset())
+                        - (codeAddr + offsetof(PyCodeObject, co_code_adaptive))) / 2;
+                const auto &func = getString<3>(pc, Elf::Addr(
+                            code.co_qualname != nullptr ? code.co_qualname : code.co_name));
+                const auto &file = getString<3>(pc, Elf::Addr(code.co_filename));
+                pc->os << pc->prefix() << func << " in " << file << ":"
+                    << getLine311(pc, &code, lasti) << std::endl;
+            }
+            frameAddr = next;
+        }
+    }
+    catch (const std::exception &ex) {
+        pc->os << "(print failed:" << ex.what() << ")";
+    }
+    --pc->depth;
+}
+
+#endif
+
 template struct PythonPrinter<3>;
 
 }
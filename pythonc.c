@@ -12,3 +12,25 @@
 size_t pyInterpOffset() {
    return offsetof(_PyRuntimeState, interpreters) + offsetof(struct pyinterpreters, head);
 }
+
+#if PY_VERSION_HEX >= 0x030b0000
+#include <internal/pycore_frame.h>
+
+/*
+ * 3.11 moved interpreter frames out of heap PyFrameObjects into
+ * _PyInterpreterFrame, which is only defined in the core-private headers -
+ * export its layout so the C++ side can decode frames read from the target.
+ */
+size_t pyFrameSize() {
+   return sizeof (struct _PyInterpreterFrame);
+}
+size_t pyFrameCodeOffset() {
+   return offsetof(struct _PyInterpreterFrame, f_code);
+}
+size_t pyFramePreviousOffset() {
+   return offsetof(struct _PyInterpreterFrame, previous);
+}
+size_t pyFramePrevInstrOffset() {
+   return offsetof(struct _PyInterpreterFrame, prev_instr);
+}
+#endif
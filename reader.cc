@@ -4,7 +4,9 @@
 #include <unistd.h>
 #include <cassert>
 #include <cstdint>
+#include <unordered_set>
 #include "libpstack/reader.h"
+#include "libpstack/stats.h"
 #include "libpstack/fs.h"
 #include "libpstack/global.h"
 #include <cstring>
@@ -77,6 +79,26 @@ MemReader::readString(Off offset) const {
    return string(ptroff(data, offset));
 }
 
+const char *
+MemReader::window(Off offset, size_t count) const {
+   if (offset + count > len)
+      return nullptr;
+   return ptroff(data, offset);
+}
+
+
+void
+Reader::readv(std::vector<ReadRange> &ranges) const
+{
+    for (auto &range : ranges) {
+        try {
+            range.got = read(range.offset, range.count, range.ptr);
+        }
+        catch (const std::exception &) {
+            range.got = 0;
+        }
+    }
+}
 
 string
 Reader::readString(Off offset) const
@@ -103,6 +125,25 @@ Reader::view(const std::string &name, Off offset, Off size) const {
 size_t
 FileReader::read(Off off, size_t count, char *ptr) const
 {
+    // Sequential scans - FDE walks, unit iteration, canal's segment sweep -
+    // arrive here as back-to-back reads (usually a page at a time, via the
+    // cache). Spot them and ask the kernel to start fetching a doubling
+    // window ahead of the scan; a non-sequential read drops back to plain
+    // on-demand reads.
+    if (off != 0 && off == expected.load(std::memory_order_relaxed)) {
+        Off w = window.load(std::memory_order_relaxed);
+        w = w == 0 ? initialWindow : std::min(w * 2, maxWindow);
+        window.store(w, std::memory_order_relaxed);
+        Off target = std::min(off + Off(count) + w, Off(fileSize));
+        Off from = std::max(advised.load(std::memory_order_relaxed), off);
+        if (target > from) {
+            posix_fadvise(file, from, target - from, POSIX_FADV_WILLNEED);
+            advised.store(target, std::memory_order_relaxed);
+        }
+    } else {
+        window.store(0, std::memory_order_relaxed);
+    }
+    expected.store(off + Off(count), std::memory_order_relaxed);
     auto rc = pread(file, ptr, count, off);
     if (rc == -1)
         throw (Exception()
@@ -110,6 +151,8 @@ FileReader::read(Off off, size_t count, char *ptr) const
             << " at " << (void *)off
             << " on " << *this
             << " failed: " << strerror(errno));
+    stats::count(stats::readerOps);
+    stats::count(stats::readerBytes, rc);
     return rc;
 }
 
@@ -121,56 +164,104 @@ CacheReader::Page::load(const Reader &r, Off offset_)
     offset = offset_;
 }
 
-CacheReader::CacheReader(Reader::csptr upstream_)
+CacheReader::CacheReader(Reader::csptr upstream_, size_t pagesize_)
     : upstream(std::move(upstream_))
+    , pagesize(pagesize_)
+{
+}
+
+CacheReader::~CacheReader()
 {
+    if (verbose >= 2)
+        *debug << "page cache for " << *upstream << ": hits=" << hits
+            << ", misses=" << misses << ", pages=" << pages.size()
+            << " of " << maxpages << std::endl;
 }
 
 void
 CacheReader::flush() {
+    std::lock_guard<std::mutex> guard(cacheLock);
     pages.clear();
+    lruHead = lruTail = nullptr;
+}
+
+void
+CacheReader::lruUnlink(Page *p) const
+{
+    if (p->lruPrev != nullptr)
+        p->lruPrev->lruNext = p->lruNext;
+    else
+        lruHead = p->lruNext;
+    if (p->lruNext != nullptr)
+        p->lruNext->lruPrev = p->lruPrev;
+    else
+        lruTail = p->lruPrev;
+    p->lruPrev = p->lruNext = nullptr;
+}
+
+void
+CacheReader::lruInsert(Page *p) const
+{
+    p->lruNext = lruHead;
+    if (lruHead != nullptr)
+        lruHead->lruPrev = p;
+    lruHead = p;
+    if (lruTail == nullptr)
+        lruTail = p;
 }
 
 CacheReader::Page &
 CacheReader::getPage(Off pageoff) const
 {
-    bool first = true;
-    for (auto i = pages.begin(); i != pages.end(); ++i) {
-        if ((*i)->offset == pageoff) {
-            // move page to front.
-            if (!first) {
-                auto page = std::exchange(*i, nullptr);
-                pages.erase(i);
-                pages.push_front(std::move(page));
-            }
-            return **pages.begin();
+    auto it = pages.find(pageoff);
+    if (it != pages.end()) {
+        hits++;
+        stats::count(stats::cacheHits);
+        Page *p = it->second.get();
+        // move page to front.
+        if (lruHead != p) {
+            lruUnlink(p);
+            lruInsert(p);
         }
-        first = false;
+        return *p;
     }
 
+    misses++;
+    stats::count(stats::cacheMisses);
     std::unique_ptr<Page> p;
-    if (pages.size() == MAXPAGES) {
-        // steal the oldest page.
-        p = std::exchange( pages.back(), nullptr );
-        pages.pop_back();
+    if (pages.size() >= maxpages && misses > hits && maxpages < MAXPAGES) {
+        // The working set is bigger than the cache - grow it rather than
+        // thrash, within reason.
+        maxpages *= 2;
+    }
+    if (pages.size() >= maxpages) {
+        // steal the least-recently-used page.
+        Page *victim = lruTail;
+        lruUnlink(victim);
+        auto node = pages.find(victim->offset);
+        p = std::move(node->second);
+        pages.erase(node);
     } else {
-        p = std::make_unique<Page>();
+        p = std::make_unique<Page>(pagesize);
     }
-     p->load(*upstream, pageoff);
-     pages.push_front(std::move(p));
-     return **pages.begin();
+    p->load(*upstream, pageoff);
+    Page *raw = p.get();
+    pages[pageoff] = std::move(p);
+    lruInsert(raw);
+    return *raw;
 }
 
 size_t
 CacheReader::read(Off off, size_t count, char *ptr) const
 {
-    if (count >= PAGESIZE)
+    if (count >= pagesize)
         return upstream->read(off, count, ptr);
+    std::lock_guard<std::mutex> guard(cacheLock);
     Off startoff = off;
     for (;;) {
         if (count == 0)
             break;
-        size_t offsetOfDataInPage = off % PAGESIZE;
+        size_t offsetOfDataInPage = off % pagesize;
         Off offsetOfPageInFile = off - offsetOfDataInPage;
         Page &page = getPage(offsetOfPageInFile);
         size_t chunk = std::min(page.len - offsetOfDataInPage, count);
@@ -178,19 +269,36 @@ CacheReader::read(Off off, size_t count, char *ptr) const
         off += chunk;
         count -= chunk;
         ptr += chunk;
-        if (page.len != PAGESIZE)
+        if (page.len != pagesize)
             break;
     }
     return off - startoff;
 }
 
+const std::string &
+internString(std::string &&s)
+{
+    static std::mutex poolLock;
+    static std::unordered_set<std::string> pool;
+    std::lock_guard<std::mutex> guard(poolLock);
+    return *pool.emplace(std::move(s)).first;
+}
+
 string
 CacheReader::readString(Off off) const
 {
-    auto [it, neu] = stringCache.insert(std::make_pair(off, std::string{}));
-    if (neu)
-        it->second = Reader::readString(off);
-    return it->second;
+    {
+        std::lock_guard<std::mutex> guard(cacheLock);
+        auto it = stringCache.find(off);
+        if (it != stringCache.end())
+            return *it->second;
+    }
+    // read the string without the lock held - Reader::readString comes back
+    // through our own (locking) read().
+    const auto &s = internString(Reader::readString(off));
+    std::lock_guard<std::mutex> guard(cacheLock);
+    stringCache.emplace(off, &s);
+    return s;
 }
 
 Reader::csptr
@@ -200,7 +308,7 @@ loadFile(const string &path)
         std::make_shared<FileReader>(path));
 }
 
-MmapReader::MmapReader(const string &name_)
+MmapReader::MmapReader(const string &name_, bool readahead)
    : MemReader(name_, 0, nullptr)
 {
    int fd = openfile(name_);
@@ -211,6 +319,10 @@ MmapReader::MmapReader(const string &name_)
    close(fd);
    if (p == MAP_FAILED)
       throw (Exception() << "mmap failed: " << strerror(errno));
+   // We walk section and debug content mostly front-to-back, so let the
+   // kernel read ahead aggressively rather than faulting a page at a time.
+   if (readahead)
+      madvise(p, len, MADV_WILLNEED);
    data = static_cast<char *>(p);
 }
 
@@ -268,6 +380,20 @@ OffsetReader::size() const {
    return length;
 }
 
+const char *
+OffsetReader::window(Off off, size_t count) const {
+   if (off + count > length)
+      return nullptr;
+   return upstream->window(off + offset, count);
+}
+
+Reader::csptr
+OffsetReader::view(const std::string &name, Off start, Off viewLength) const {
+   if (viewLength == std::numeric_limits<Off>::max())
+      viewLength = length - start;
+   return upstream->view(name, offset + start, viewLength);
+}
+
 std::pair<uintmax_t, size_t>
 Reader::readULEB128(Off off) const
 {
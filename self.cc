@@ -2,6 +2,7 @@
 
 #include <sys/ptrace.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include <dirent.h>
 #include <err.h>
@@ -105,4 +106,79 @@ SelfProcess::findRDebugAddr() {
     return Elf::Addr(dlsym(RTLD_DEFAULT, "_r_debug"));
 }
 
+// Read a frame (saved frame pointer + return address) from our own address
+// space via the kernel, so a garbage frame pointer gets us EFAULT rather
+// than a nested fault inside the signal handler.
+static bool
+safeReadFrame(Elf::Addr addr, Elf::Addr (&frame)[2])
+{
+    iovec local { .iov_base = frame, .iov_len = sizeof frame };
+    iovec remote { .iov_base = reinterpret_cast<void *>(addr), .iov_len = sizeof frame };
+    return process_vm_readv(getpid(), &local, 1, &remote, 1, 0) == ssize_t(sizeof frame);
+}
+
+/*
+ * Async-signal-safe stack capture. Full eh_frame unwinding allocates all
+ * over the place, so from a signal handler we settle for the frame-pointer
+ * chain - we build with -fno-omit-frame-pointer for exactly this kind of
+ * job. Everything here is a stack local or a plain syscall.
+ */
+size_t
+threadFrames(const ucontext_t *uc, Elf::Addr *ips, size_t maxframes)
+{
+    Elf::Addr ip, bp, sp;
+#if defined(__amd64__)
+    ip = uc->uc_mcontext.gregs[REG_RIP];
+    bp = uc->uc_mcontext.gregs[REG_RBP];
+    sp = uc->uc_mcontext.gregs[REG_RSP];
+#elif defined(__i386__)
+    ip = uc->uc_mcontext.gregs[REG_EIP];
+    bp = uc->uc_mcontext.gregs[REG_EBP];
+    sp = uc->uc_mcontext.gregs[REG_ESP];
+#elif defined(__aarch64__)
+    ip = uc->uc_mcontext.pc;
+    bp = uc->uc_mcontext.regs[29];
+    sp = uc->uc_mcontext.sp;
+#else
+    (void)uc;
+    return 0;
+#endif
+    size_t count = 0;
+    if (count < maxframes)
+        ips[count++] = ip;
+    while (count < maxframes && bp > sp) {
+        Elf::Addr frame[2]; // { saved frame pointer, return address }
+        if (!safeReadFrame(bp, frame) || frame[1] < 4096)
+            break;
+        ips[count++] = frame[1];
+        if (frame[0] <= bp)
+            break; // chain must march up the stack.
+        sp = bp;
+        bp = frame[0];
+    }
+    return count;
+}
+
+ThreadStack
+SelfProcess::frameStack(const Elf::Addr *ips, size_t count)
+{
+    ThreadStack ts;
+    ts.info.ti_lid = lwpid_t(syscall(SYS_gettid));
+    Elf::CoreRegisters regs;
+    memset(&regs, 0, sizeof regs);
+    for (size_t i = 0; i < count; ++i) {
+#if defined(__aarch64__)
+        regs.pc = ips[i];
+#elif defined(__amd64__)
+        regs.rip = ips[i];
+#elif defined(__i386__)
+        regs.eip = ips[i];
+#endif
+        ts.stack.emplace_back(i == 0
+                ? UnwindMechanism::MACHINEREGS
+                : UnwindMechanism::FRAMEPOINTER, regs);
+    }
+    return ts;
+}
+
 }
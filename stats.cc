@@ -0,0 +1,35 @@
+#include "libpstack/stats.h"
+#include "libpstack/json.h"
+
+#include <ostream>
+
+namespace pstack::stats {
+
+std::atomic<uintmax_t> readerOps;
+std::atomic<uintmax_t> readerBytes;
+std::atomic<uintmax_t> cacheHits;
+std::atomic<uintmax_t> cacheMisses;
+std::atomic<uintmax_t> fdesDecoded;
+std::atomic<uintmax_t> diesMaterialized;
+std::atomic<uintmax_t> symbolsScanned;
+std::atomic<uintmax_t> phaseNsec[ph_count];
+
+void
+dump(std::ostream &os)
+{
+   JObject(os)
+      .field("reader-ops", readerOps.load())
+      .field("reader-bytes", readerBytes.load())
+      .field("cache-hits", cacheHits.load())
+      .field("cache-misses", cacheMisses.load())
+      .field("fdes-decoded", fdesDecoded.load())
+      .field("dies-materialized", diesMaterialized.load())
+      .field("symbols-scanned", symbolsScanned.load())
+      .field("load-nsec", phaseNsec[ph_load].load())
+      .field("unwind-nsec", phaseNsec[ph_unwind].load())
+      .field("symbolize-nsec", phaseNsec[ph_symbolize].load())
+      .field("print-nsec", phaseNsec[ph_print].load());
+   os << "\n";
+}
+
+}
@@ -0,0 +1,138 @@
+// Microbenchmarks for pstack's hot kernels. This is not run under ctest:
+// build the pstack-bench target and run it directly to put numbers on a
+// change, rather than wall-clocking runs against production cores. The
+// benchmarks use this binary's own ELF and DWARF as their fixture, so
+// results are comparable between runs of the same build.
+
+#include "libpstack/dwarf.h"
+#include "libpstack/dwarf_reader.h"
+#include "libpstack/proc.h"
+#include "libpstack/global.h"
+
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+using namespace pstack;
+
+namespace {
+
+/*
+ * Run body until it has consumed about half a second, and report the unit
+ * rate. The body returns the number of units it processed, and is run once
+ * before timing starts so lazily-built caches don't dominate: it's the
+ * steady state we're interested in.
+ */
+void
+bench(const char *name, const std::function<size_t()> &body)
+{
+    using clock = std::chrono::steady_clock;
+    size_t units = body();
+    if (units == 0) {
+        std::cout << std::left << std::setw(24) << name << "(no work - skipped)\n";
+        return;
+    }
+    units = 0;
+    auto start = clock::now();
+    std::chrono::duration<double> elapsed {};
+    do {
+        units += body();
+        elapsed = clock::now() - start;
+    } while (elapsed.count() < 0.5);
+    std::cout << std::left << std::setw(24) << name << std::right
+        << std::setw(12) << units << " ops "
+        << std::setw(12) << std::fixed << std::setprecision(1)
+        << elapsed.count() / double(units) * 1e9 << " ns/op\n";
+}
+
+void
+encodeULEB(std::vector<char> &buf, uintmax_t v)
+{
+    do {
+        unsigned char byte = v & 0x7f;
+        v >>= 7;
+        if (v != 0)
+            byte |= 0x80;
+        buf.push_back(char(byte));
+    } while (v != 0);
+}
+
+}
+
+int
+main(int, char *argv[])
+{
+    verbose = 0;
+    Dwarf::ImageCache cache;
+    auto exe = cache.getImageForName(argv[0]);
+    auto dwarf = cache.getDwarf(exe);
+
+    // ULEB decoding underlies walking DIE trees, line- and CFA-programs.
+    std::vector<char> lebs;
+    std::mt19937 rng(42);
+    for (size_t i = 0; i < 65536; ++i)
+        encodeULEB(lebs, rng() & ((1U << (rng() % 32)) - 1));
+    auto lebReader = std::make_shared<MemReader>("lebs", lebs.size(), lebs.data());
+    bench("readULEB128", [&]() {
+        Dwarf::DWARFReader r(lebReader, 0, lebs.size());
+        size_t count;
+        for (count = 0; !r.empty(); ++count)
+            r.getuleb128();
+        return count;
+    });
+
+    // Attribute and DIE decode: visit the top-level DIEs of every unit.
+    bench("DIE decode", [&]() {
+        size_t count = 0;
+        for (const auto &unit : dwarf->getUnits()) {
+            for (const auto &die : unit->root().children())
+                count += die.name().size() + 1;
+        }
+        return count;
+    });
+
+    // CFA programs: run every FDE's instructions to the end of its range.
+    auto cfi = dwarf->getCFI(Dwarf::FI_EH_FRAME);
+    bench("CIE::execInsns", [&]() {
+        size_t count = 0;
+        for (const auto &fde : cfi->getFDEs()) {
+            Dwarf::DWARFReader r(cfi->io, fde->instructions, fde->end);
+            cfi->getCIE(fde->cieOff).execInsns(r, fde->iloc, fde->iloc + fde->irange - 1);
+            ++count;
+        }
+        return count;
+    });
+
+    // Symbol lookup, for a present and an absent name - the latter is what
+    // the hash sections are supposed to make cheap.
+    bench("findSymbol hit", [&]() {
+        exe->findDebugSymbol("main");
+        return 1;
+    });
+    bench("findSymbol miss", [&]() {
+        exe->findDebugSymbol("no_such_symbol_anywhere");
+        return 1;
+    });
+
+    // Source lookup for the address of main - exercises unit lookup and the
+    // (cached) line tables.
+    auto [sym, idx] = exe->findDebugSymbol("main");
+    (void)idx;
+    bench("sourceFromAddr", [&]() {
+        return dwarf->sourceFromAddr(sym.st_value).size();
+    });
+
+    // Buffered reads through a CacheReader, the access pattern of core and
+    // live-process readers.
+    auto cached = std::make_shared<CacheReader>(std::make_shared<FileReader>(argv[0]));
+    auto size = cached->size();
+    bench("CacheReader::read", [&]() {
+        char buf[64];
+        size_t count;
+        for (count = 0; count < 1024; ++count)
+            cached->read(rng() % (size - sizeof buf), sizeof buf, buf);
+        return count;
+    });
+}
@@ -0,0 +1,37 @@
+#!/usr/bin/python3
+# Generate a C source with a large .debug_info - thousands of functions,
+# each with its own type and locals - as a fixture for perf-test.py. The
+# functions form a call chain, so running the binary also gives a deep
+# stack to unwind.
+
+import sys
+
+out = sys.argv[1]
+count = int(sys.argv[2]) if len(sys.argv) > 2 else 2000
+
+with open(out, "w") as f:
+    f.write("#include <unistd.h>\n")
+    f.write("volatile long sink;\n")
+    for i in range(count):
+        f.write("long func_%d(long arg);\n" % i)
+    for i in range(count):
+        call = "func_%d(arg + 1)" % (i + 1) if i + 1 < count else "arg"
+        f.write("""
+struct record_%d { long a; long b; char name[32]; };
+long func_%d(long arg)
+{
+    struct record_%d r = { arg, arg * 2, "fixture" };
+    sink += r.a + r.b;
+    return %s;
+}
+""" % (i, i, i, call))
+    f.write("""
+int main(int argc, char **argv)
+{
+    (void)argv;
+    sink = func_0(argc);
+    if (argc > 1)
+        pause(); /* park at the bottom of the chain for attach tests */
+    return 0;
+}
+""")
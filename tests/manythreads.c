@@ -0,0 +1,43 @@
+/*
+ * Synthesizes the shape of process that hurts analysis time: many
+ * threads, each with a deep stack. All the threads recurse, meet at the
+ * barrier, and then the main thread aborts, so pstack reports every
+ * stack. perf-test.py asserts a time budget on that run.
+ */
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+#define NTHREADS 64
+#define DEPTH 50
+
+static pthread_barrier_t barrier;
+
+void *
+deep(long depth)
+{
+    if (depth != 0)
+        return deep(depth - 1);
+    pthread_barrier_wait(&barrier);
+    pause();
+    return 0;
+}
+
+static void *
+entry(void *unused)
+{
+    (void)unused;
+    return deep(DEPTH);
+}
+
+int
+main(void)
+{
+    pthread_t tid;
+    pthread_barrier_init(&barrier, 0, NTHREADS + 1);
+    for (int i = 0; i < NTHREADS; ++i)
+        pthread_create(&tid, 0, entry, 0);
+    pthread_barrier_wait(&barrier);
+    raise(SIGABRT);
+    return 0;
+}
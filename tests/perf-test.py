@@ -0,0 +1,46 @@
+#!/usr/bin/python3
+# Timing gates over synthesized large fixtures: a many-thread deep-stack
+# process, and an executable with a few thousand functions' worth of
+# .debug_info. The budgets are deliberately generous - they catch the
+# "this release doubled core-analysis time" class of regression, not
+# small drift - and the measured times are printed for trending.
+
+import os
+import subprocess
+import time
+
+import pstack
+
+BUDGET = float(os.environ.get("PSTACK_PERF_BUDGET", "30"))
+PSTACK_BIN = os.environ.get("PSTACK_BIN", "pstack")
+
+
+def timed(name, func):
+    start = time.monotonic()
+    rv = func()
+    elapsed = time.monotonic() - start
+    print("%-24s %6.2fs (budget %.0fs)" % (name, elapsed, BUDGET))
+    assert elapsed < BUDGET, "%s took %.2fs, budget is %.0fs" % (
+        name, elapsed, BUDGET)
+    return rv
+
+
+# 64 threads, each 50 frames deep.
+out, _ = timed("pstack many-threads", lambda: pstack.TEXT(["tests/manythreads"]))
+assert out.count("thread:") >= 64
+assert "deep" in out
+
+# Dump all the DWARF of the big image.
+with open(os.devnull, "w") as null:
+    timed("pstack -D bigdwarf", lambda: subprocess.check_call(
+        ["./%s" % PSTACK_BIN, "-D", "tests/bigdwarf"], stdout=null))
+
+# canal's symbol census against a parked instance of the big image.
+target = subprocess.Popen(["tests/bigdwarf", "wait"])
+try:
+    time.sleep(0.5)  # let it get to the bottom of the call chain.
+    with open(os.devnull, "w") as null:
+        timed("canal bigdwarf", lambda: subprocess.check_call(
+            ["./canal", "tests/bigdwarf", str(target.pid)], stdout=null))
+finally:
+    target.kill()
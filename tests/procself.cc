@@ -3,6 +3,7 @@
 #include "libpstack/archreg.h"
 #include <unistd.h>
 #include <cassert>
+#include <csignal>
 
 extern "C" {
 int foobar() {
@@ -26,5 +27,22 @@ main()
 
     std::cout << "found foobar in " << *lib->io << "@" << addr << ", value=" << sym.st_value << ", size=" << sym.st_size << std::endl;
     assert(pstack::Elf::Addr(foobar) == addr + sym.st_value);
+
+    // Capture our own stack the way a crash handler would, then symbolize
+    // the result once we're back out of the handler.
+    static pstack::Elf::Addr ips[64];
+    static size_t ipCount;
+    struct sigaction sa {};
+    sa.sa_flags = SA_SIGINFO;
+    sa.sa_sigaction = [] (int, siginfo_t *, void *uc) {
+        ipCount = pstack::Procman::threadFrames(
+                static_cast<ucontext_t *>(uc), ips, 64);
+    };
+    sigaction(SIGUSR1, &sa, nullptr);
+    raise(SIGUSR1);
+    assert(ipCount > 0);
+    auto self = dynamic_cast<pstack::Procman::SelfProcess *>(p.get());
+    auto stack = self->frameStack(ips, ipCount);
+    p->dumpStackText(std::cout, stack);
     return 0;
 }
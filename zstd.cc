@@ -0,0 +1,104 @@
+#include "libpstack/zstdreader.h"
+#include "libpstack/global.h"
+
+#include <string.h>
+
+namespace pstack {
+
+// Granularity of the decoded-block cache. Big enough that the per-block
+// bookkeeping is noise, small enough that a sparse read pattern doesn't
+// balloon memory too far past what was actually asked for.
+static constexpr size_t blockSize = 1024 * 1024;
+
+ZstdReader::ZstdReader(Reader::csptr upstream_)
+    : upstream{std::move(upstream_)}
+    , stream{ZSTD_createDStream()}
+{
+    if (stream == nullptr)
+        throw (Exception() << "can't create zstd stream");
+    // The frame header records the content size if the compressor knew it.
+    // If it didn't, size() has to decode the entire stream to find out.
+    char header[32];
+    size_t got = upstream->read(0, sizeof header, header);
+    auto contentSize = ZSTD_getFrameContentSize(header, got);
+    knownSize = contentSize == ZSTD_CONTENTSIZE_UNKNOWN
+            || contentSize == ZSTD_CONTENTSIZE_ERROR
+        ? Off(-1)
+        : Off(contentSize);
+    input.resize(ZSTD_DStreamInSize());
+    if (verbose >= 2)
+        *debug << "zstd inflate: " << *this << "\n";
+}
+
+// Advance the decode frontier until "offset" bytes of output exist (or the
+// stream is exhausted), filing each blockSize chunk of output in the cache.
+void
+ZstdReader::decodeTo(Off offset) const
+{
+    while (decoded < offset && !eof) {
+        if (inputPos == inputAvail) {
+            inputAvail = upstream->read(inputOffset, input.size(), &input[0]);
+            inputOffset += inputAvail;
+            inputPos = 0;
+            if (inputAvail == 0) {
+                eof = true;
+                break;
+            }
+        }
+        Off blockStart = decoded - decoded % blockSize;
+        auto &block = blocks[blockStart];
+        if (block.empty())
+            block.resize(blockSize);
+        ZSTD_outBuffer out { &block[0], block.size(), size_t(decoded - blockStart) };
+        ZSTD_inBuffer in { &input[0], inputAvail, inputPos };
+        // A zero return just means "end of frame" - cores may be written as
+        // several concatenated frames, so keep going until the input runs dry.
+        size_t rc = ZSTD_decompressStream(stream, &out, &in);
+        if (ZSTD_isError(rc) != 0u)
+            throw (Exception() << "zstd decode failed at offset " << decoded
+                    << ": " << ZSTD_getErrorName(rc));
+        inputPos = in.pos;
+        decoded = blockStart + Off(out.pos);
+    }
+}
+
+size_t
+ZstdReader::read(Off offset, size_t size, char *data) const
+{
+    decodeTo(offset + Off(size));
+    size_t startSize = size;
+    while (size != 0 && offset < decoded) {
+        Off blockStart = offset - offset % blockSize;
+        const auto &block = blocks.at(blockStart);
+        size_t blockOff = offset - blockStart;
+        size_t amount = std::min(Off(std::min(block.size() - blockOff, size)),
+                decoded - offset);
+        memcpy(data, &block[blockOff], amount);
+        size -= amount;
+        offset += amount;
+        data += amount;
+    }
+    return startSize - size;
+}
+
+Reader::Off
+ZstdReader::size() const
+{
+    if (knownSize == Off(-1)) {
+        decodeTo(std::numeric_limits<Off>::max());
+        knownSize = decoded;
+    }
+    return knownSize;
+}
+
+void
+ZstdReader::describe(std::ostream &os) const
+{
+    os << "zstd compressed " << *upstream;
+}
+
+ZstdReader::~ZstdReader()
+{
+    ZSTD_freeDStream(stream);
+}
+}